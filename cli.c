@@ -2,11 +2,38 @@
 #include "custom_fgets.h"
 #include "filesystem.h"
 #include "flash_ops.h"
+#include "proto.h"
 #include "tests.h"
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// Result of the last command run by execute_command, see cli.h
+int cli_status;
+
+// Scripts being run by 'source', one within the other
+static int source_depth;
+
+// Set while commands are read in batch mode
+static bool batch_mode;
+
+/**
+ * @brief Prints a message about the outcome of a command, unless in batch
+ * mode, where the result of the command that follows it says the same.
+ *
+ * @param format The format of the message, as for printf.
+ */
+static void say(const char *format, ...) {
+    if (batch_mode) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
 /**
  * @brief Executes a command based on the input string.
  *
@@ -25,7 +52,8 @@
  *  5. seek: <fd> <offset> <whence> - Moves the file pointer to a specified
  * position in the file.
  *  6. ls: - Lists all files in the filesystem.
- *  7. wipe: - Wipes all files from the filesystem.
+ *  7. wipe: [lazy] - Wipes all files from the filesystem, leaving their
+ *  sectors to be erased in the background if lazy is given.
  *  8. create: <filename> - Creates a new file with the specified filename.
  *  9. rm: <filename> - Removes the file with the specified filename.
  *  10. format: <filename> - Formats the file with the specified filename.
@@ -35,16 +63,39 @@
  *  location to another.
  *  13. exit: - exits
  *  14. test: - runs the unit tests
+ *  15. sync: <fd> - Writes everything buffered for the file with the
+ *  specified file descriptor to flash.
+ *  16. wear: - Prints how many times each sector has been erased.
+ *  17. stats: [reset] - Prints the performance counters, or resets them.
+ *  18. latency: - Prints the median, 99th percentile and longest latency of
+ *  each timed operation and of the windows with interrupts disabled.
+ *  19. mkdir: <path> - Creates a directory.
+ *  20. rmdir: <path> - Removes an empty directory.
+ *  21. scrub: [sectors] - Checks the next sectors holding file data against
+ *  their CRC32, every one of them if no number is given.
+ *  22. df: - Prints the free space of the volume.
+ *  23. binary: - Switches to the binary protocol of proto.h until the other
+ *  end quits it, for moving files with a client such as host/fs_client.
+ *  24. batch: - Reads commands without echo or prompts, acknowledging each
+ *  with its result, until exit.
+ *  25. source: <filename> - Runs the commands of a script stored in the
+ *  filesystem, stopping at the first that fails.
+ *
+ * Filenames are paths, with directories separated by '/'. The result of the
+ * command is left in cli_status.
  *
  * @param command The command string to execute.
+ * @return 1 if the command was exit, otherwise 0.
  */
 int execute_command(char *command) {
     // Tokenize the command string to extract the command keyword
     char *token = strtok(command, " ");
 
     // Check if the command string is empty
+    cli_status = 0;
     if (token == NULL) {
-        printf("\nInvalid command\n");
+        cli_status = CLI_UNKNOWN_COMMAND;
+        say("\nInvalid command\n");
         return 0;
     }
 
@@ -54,6 +105,8 @@ int execute_command(char *command) {
         handle_open_command();
     } else if (strcmp(token, "close") == 0) { // close: <fd>
         handle_close_command();
+    } else if (strcmp(token, "sync") == 0) { // sync: <fd>
+        handle_sync_command();
     } else if (strcmp(token, "read") == 0) { // read: <fd> <size>
         handle_read_command();
     } else if (strcmp(token, "write") == 0) { // write: <fd> <string>
@@ -62,12 +115,26 @@ int execute_command(char *command) {
         handle_seek_command();
     } else if (strcmp(token, "ls") == 0) { // ls
         handle_ls_command();
-    } else if (strcmp(token, "wipe") == 0) { // wipe
+    } else if (strcmp(token, "wear") == 0) { // wear
+        handle_wear_command();
+    } else if (strcmp(token, "df") == 0) { // df
+        handle_df_command();
+    } else if (strcmp(token, "stats") == 0) { // stats: [reset]
+        handle_stats_command();
+    } else if (strcmp(token, "latency") == 0) { // latency
+        handle_latency_command();
+    } else if (strcmp(token, "scrub") == 0) { // scrub: [sectors]
+        handle_scrub_command();
+    } else if (strcmp(token, "wipe") == 0) { // wipe: [lazy]
         handle_wipe_command();
     } else if (strcmp(token, "create") == 0) { // create: <filename>
         handle_create_command();
     } else if (strcmp(token, "rm") == 0) { // rm: <filename>
         handle_rm_command();
+    } else if (strcmp(token, "mkdir") == 0) { // mkdir: <path>
+        handle_mkdir_command();
+    } else if (strcmp(token, "rmdir") == 0) { // rmdir: <path>
+        handle_rmdir_command();
     } else if (strcmp(token, "format") == 0) { // format: <filename>
         handle_format_command();
     } else if (strcmp(token, "mv") == 0) { // mv: <old_filename> <new_filename>
@@ -75,6 +142,12 @@ int execute_command(char *command) {
     } else if (strcmp(token, "cp") ==
                0) { // cp: <source_filename> <destination_filename>
         handle_cp_command();
+    } else if (strcmp(token, "binary") == 0) { // binary
+        handle_binary_command();
+    } else if (strcmp(token, "batch") == 0) { // batch
+        handle_batch_command();
+    } else if (strcmp(token, "source") == 0) { // source: <filename>
+        handle_source_command();
     } else if (strcmp(token, "test") == 0) { // test
         run_tests();
     } else if (strcmp(token, "exit") == 0) { // exit
@@ -86,6 +159,34 @@ int execute_command(char *command) {
     return 0;
 }
 
+/**
+ * @brief Prints what is wrong with the arguments of a command, which fails
+ * with CLI_BAD_ARGUMENTS.
+ *
+ * @param message The message, without newlines.
+ */
+static void usage(const char *message) {
+    cli_status = CLI_BAD_ARGUMENTS;
+    say("\n%s\n", message);
+}
+
+/**
+ * @brief Prints the message of an error about a path.
+ *
+ * @param error The error code returned by a filesystem function.
+ */
+static void print_path_error(int error) {
+    if (error == INVALID_PATH) {
+        say("\nInvalid path\n");
+    } else if (error == NOT_A_DIRECTORY) {
+        say("\nNot a directory\n");
+    } else if (error == IS_A_DIRECTORY) {
+        say("\nIs a directory\n");
+    } else if (error == DIRECTORY_NOT_EMPTY) {
+        say("\nDirectory not empty\n");
+    }
+}
+
 /**
  * @brief Handles the 'open' command to open a file with the specified name
  * and mode.
@@ -103,7 +204,7 @@ void handle_open_command() {
     // Extract the filename and mode from the command string
     char *token = strtok(NULL, " ");
     if (token == NULL) {
-        printf("\nOpen needs a name\n");
+        usage("Open needs a name");
         return;
     }
     char *name = token;
@@ -111,15 +212,38 @@ void handle_open_command() {
     // Extract the mode from the command string
     token = strtok(NULL, " ");
     if (token == NULL) {
-        printf("\nOpen needs a mode\n");
+        usage("Open needs a mode");
         return;
     }
     int m = 0;
 
+    // Check if the mode ends with the 'b' character to indicate write-back
+    size_t length = strlen(token);
+    if (length > 1 && token[length - 1] == 'b') {
+        token[length - 1] = '\0';
+        m = MODE_WRITEBACK;
+    }
+
+    // Check if the mode then ends with the 'z' character to indicate
+    // compression
+    length = strlen(token);
+    if (length > 1 && token[length - 1] == 'z') {
+        token[length - 1] = '\0';
+        m |= MODE_COMPRESS;
+    }
+
+    // Check if the mode then ends with the 'v' character to indicate that
+    // reads are verified
+    length = strlen(token);
+    if (length > 1 && token[length - 1] == 'v') {
+        token[length - 1] = '\0';
+        m |= MODE_VERIFY;
+    }
+
     // Check if the mode contains the 'c' character to indicate create mode
     if (strstr(token, "c") != NULL) {
         token[strlen(token) - 1] = '\0';
-        m = MODE_CREATE;
+        m |= MODE_CREATE;
     }
     // Check if the mode contains the 'r', 'w', or 'a' characters to
     // indicate read,
@@ -134,29 +258,30 @@ void handle_open_command() {
     } else if (strcmp(token, "aw") == 0) {
         m |= MODE_APPEND | MODE_WRITE;
     } else {
-        printf("\nUnknown mode\n");
+        usage("Unknown mode");
         return;
     }
 
     // Attempt to open the file with the specified name and mode
     int fd = fs_open(name, m);
+    cli_status = fd;
 
     // Print appropriate messages based on the result of the fs_open
     // function
     if (fd == FILE_NOT_FOUND) {
-        if (check_mode(m, MODE_CREATE)) {
-            printf("\nFile not found and memory full\n");
-        } else {
-            printf("\nFile not found\n");
-        }
+        say("\nFile not found\n");
+    } else if (fd == FILE_TABLE_FULL) {
+        say("\nMemory is full\n");
     } else if (fd == FILE_ALREADY_OPEN) {
-        printf("\nFile already opened\n");
+        say("\nFile already opened\n");
     } else if (fd == OPENED_FILES_FULL) {
-        printf("\nNo more file descriptors\n");
+        say("\nNo more file descriptors\n");
     } else if (fd == INCORRECT_MODE) {
-        printf("\nCannot open in read and append mode\n");
+        say("\nCannot open in read and append mode\n");
+    } else if (fd < 0) {
+        print_path_error(fd);
     } else {
-        printf("\nFile opened with fd %d\n", fd);
+        say("\nFile opened with fd %d\n", fd);
     }
 }
 /**
@@ -175,13 +300,34 @@ void handle_close_command() {
     // Extract the file descriptor from the command string
     char *token = strtok(NULL, " ");
     if (token == NULL) {
-        printf("\nClose needs a file descriptor\n");
+        usage("Close needs a file descriptor");
         return;
     }
     int fd = atoi(token);
     fs_close(fd);
 }
 
+/**
+ * @brief Handles the 'sync' command to write everything buffered for a file
+ * with the specified file descriptor to flash.
+ *
+ * This function parses the 'sync' command, extracts the file descriptor from
+ * the command string and calls the fs_sync function to flush the file.
+ */
+void handle_sync_command() {
+    // Extract the file descriptor from the command string
+    char *token = strtok(NULL, " ");
+    if (token == NULL) {
+        usage("Sync needs a file descriptor");
+        return;
+    }
+    int fd = atoi(token);
+    cli_status = fs_sync(fd);
+    if (cli_status == FILE_NOT_OPEN) {
+        say("\nFile not opened\n");
+    }
+}
+
 /**
  * @brief Handles the 'read' command to read data from a file with the
  * specified file descriptor.
@@ -199,27 +345,35 @@ void handle_read_command() {
     // Extract the file descriptor and size from the command string
     char *token = strtok(NULL, " ");
     if (token == NULL) {
-        printf("\nRead needs a file descriptor\n");
+        usage("Read needs a file descriptor");
         return;
     }
     int fd = atoi(token);
     // Extract the size of data to read from the command string
     token = strtok(NULL, " ");
     if (token == NULL) {
-        printf("\nRead needs a size\n");
+        usage("Read needs a size");
         return;
     }
     int size = atoi(token);
     char buffer[size];
     int read = fs_read(fd, buffer, size);
+    cli_status = read;
     // Print appropriate messages based on the result of the fs_read
     // function
     if (read == FILE_NOT_OPEN) {
-        printf("\nIncorrect file descriptor\n");
+        say("\nIncorrect file descriptor\n");
     } else if (read == INCORRECT_MODE) {
-        printf("\nFile not open for reading\n");
+        say("\nFile not open for reading\n");
+    } else if (read == DATA_CORRUPT) {
+        say("\nFile data does not match its checksum\n");
     } else {
-        printf("\nRead %d bytes: %.*s\n", read, read, buffer);
+        // In batch mode the data alone, its length going in the result
+        if (batch_mode) {
+            printf("%.*s\n", read, buffer);
+        } else {
+            printf("\nRead %d bytes: %.*s\n", read, read, buffer);
+        }
     }
 }
 
@@ -240,28 +394,36 @@ void handle_write_command() {
     // Extract the file descriptor from the command string
     char *token = strtok(NULL, " ");
     if (token == NULL) {
-        printf("\nWrite needs a file descriptor\n");
+        usage("Write needs a file descriptor");
         return;
     }
     int fd = atoi(token);
     // Extract the string to write from the command string
     token = strtok(NULL, "\"");
     if (token == NULL) {
-        printf("\nWrite needs a string\n");
+        usage("Write needs a string");
         return;
     }
     int size = strlen(token);
     int written = fs_write(fd, token, size);
+    cli_status = written;
     // Print appropriate messages based on the result of the fs_write
     // function
     if (written == FILE_NOT_OPEN) {
-        printf("\nIncorrect file descriptor\n");
+        say("\nIncorrect file descriptor\n");
     } else if (written == INCORRECT_MODE) {
-        printf("\nFile not open for writing\n");
+        say("\nFile not open for writing\n");
     } else if (written == OVERFLOW) {
-        printf("\nData size exceeds maximum file size\n");
+        say("\nData size exceeds maximum file size\n");
+    } else if (written == NO_SPACE) {
+        say("\nNo space left on the filesystem\n");
+    } else if (written == INVALID_POSITION) {
+        say("\nCompressed files can only be written from their last "
+            "block\n");
+    } else if (written == DATA_CORRUPT) {
+        say("\nFile data does not match its checksum\n");
     } else {
-        printf("\nWrote %d bytes\n", written);
+        say("\nWrote %d bytes\n", written);
     }
 }
 
@@ -283,21 +445,21 @@ void handle_seek_command() {
     // Extract the file descriptor from the command string
     char *token = strtok(NULL, " ");
     if (token == NULL) {
-        printf("\nSeek needs a file descriptor\n");
+        usage("Seek needs a file descriptor");
         return;
     }
     int fd = atoi(token);
     // Extract the offset parameter from the command string
     token = strtok(NULL, " ");
     if (token == NULL) {
-        printf("\nSeek needs an offset\n");
+        usage("Seek needs an offset");
         return;
     }
     long offset = atoi(token);
     // Extract the whence parameter from the command string
     token = strtok(NULL, " ");
     if (token == NULL) {
-        printf("\nSeek needs a 'set', 'cur', or 'end' parameter\n");
+        usage("Seek needs a 'set', 'cur', or 'end' parameter");
         return;
     }
     int whence = 0;
@@ -309,16 +471,17 @@ void handle_seek_command() {
     } else if (strcmp(token, "end") == 0) {
         whence = FS_SEEK_END;
     } else {
-        printf("\nUnknown whence parameter\n");
+        usage("Unknown whence parameter");
         return;
     }
     int seek = fs_seek(fd, offset, whence);
+    cli_status = seek;
     // Print appropriate messages based on the result of the fs_seek
     // function
     if (seek == FILE_NOT_OPEN) {
-        printf("\nIncorrect file descriptor\n");
+        say("\nIncorrect file descriptor\n");
     } else {
-        printf("\nSeeked to position %d\n", seek);
+        say("\nSeeked to position %d\n", seek);
     }
 }
 
@@ -328,15 +491,160 @@ void handle_seek_command() {
  * This function calls the fs_ls function to list all files in the
  * filesystem.
  */
-void handle_ls_command() { printf("\nThe system has %d files\n", fs_ls()); }
+void handle_ls_command() {
+    cli_status = fs_ls();
+    say("\nThe system has %d files\n", cli_status);
+}
+
+/**
+ * @brief Handles the 'wear' command to print the erase count of every sector.
+ *
+ * This function prints how many times each sector has been erased, followed
+ * by the least, average and most erases of a sector and how much of the
+ * rated endurance the most worn sector has used.
+ */
+void handle_wear_command() {
+    static uint32_t counts[FS_NUM_SECTORS];
+    int sectors = fs_wear(counts);
+    uint32_t min = counts[0];
+    uint32_t max = counts[0];
+    uint64_t total = 0;
+
+    printf("\nsector erases\n");
+    for (int i = 0; i < sectors; i++) {
+        printf("%d %u\n", i, (unsigned)counts[i]);
+        min = counts[i] < min ? counts[i] : min;
+        max = counts[i] > max ? counts[i] : max;
+        total += counts[i];
+    }
+    printf("min %u avg %u max %u, %.2f%% of %d cycles used\n", (unsigned)min,
+           (unsigned)(total / sectors), (unsigned)max,
+           100.0 * max / FS_ENDURANCE, FS_ENDURANCE);
+}
+
+/**
+ * @brief Handles the 'df' command to print the free space of the volume.
+ *
+ * This function prints how many data sectors are free, how many of those are
+ * already erased, and how many entries of the file table are unused.
+ */
+void handle_df_command() {
+    FsSpace space = fs_df();
+    printf("\n%u of %u sectors free (%u KB), %u of them erased\n",
+           (unsigned)space.free_sectors, (unsigned)space.sectors,
+           (unsigned)(space.free_sectors * FS_SECTOR_SIZE / 1024),
+           (unsigned)space.erased_sectors);
+    printf("%u of %d entries free\n", (unsigned)space.free_entries,
+           FS_MAX_FILES);
+}
+
+/**
+ * @brief Handles the 'stats' command to print or reset the performance
+ * counters.
+ *
+ * This function prints the counters of flash operations and filesystem work
+ * made since they were last reset, or resets them if the command is followed
+ * by 'reset'.
+ */
+void handle_stats_command() {
+    char *token = strtok(NULL, " ");
+    if (token != NULL && strcmp(token, "reset") == 0) {
+        fs_reset_stats();
+        say("\nStats reset\n");
+        return;
+    }
+
+    FsStats stats = fs_get_stats();
+    printf("\nflash erases        %u sectors, %u blocks\n",
+           (unsigned)stats.flash.erases, (unsigned)stats.flash.block_erases);
+    printf("flash programs      %u pages, %llu bytes\n",
+           (unsigned)stats.flash.programs,
+           (unsigned long long)stats.flash.bytes_programmed);
+    printf("flash reads         %u, %llu bytes\n", (unsigned)stats.flash.reads,
+           (unsigned long long)stats.flash.bytes_read);
+    printf("flash CRCs          %u, %llu bytes\n", (unsigned)stats.flash.crcs,
+           (unsigned long long)stats.flash.bytes_crc);
+    printf("interrupts off      %llu us\n",
+           (unsigned long long)stats.flash.irq_off_us);
+    printf("table updates       %u\n", (unsigned)stats.table_updates);
+    printf("buffer clears       %u\n", (unsigned)stats.buffer_clears);
+    printf("cache hits          %u\n", (unsigned)stats.cache_hits);
+    printf("cache misses        %u\n", (unsigned)stats.cache_misses);
+    printf("bytes read          %llu\n", (unsigned long long)stats.bytes_read);
+    printf("bytes written       %llu\n",
+           (unsigned long long)stats.bytes_written);
+    printf("sectors verified    %u, %u corrupt\n",
+           (unsigned)stats.sectors_verified, (unsigned)stats.corrupt_sectors);
+}
+
+/**
+ * @brief Prints a row of the latency table.
+ *
+ * @param name The name of the operation.
+ * @param hist The histogram of its latencies.
+ */
+static void print_latency(const char *name, const Histogram *hist) {
+    printf("%-9s %8u %8llu %8llu %8llu\n", name, (unsigned)hist->samples,
+           (unsigned long long)hist_percentile(hist, 50),
+           (unsigned long long)hist_percentile(hist, 99),
+           (unsigned long long)hist->max_us);
+}
+
+/**
+ * @brief Handles the 'latency' command to print the latency of operations.
+ *
+ * This function prints, for the windows with interrupts disabled and each
+ * timed filesystem operation, the number of samples since the counters were
+ * last reset and their median, 99th percentile and longest latency in
+ * microseconds. Percentiles are the upper bound of their histogram bucket.
+ */
+void handle_latency_command() {
+    static const char *names[FS_OPS] = {"open", "read", "write",
+                                        "cp",   "mv",   "rm"};
+    FsStats stats = fs_get_stats();
+
+    printf("\n%-9s %8s %8s %8s %8s\n", "operation", "samples", "p50 us",
+           "p99 us", "max us");
+    print_latency("irq off", &stats.flash.irq_off);
+    for (int i = 0; i < FS_OPS; i++) {
+        print_latency(names[i], &stats.latency[i]);
+    }
+}
+
+/**
+ * @brief Handles the 'scrub' command to check file data against its CRC32.
+ *
+ * This function checks the given number of sectors holding file data with
+ * fs_scrub, or every such sector if no number is given, and prints how many
+ * did not match.
+ */
+void handle_scrub_command() {
+    char *token = strtok(NULL, " ");
+    int sectors = token != NULL ? atoi(token) : FS_NUM_SECTORS;
+    FsStats before = fs_get_stats();
+    int corrupt = fs_scrub(sectors);
+    cli_status = corrupt > 0 ? DATA_CORRUPT : 0;
+    FsStats after = fs_get_stats();
+    say("\nChecked %u sectors, %d corrupt\n",
+        (unsigned)(after.sectors_verified - before.sectors_verified),
+        corrupt);
+}
 
 /**
  * @brief Handles the 'wipe' command to wipe all files from the filesystem.
  *
  * This function calls the fs_wipe function to wipe all files from the
- * filesystem.
+ * filesystem, or fs_wipe_lazy if the argument is "lazy", which leaves the
+ * sectors to be erased while the command loop is idle.
  */
-void handle_wipe_command() { fs_wipe(); }
+void handle_wipe_command() {
+    char *token = strtok(NULL, " ");
+    if (token != NULL && strcmp(token, "lazy") == 0) {
+        fs_wipe_lazy();
+    } else {
+        fs_wipe();
+    }
+}
 
 /**
  * @brief Handles the 'create' command to create a new file with the
@@ -354,16 +662,21 @@ void handle_create_command() {
     // Extract the filename from the command string
     char *token = strtok(NULL, " ");
     if (token == NULL) {
-        printf("\nCreate needs a name\n");
+        usage("Create needs a name");
         return;
     }
     int create = fs_create(token);
+    cli_status = create < 0 ? create : 0;
     // Print appropriate messages based on the result of the fs_create
     // function
     if (create == FILE_ALREADY_EXISTS) {
-        printf("\nFile already exists\n");
+        say("\nFile already exists\n");
     } else if (create == FILE_TABLE_FULL) {
-        printf("\nMemory is full\n");
+        say("\nMemory is full\n");
+    } else if (create == FILE_NOT_FOUND) {
+        say("\nDirectory not found\n");
+    } else {
+        print_path_error(create);
     }
 }
 
@@ -382,12 +695,64 @@ void handle_rm_command() {
     // Extract the filename from the command string
     char *token = strtok(NULL, " ");
     if (token == NULL) {
-        printf("\nRemove needs a name\n");
+        usage("Remove needs a name");
         return;
     }
     // Call the fs_rm function to remove the file with the specified name
-    if (fs_rm(token) == FILE_NOT_FOUND) {
-        printf("\nFile not found\n");
+    int removed = fs_rm(token);
+    cli_status = removed < 0 ? removed : 0;
+    if (removed == FILE_NOT_FOUND) {
+        say("\nFile not found\n");
+    } else {
+        print_path_error(removed);
+    }
+}
+
+/**
+ * @brief Handles the 'mkdir' command to create a directory.
+ *
+ * This function parses the 'mkdir' command and calls the fs_mkdir function
+ * to create a directory at the specified path, printing a message if it
+ * fails.
+ */
+void handle_mkdir_command() {
+    char *token = strtok(NULL, " ");
+    if (token == NULL) {
+        usage("Mkdir needs a path");
+        return;
+    }
+    int made = fs_mkdir(token);
+    cli_status = made < 0 ? made : 0;
+    if (made == FILE_ALREADY_EXISTS) {
+        say("\nFile already exists\n");
+    } else if (made == FILE_TABLE_FULL) {
+        say("\nMemory is full\n");
+    } else if (made == FILE_NOT_FOUND) {
+        say("\nDirectory not found\n");
+    } else {
+        print_path_error(made);
+    }
+}
+
+/**
+ * @brief Handles the 'rmdir' command to remove an empty directory.
+ *
+ * This function parses the 'rmdir' command and calls the fs_rmdir function
+ * to remove the directory at the specified path, printing a message if it
+ * fails.
+ */
+void handle_rmdir_command() {
+    char *token = strtok(NULL, " ");
+    if (token == NULL) {
+        usage("Rmdir needs a path");
+        return;
+    }
+    int removed = fs_rmdir(token);
+    cli_status = removed < 0 ? removed : 0;
+    if (removed == FILE_NOT_FOUND) {
+        say("\nDirectory not found\n");
+    } else {
+        print_path_error(removed);
     }
 }
 
@@ -406,13 +771,17 @@ void handle_format_command() {
     // Extract the filename from the command string
     char *token = strtok(NULL, " ");
     if (token == NULL) {
-        printf("\nFormat needs a name\n");
+        usage("Format needs a name");
         return;
     }
     // Call the fs_format function to format the file with the specified
     // name
-    if (fs_format(token) == FILE_NOT_FOUND) {
-        printf("\nFile not found\n");
+    int formatted = fs_format(token);
+    cli_status = formatted < 0 ? formatted : 0;
+    if (formatted == FILE_NOT_FOUND) {
+        say("\nFile not found\n");
+    } else {
+        print_path_error(formatted);
     }
 }
 
@@ -433,18 +802,26 @@ void handle_mv_command() {
     // Extract the source and destination filenames from the command string
     char *token = strtok(NULL, " ");
     if (token == NULL) {
-        printf("\nMove needs 2 names\n");
+        usage("Move needs 2 names");
         return;
     }
     // Extract the destination filename from the command string
     char *to = strtok(NULL, " ");
     if (to == NULL) {
-        printf("\nMove needs 2 names\n");
+        usage("Move needs 2 names");
         return;
     }
     // Call the fs_mv function to move the file from the source to the
-    if (fs_mv(token, to) == FILE_NOT_FOUND) {
-        printf("\nFile not found\n");
+    int moved = fs_mv(token, to);
+    cli_status = moved < 0 ? moved : 0;
+    if (moved == FILE_NOT_FOUND) {
+        say("\nFile not found\n");
+    } else if (moved == FILE_ALREADY_EXISTS) {
+        say("\nFile already exists\n");
+    } else if (moved == NO_SPACE) {
+        say("\nNo space left on the filesystem\n");
+    } else {
+        print_path_error(moved);
     }
 }
 
@@ -465,20 +842,171 @@ void handle_cp_command() {
     // Extract the source and destination filenames from the command string
     char *token = strtok(NULL, " ");
     if (token == NULL) {
-        printf("\nCopy needs 2 names\n");
+        usage("Copy needs 2 names");
         return;
     }
     // Extract the destination filename from the command string
     char *to = strtok(NULL, " ");
     if (to == NULL) {
-        printf("\nCopy needs 2 names\n");
+        usage("Copy needs 2 names");
         return;
     }
     // Call the fs_cp function to copy the file from the source to the
     // destination
-    if (fs_cp(token, to) == FILE_NOT_FOUND) {
-        printf("\nFile not found\n");
+    int copied = fs_cp(token, to);
+    cli_status = copied < 0 ? copied : 0;
+    if (copied == FILE_NOT_FOUND) {
+        say("\nFile not found\n");
+    } else if (copied == FILE_TABLE_FULL) {
+        say("\nMemory is full\n");
+    } else if (copied == NO_SPACE) {
+        say("\nNo space left on the filesystem\n");
+    } else {
+        print_path_error(copied);
+    }
+}
+
+/**
+ * @brief Handles the 'binary' command to run the binary protocol.
+ *
+ * This function hands the input and output over to proto_serve, which
+ * returns once the client sends PROTO_QUIT.
+ */
+void handle_binary_command() { proto_serve(); }
+
+/**
+ * @brief Tells whether a line of commands is blank or a comment, which
+ * batch mode and scripts skip.
+ *
+ * @param line The line.
+ * @return true if the line is empty, only spaces or starts with '#'.
+ */
+static bool skip_line(const char *line) {
+    while (*line == ' ') {
+        line++;
     }
+    return *line == '\0' || *line == '#';
+}
+
+/**
+ * @brief Handles the 'batch' command to run commands sent by a program.
+ *
+ * Commands are read without echo and without prompts, and each is followed
+ * by a line holding '=' and its result, as left in cli_status, so a program
+ * can send a stream of commands and check them without waiting on the
+ * console. Blank lines and lines starting with '#' are skipped. exit leaves
+ * batch mode and goes back to the prompt.
+ */
+void handle_batch_command() {
+    char line[CLI_LINE_SIZE];
+    if (batch_mode) {
+        return;
+    }
+    batch_mode = true;
+    printf("\n=0\n");
+    while (true) {
+        custom_fgets_noecho(line, sizeof(line), stdin);
+        // The input only ends on the host
+        if (feof(stdin)) {
+            break;
+        }
+        if (skip_line(line)) {
+            continue;
+        }
+        if (execute_command(line)) {
+            printf("=0\n");
+            break;
+        }
+        printf("=%d\n", cli_status);
+    }
+    batch_mode = false;
+    cli_status = 0;
+}
+
+/**
+ * @brief Runs the commands of a script stored in the filesystem.
+ *
+ * The script is read a line at a time, with the file opened only while the
+ * line is read, so its commands have every file descriptor to use and can
+ * change the script itself.
+ *
+ * @param path The path of the script.
+ * @return 0 if every command succeeded, otherwise the result of the one
+ * that failed, or the error code of reading the script.
+ */
+static int run_script(const char *path) {
+    char line[CLI_LINE_SIZE];
+    uint32_t offset = 0;
+    for (int number = 1;; number++) {
+        int fd = fs_open(path, MODE_READ);
+        if (fd == FILE_NOT_FOUND) {
+            say("\nFile not found\n");
+        } else if (fd == FILE_ALREADY_OPEN) {
+            say("\nFile already opened\n");
+        } else if (fd < 0) {
+            print_path_error(fd);
+        }
+        if (fd < 0) {
+            return fd;
+        }
+        fs_seek(fd, offset, FS_SEEK_SET);
+        int length = fs_read(fd, line, sizeof(line) - 1);
+        fs_close(fd);
+        if (length <= 0) {
+            return length;
+        }
+
+        // Cut the line at its newline, leaving the rest for the next read
+        line[length] = '\0';
+        char *end = memchr(line, '\n', length);
+        if (end == NULL && length == sizeof(line) - 1) {
+            say("\nLine %d of %s is too long\n", number, path);
+            return CLI_BAD_ARGUMENTS;
+        }
+        if (end != NULL) {
+            *end = '\0';
+            length = end - line + 1;
+        }
+        offset += length;
+        line[strcspn(line, "\r")] = '\0';
+
+        if (skip_line(line)) {
+            continue;
+        }
+        if (execute_command(line)) {
+            return 0;
+        }
+        if (cli_status < 0) {
+            say("\nLine %d of %s failed with %d\n", number, path,
+                cli_status);
+            return cli_status;
+        }
+    }
+}
+
+/**
+ * @brief Handles the 'source' command to run a script stored in the
+ * filesystem.
+ *
+ * This function runs the commands of the script given one after the other,
+ * as if they were typed, and stops at the first that fails. Blank lines and
+ * lines starting with '#' are skipped, and exit ends the script. Scripts can
+ * source others up to CLI_SOURCE_DEPTH deep.
+ */
+void handle_source_command() {
+    char *token = strtok(NULL, " ");
+    if (token == NULL) {
+        usage("Source needs a name");
+        return;
+    }
+    if (source_depth >= CLI_SOURCE_DEPTH) {
+        usage("Scripts are nested too deep");
+        return;
+    }
+    source_depth++;
+    int status = run_script(token);
+    source_depth--;
+    cli_status = status;
 }
 
 /**
@@ -488,4 +1016,7 @@ void handle_cp_command() {
  * recognized. It simply prints a message indicating that the command is
  * unknown.
  */
-void handle_unknown_command() { printf("\nUnknown command\n"); }
+void handle_unknown_command() {
+    cli_status = CLI_UNKNOWN_COMMAND;
+    say("\nUnknown command\n");
+}
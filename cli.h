@@ -1,19 +1,43 @@
 #ifndef CLI_H
 #define CLI_H
 
+#define CLI_LINE_SIZE 256  // Longest command, with its NUL
+#define CLI_SOURCE_DEPTH 4 // Scripts that can run one within the other
+
+// Errors of commands, apart from those of the filesystem
+enum cli_errors {
+    CLI_BAD_ARGUMENTS = -200,   // Arguments missing or not understood
+    CLI_UNKNOWN_COMMAND = -201, // No such command
+};
+
+// Result of the last command: what its filesystem call returned, such as a
+// file descriptor or a number of bytes, 0 if it has none, or an error code
+extern int cli_status;
+
 int execute_command(char *command);
 
 void handle_open_command();
 void handle_close_command();
+void handle_sync_command();
 void handle_read_command();
 void handle_write_command();
 void handle_seek_command();
 void handle_ls_command();
+void handle_wear_command();
+void handle_df_command();
+void handle_stats_command();
+void handle_latency_command();
+void handle_scrub_command();
 void handle_wipe_command();
 void handle_create_command();
 void handle_rm_command();
+void handle_mkdir_command();
+void handle_rmdir_command();
 void handle_format_command();
 void handle_mv_command();
 void handle_cp_command();
+void handle_binary_command();
+void handle_batch_command();
+void handle_source_command();
 void handle_unknown_command();
 #endif // CLI_H
@@ -1,22 +1,40 @@
 #include "custom_fgets.h"
+#include "filesystem.h"
+#include "pico/stdlib.h"
 #include <stdio.h>
 
-char* custom_fgets(char* str, int n, FILE* stream) {
+#define IDLE_POLL_US 10000 // How long to wait for a key before doing idle work
+
+/**
+ * @brief Reads a line typed on the console, doing idle work while waiting.
+ *
+ * @param str Where the line goes, without its newline.
+ * @param n The size of str.
+ * @param echo Whether to echo the characters as they are typed.
+ * @return str.
+ */
+static char* read_line(char* str, int n, bool echo) {
     int i = 0;
     while (i < n - 1) {
-        int ch = getchar();
+        int ch = getchar_timeout_us(IDLE_POLL_US);
 
-        if (ch == '\n' || ch == '\r') {
+        if (ch == PICO_ERROR_TIMEOUT) {
+            fs_idle_step();
+        } else if (ch == '\n' || ch == '\r') {
             str[i] = '\0';
             return str;
         } else if (ch == '\b' || ch == 0x7F) {
             if (i > 0) {
                 i--;
-                printf("\b \b");
+                if (echo) {
+                    printf("\b \b");
+                }
             }
         } else if (ch >= 32 && ch <= 126) {
             str[i++] = (char)ch;
-            printf("%c", ch);
+            if (echo) {
+                printf("%c", ch);
+            }
         }
         // Non-printable characters are ignored
     }
@@ -24,3 +42,11 @@ char* custom_fgets(char* str, int n, FILE* stream) {
     return str;
 }
 
+char* custom_fgets(char* str, int n, FILE* stream) {
+    return read_line(str, n, true);
+}
+
+// Same without the echo, for commands sent by a program rather than typed
+char* custom_fgets_noecho(char* str, int n, FILE* stream) {
+    return read_line(str, n, false);
+}
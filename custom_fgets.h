@@ -4,5 +4,6 @@
 #include <stdio.h>
 
 char* custom_fgets(char* str, int n, FILE* stream);
+char* custom_fgets_noecho(char* str, int n, FILE* stream);
 
 #endif // CUSTOM_FGETS_H
@@ -1,100 +1,1461 @@
 #include "filesystem.h"
 #include "flash_ops.h"
+#include "fs_async.h"
+#include "lz.h"
 #include "pico/stdlib.h"
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 
-char temp_buffer[4096];
+#define FS_MAGIC "magic string for init v7"
 
-FileEntry file_table[25];
+// Size of a copy of the file table in the metadata sectors, in whole pages
+#define META_RECORD_SIZE                                                      \
+    ((sizeof(MetaHeader) + sizeof(FileTable) + FS_PAGE_SIZE - 1) /            \
+     FS_PAGE_SIZE * FS_PAGE_SIZE)
 
-FS_FILE open_files[10];
+// Copies are written in groups of metadata sectors that are erased together.
+// Copies smaller than a sector share a one sector group, larger ones take a
+// group of as many sectors as they need.
+#define META_GROUP_SECTORS                                                    \
+    ((META_RECORD_SIZE + FS_SECTOR_SIZE - 1) / FS_SECTOR_SIZE)
+#define META_RECORDS_PER_GROUP                                                \
+    (META_GROUP_SECTORS * FS_SECTOR_SIZE / META_RECORD_SIZE)
+#define META_GROUPS (FS_META_SECTORS / META_GROUP_SECTORS)
+#define META_RECORDS (META_GROUPS * META_RECORDS_PER_GROUP)
+_Static_assert(META_GROUPS >= 2,
+               "The metadata sectors must hold two copies of the file table");
+_Static_assert(sizeof(FileTable) >= FS_PAGE_SIZE - sizeof(MetaHeader),
+               "The header shares the first page of a copy with the table");
+_Static_assert(FS_FILE_ENTRIES < 0xFFFF, "Entries are indexed by uint16_t");
+_Static_assert(sizeof(((FileEntry *)0)->filename) == FS_NAME_SIZE,
+               "FS_NAME_SIZE is the room for a name in a file entry");
+_Static_assert(FS_NUM_SECTORS < FAT_RESERVED,
+               "Sectors are indexed by uint16_t");
+
+// Buckets of the filename index, at least one per entry
+#define FS_HASH_BUCKETS (FS_MAX_FILES < 32 ? 32 : FS_MAX_FILES)
+
+// Words of a bitmap with a bit per sector
+#define FS_MAP_WORDS ((FS_NUM_SECTORS + 31) / 32)
+
+char temp_buffer[FS_SECTOR_SIZE];
+
+FileTable table;
+
+FS_FILE open_files[FS_MAX_OPEN];
+
+// Filename index kept in RAM. Entries hashing to the same bucket are linked
+// through name_next, and unused entries are linked from free_entry the same
+// way. Entry 0 holds the magic, so 0 ends a list.
+uint16_t name_buckets[FS_HASH_BUCKETS];
+uint16_t name_next[FS_FILE_ENTRIES];
+uint16_t free_entry;
+uint16_t free_entries;
+
+// Entries of each directory, also kept in RAM. first_child[dir] heads a list
+// of the directory's entries linked both ways through the sibling arrays, the
+// root's being first_child[0]. Entry 0 is never in a list, so its sibling
+// links are only ever written as scratch.
+uint16_t first_child[FS_FILE_ENTRIES];
+uint16_t next_sibling[FS_FILE_ENTRIES];
+uint16_t prev_sibling[FS_FILE_ENTRIES];
+
+// Bumped whenever sectors leave a chain, which invalidates the sectors cached
+// in open_files. Sectors joining a chain do not move the ones before them.
+uint32_t chain_generation;
+
+// Write-back cache shared by the descriptors opened with MODE_WRITEBACK
+CacheSlot cache[FS_CACHE_SLOTS];
+uint32_t cache_clock;
+
+// Set while the file table in RAM has changes not yet written to flash
+bool table_dirty;
+
+// Sequence number of the newest copy of the file table, and the record slot
+// in the metadata sectors the next copy goes to
+uint32_t meta_sequence;
+uint32_t meta_next;
+
+// Bitmaps of the sectors no file uses, which mirrors the allocation table,
+// and of the sectors known to be erased. Free sectors that are not erased are
+// erased by fs_idle, and writes are steered to the ones that are. Sector i is
+// bit i % 32 of word i / 32, so the sectors of interest are found a word at a
+// time with __builtin_ctz instead of a sector at a time.
+uint32_t free_map[FS_MAP_WORDS];
+uint32_t erased_map[FS_MAP_WORDS];
+
+// Sectors of the volume, FS_NUM_SECTORS unless the flash after the firmware
+// image has fewer. The allocation table reserves the ones past the end.
+uint16_t volume_sectors;
+
+// Number of chains holding each sector. fs_cp gives the copy the source's
+// chain instead of copying its data, so a sector can be in several chains,
+// and is copied before any of them changes it. Since a sector has one link,
+// the sectors after a shared sector are shared as well.
+uint16_t sector_refs[FS_NUM_SECTORS];
+
+// Bytes of each sector its CRC32 covers, the bytes of its file as of the
+// table the CRC is in. They are not kept in the table as they follow from the
+// sizes of the files.
+uint16_t crc_length[FS_NUM_SECTORS];
+
+// Bitmap of the sectors checked against their CRC32 since the filesystem was
+// initialized, or written since, which reads with MODE_VERIFY do not check
+// again
+uint32_t verified_map[FS_MAP_WORDS];
+
+// Sector fs_scrub checks next
+uint16_t scrub_next;
+
+// A block of a compressed file, as its data and as it is stored. The data is
+// also kept for reads, tagged with the entry, block and chain generation it
+// belongs to, block_entry being NULL when it holds nothing to keep.
+char block_data[FS_BLOCK_SIZE];
+uint8_t block_packed[FS_BLOCK_SIZE];
+const FileEntry *block_entry;
+uint32_t block_index;
+uint32_t block_generation;
+uint32_t block_length;
+
+// Counters of the work done, the flash ones are kept by flash_ops.c
+FsStats stats;
+
+/**
+ * @brief Checks the bit of a sector in a bitmap.
+ *
+ * @param map The bitmap.
+ * @param sector The sector.
+ * @return 1 if the bit is set, otherwise 0.
+ */
+int map_test(const uint32_t *map, uint16_t sector) {
+    return (map[sector / 32] >> (sector % 32)) & 1;
+}
+
+/**
+ * @brief Sets or clears the bit of a sector in a bitmap.
+ *
+ * @param map The bitmap.
+ * @param sector The sector.
+ * @param value Whether the bit is set.
+ */
+void map_set(uint32_t *map, uint16_t sector, bool value) {
+    if (value) {
+        map[sector / 32] |= 1u << (sector % 32);
+    } else {
+        map[sector / 32] &= ~(1u << (sector % 32));
+    }
+}
+
+/**
+ * @brief Clears the temporary buffer.
+ */
+void clear_buffer() {
+    memset(temp_buffer, 0, sizeof(temp_buffer));
+    stats.buffer_clears++;
+}
+
+/**
+ * @brief Records how long an operation took.
+ *
+ * @param op The operation, one of FS_OP_*.
+ * @param start When the operation started, from time_us_64.
+ */
+void record_latency(int op, uint64_t start) {
+    hist_add(&stats.latency[op], time_us_64() - start);
+}
+
+/**
+ * @brief Hashes a name within a directory into a bucket of the filename index
+ * (FNV-1a).
+ *
+ * @param parent The entry of the directory, 0 for the root.
+ * @param name The name to hash, which need not be null terminated.
+ * @param length The length of the name.
+ * @return The bucket of the name.
+ */
+uint32_t hash_name(uint16_t parent, const char *name, size_t length) {
+    uint32_t hash = (2166136261u ^ parent) * 16777619u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash % FS_HASH_BUCKETS;
+}
+
+/**
+ * @brief Hashes the name of a file entry within its directory.
+ *
+ * @param file The index of the file entry.
+ * @return The bucket of the entry.
+ */
+uint32_t hash_entry(int file) {
+    const FileEntry *entry = &table.files[file];
+    return hash_name(entry->parent, entry->filename, strlen(entry->filename));
+}
+
+/**
+ * @brief Adds a file entry to the filename index under its current name, and
+ * to the entries of its directory.
+ *
+ * @param file The index of the file entry.
+ */
+void index_add(int file) {
+    uint32_t bucket = hash_entry(file);
+    name_next[file] = name_buckets[bucket];
+    name_buckets[bucket] = file;
+
+    uint16_t dir = table.files[file].parent;
+    next_sibling[file] = first_child[dir];
+    prev_sibling[file] = 0;
+    prev_sibling[first_child[dir]] = file;
+    first_child[dir] = file;
+}
+
+/**
+ * @brief Removes a file entry from the filename index and the entries of its
+ * directory. Must be called before the entry's name or directory changes.
+ *
+ * @param file The index of the file entry.
+ */
+void index_remove(int file) {
+    uint16_t *link = &name_buckets[hash_entry(file)];
+    while (*link != file) {
+        link = &name_next[*link];
+    }
+    *link = name_next[file];
+
+    uint16_t prev = prev_sibling[file];
+    uint16_t next = next_sibling[file];
+    if (prev == 0) {
+        first_child[table.files[file].parent] = next;
+    } else {
+        next_sibling[prev] = next;
+    }
+    prev_sibling[next] = prev;
+}
+
+/**
+ * @brief Rebuilds the filename index, the entries of each directory, the list
+ * of unused entries, the bitmap of free sectors, and the reference counts of
+ * the sectors and the lengths their CRC32 covers from the file table.
+ */
+void index_build() {
+    memset(name_buckets, 0, sizeof(name_buckets));
+    memset(first_child, 0, sizeof(first_child));
+    memset(sector_refs, 0, sizeof(sector_refs));
+    memset(crc_length, 0, sizeof(crc_length));
+    memset(free_map, 0, sizeof(free_map));
+    for (int i = FS_META_SECTORS; i < FS_NUM_SECTORS; i++) {
+        map_set(free_map, i, table.fat[i] == FAT_FREE);
+    }
+    free_entry = 0;
+    free_entries = 0;
+    // Walk backwards so unused entries are handed out lowest first
+    for (int i = FS_MAX_FILES; i > 0; i--) {
+        if (table.files[i].filename[0] == '\0') {
+            name_next[i] = free_entry;
+            free_entry = i;
+            free_entries++;
+        } else {
+            index_add(i);
+            uint32_t left = table.files[i].size;
+            for (uint16_t sector = table.files[i].first_sector;
+                 sector != 0 && sector != FAT_END; sector = table.fat[sector]) {
+                sector_refs[sector]++;
+                crc_length[sector] =
+                    left < FS_SECTOR_SIZE ? left : FS_SECTOR_SIZE;
+                left -= crc_length[sector];
+            }
+        }
+    }
+}
+
+/**
+ * @brief Searches a directory for an entry by its name.
+ *
+ * @param dir The entry of the directory, 0 for the root.
+ * @param name The name to search for, which need not be null terminated.
+ * @param length The length of the name.
+ * @return The index of the entry if found, otherwise FILE_NOT_FOUND.
+ */
+int get_child(uint16_t dir, const char *name, size_t length) {
+    if (length >= sizeof(table.files[0].filename)) {
+        return FILE_NOT_FOUND;
+    }
+    for (int i = name_buckets[hash_name(dir, name, length)]; i != 0;
+         i = name_next[i]) {
+        const FileEntry *entry = &table.files[i];
+        if (entry->parent == dir &&
+            strncmp(entry->filename, name, length) == 0 &&
+            entry->filename[length] == '\0') {
+            return i;
+        }
+    }
+    return FILE_NOT_FOUND;
+}
+
+/**
+ * @brief Finds the directory holding the last component of a path.
+ *
+ * Components are separated by '/' and a leading '/' is optional, as every
+ * path starts at the root. Each directory on the way is looked up in the
+ * filename index, so the cost grows with the depth of the path rather than
+ * the number of files.
+ *
+ * @param path The path to resolve.
+ * @param name Set to the last component of the path.
+ * @return The entry of the directory, 0 for the root, FILE_NOT_FOUND if a
+ * directory on the way does not exist or NOT_A_DIRECTORY if it is a file.
+ */
+int resolve_parent(const char *path, const char **name) {
+    int dir = 0;
+    if (*path == '/') {
+        path++;
+    }
+    for (const char *slash = strchr(path, '/'); slash != NULL;
+         slash = strchr(path, '/')) {
+        int child = get_child(dir, path, slash - path);
+        if (child < 0) {
+            return child;
+        }
+        if (!table.files[child].is_dir) {
+            return NOT_A_DIRECTORY;
+        }
+        dir = child;
+        path = slash + 1;
+    }
+    *name = path;
+    return dir;
+}
+
+/**
+ * @brief Searches for a file or directory in the file table by its path.
+ *
+ * @param path The path of the file to search for.
+ * @return The index of the file entry if found, otherwise FILE_NOT_FOUND or
+ * NOT_A_DIRECTORY if a directory on the way is a file.
+ */
+int get_file(const char *path) {
+    const char *name;
+    int dir = resolve_parent(path, &name);
+    if (dir < 0) {
+        return dir;
+    }
+    return get_child(dir, name, strlen(name));
+}
+
+/**
+ * @brief Checks that a name can be given to a file or directory.
+ *
+ * @param name The name, the last component of a path.
+ * @return 1 if the name is not empty and fits in a file entry, otherwise 0.
+ */
+int valid_name(const char *name) {
+    size_t length = strlen(name);
+    return length > 0 && length < sizeof(table.files[0].filename);
+}
+
+/**
+ * @brief Retrieves an available file descriptor.
+ *
+ * @return The index of an available file descriptor if found, otherwise
+ * OPENED_FILES_FULL.
+ */
+int get_fd() {
+    for (int i = 0; i < FS_MAX_OPEN; i++) {
+        if (open_files[i].entry == NULL) {
+            return i;
+        }
+    }
+    return OPENED_FILES_FULL;
+}
+
+/**
+ * @brief Checks that a file descriptor refers to an open file.
+ *
+ * @param fd The file descriptor to check.
+ * @return 1 if the descriptor is open, otherwise 0.
+ */
+int is_open(int fd) {
+    return fd >= 0 && fd < FS_MAX_OPEN && open_files[fd].entry != NULL &&
+           open_files[fd].entry->in_use;
+}
+
+/**
+ * @brief Checks if a specific mode is set.
+ *
+ * @param mode The mode to check.
+ * @param flag The flag to check for.
+ * @return 1 if the flag is set in the mode, otherwise 0.
+ */
+int check_mode(int mode, int flag) {
+    return mode & flag; // Check if the flag is set
+}
+
+/**
+ * @brief Checks whether a range of a sector is erased.
+ *
+ * @param sector The sector to check.
+ * @param start The start of the range within the sector.
+ * @param length The length of the range.
+ * @return 1 if every byte in the range is 0xFF, otherwise 0.
+ */
+int is_erased(uint16_t sector, uint32_t start, uint32_t length) {
+    const uint8_t *data = flash_xip_address(sector);
+    for (uint32_t i = start; i < start + length; i++) {
+        if (data[i] != 0xFF) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Computes the CRC32 (IEEE 802.3) of a block of memory.
+ *
+ * The CRC is computed a byte at a time from a table of the CRCs of every byte
+ * value, built on first use, as the file table it checks grows with the
+ * capacity of the filesystem.
+ *
+ * @param data The data to checksum.
+ * @param length The length of the data in bytes.
+ * @return The CRC32 of the data.
+ */
+uint32_t crc32(const void *data, size_t length) {
+    static uint32_t crc_table[256];
+    if (crc_table[1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+            }
+            crc_table[i] = crc;
+        }
+    }
+
+    const uint8_t *bytes = data;
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc = (crc >> 8) ^ crc_table[(crc ^ bytes[i]) & 0xFF];
+    }
+    return ~crc;
+}
+
+/**
+ * @brief Returns where a record slot starts, counted in bytes from the start
+ * of the metadata sectors.
+ *
+ * @param record The record slot.
+ * @return The offset of the record.
+ */
+uint32_t meta_offset(uint32_t record) {
+    return record / META_RECORDS_PER_GROUP * META_GROUP_SECTORS *
+               FS_SECTOR_SIZE +
+           record % META_RECORDS_PER_GROUP * META_RECORD_SIZE;
+}
+
+/**
+ * @brief Returns where a record slot of the metadata sectors is in the XIP
+ * view of flash.
+ *
+ * @param record The record slot.
+ * @return The start of the record.
+ */
+const uint8_t *meta_record(uint32_t record) {
+    return flash_xip_address(0) + meta_offset(record);
+}
+
+/**
+ * @brief Checks whether a record slot holds a complete copy of the file
+ * table.
+ *
+ * @param record The record slot.
+ * @return 1 if its commit word is set and its CRC matches, otherwise 0.
+ */
+int meta_valid(uint32_t record) {
+    const uint8_t *start = meta_record(record);
+    const MetaHeader *header = (const MetaHeader *)start;
+    return header->commit == FS_META_COMMIT &&
+           header->crc == crc32(start + sizeof(MetaHeader), sizeof(FileTable));
+}
+
+/**
+ * @brief Checks whether a record slot is still erased.
+ *
+ * @param record The record slot.
+ * @return 1 if every byte of the slot is erased, otherwise 0.
+ */
+int meta_erased(uint32_t record) {
+    const uint8_t *start = meta_record(record);
+    for (uint32_t i = 0; i < META_RECORD_SIZE; i++) {
+        if (start[i] != 0xFF) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Returns the first record slot of the group after that of a slot.
+ *
+ * @param record The record slot.
+ * @return The first slot of the next group.
+ */
+uint32_t meta_next_group(uint32_t record) {
+    return (record / META_RECORDS_PER_GROUP + 1) % META_GROUPS *
+           META_RECORDS_PER_GROUP;
+}
+
+/**
+ * @brief Programs data into the metadata sectors, which may cross from one
+ * sector into the next.
+ *
+ * @param offset Where the data goes, counted from the start of the metadata
+ * sectors.
+ * @param data The data to program.
+ * @param length The length of the data.
+ */
+void meta_program(uint32_t offset, const void *data, uint32_t length) {
+    const uint8_t *bytes = data;
+    while (length > 0) {
+        uint32_t start = offset % FS_SECTOR_SIZE;
+        uint32_t chunk = FS_SECTOR_SIZE - start;
+        if (chunk > length) {
+            chunk = length;
+        }
+        flash_program_safe(offset / FS_SECTOR_SIZE, start, bytes, chunk);
+        offset += chunk;
+        bytes += chunk;
+        length -= chunk;
+    }
+}
+
+/**
+ * @brief Erases a sector, counting the erase towards its wear.
+ *
+ * @param sector The sector to erase.
+ */
+void erase_sector(uint16_t sector) {
+    table.erase_count[sector]++;
+    flash_erase_safe(sector);
+    map_set(erased_map, sector, true);
+}
+
+/**
+ * @brief Erases a run of sectors, counting the erases towards their wear.
+ * The 64 KB blocks wholly in the run take a single block erase each.
+ *
+ * @param first The first sector of the run.
+ * @param count The number of sectors.
+ */
+void erase_sectors(uint16_t first, uint16_t count) {
+    flash_erase_range_safe(first, count);
+    for (uint16_t i = first; i < first + count; i++) {
+        table.erase_count[i]++;
+        map_set(erased_map, i, true);
+    }
+}
+
+/**
+ * @brief Returns the group of metadata sectors the copies of the file table
+ * move into next, which never holds the newest copy.
+ *
+ * @return The group, whose first sector is the group times
+ * META_GROUP_SECTORS.
+ */
+uint32_t next_meta_group() {
+    uint32_t group = meta_next / META_RECORDS_PER_GROUP;
+    if (meta_next % META_RECORDS_PER_GROUP == 0) {
+        return group;
+    }
+    return (group + 1) % META_GROUPS;
+}
+
+/**
+ * @brief Updates the file table in the flash memory.
+ *
+ * Rather than erasing the table in place, each update programs a new copy
+ * into the next erased record slot of the metadata sectors, which are used in
+ * turn. The sectors of a group are erased when the copies move into it, at
+ * which point the newest copy is in another group, unless fs_idle has erased
+ * them already.
+ *
+ * The copy is read back before the update counts as done. One that does not
+ * match, because the slot was not erased, is written again at the start of
+ * the next group. The table stays dirty if a freshly erased group fails too,
+ * so fs_idle leaves alone the sectors the older copy refers to.
+ */
+void update_file_table() {
+    stats.table_updates++;
+    meta_sequence++;
+    while (true) {
+        uint32_t record = meta_next;
+        bool fresh = record % META_RECORDS_PER_GROUP == 0;
+        uint32_t group = record / META_RECORDS_PER_GROUP;
+        for (uint32_t i = 0; i < META_GROUP_SECTORS; i++) {
+            uint32_t sector = group * META_GROUP_SECTORS + i;
+            if (fresh && !map_test(erased_map, sector)) {
+                erase_sector(sector);
+            }
+            map_set(erased_map, sector, false);
+        }
+
+        // Program the copy, with the header sharing its first page with the
+        // table, then its commit word. The CRC is taken after the erases,
+        // which the table counts.
+        uint32_t offset = meta_offset(record);
+        MetaHeader header = {meta_sequence, crc32(&table, sizeof(table)),
+                             0xFFFFFFFF, 0xFFFFFFFF};
+        uint8_t first_page[FS_PAGE_SIZE];
+        uint32_t head = FS_PAGE_SIZE - sizeof(header);
+        memcpy(first_page, &header, sizeof(header));
+        memcpy(first_page + sizeof(header), &table, head);
+        meta_program(offset, first_page, FS_PAGE_SIZE);
+        meta_program(offset + FS_PAGE_SIZE, (const uint8_t *)&table + head,
+                     sizeof(table) - head);
+        uint32_t commit = FS_META_COMMIT;
+        meta_program(offset + offsetof(MetaHeader, commit), &commit,
+                     sizeof(commit));
+
+        meta_next = (record + 1) % META_RECORDS;
+        if (meta_valid(record) &&
+            ((const MetaHeader *)meta_record(record))->sequence ==
+                meta_sequence) {
+            table_dirty = false;
+            return;
+        }
+        if (fresh) {
+            return;
+        }
+        meta_next = meta_next_group(record);
+    }
+}
+
+/**
+ * @brief Returns the number of sectors needed to hold a file.
+ *
+ * @param size The size of the file in bytes.
+ * @return The length of the file's chain.
+ */
+uint32_t sectors_for(uint32_t size) {
+    return (size + FS_SECTOR_SIZE - 1) / FS_SECTOR_SIZE;
+}
+
+/**
+ * @brief Counts the sectors not used by any file.
+ *
+ * @return The number of free sectors.
+ */
+uint32_t count_free_sectors() {
+    uint32_t count = 0;
+    for (int w = 0; w < FS_MAP_WORDS; w++) {
+        count += __builtin_popcount(free_map[w]);
+    }
+    return count;
+}
+
+/**
+ * @brief Records the CRC32 of the first bytes of a sector as they are now in
+ * flash, once they have been written.
+ *
+ * Only the bytes of the file are covered, so bytes added past them later do
+ * not change the CRC the file table in flash holds until the table is
+ * updated with the new size. The caller has to seal the last sector again
+ * whenever the file shrinks to end within it.
+ *
+ * @param sector The sector.
+ * @param length The number of bytes from its start the file uses.
+ */
+void seal_sector(uint16_t sector, uint32_t length) {
+    table.sector_crc[sector] = flash_crc32(sector, 0, length);
+    crc_length[sector] = length;
+    map_set(verified_map, sector, true);
+    table_dirty = true;
+}
+
+/**
+ * @brief Checks a sector against the CRC32 the file table holds for it.
+ *
+ * @param sector The sector to check.
+ * @return 1 if it matches, otherwise 0.
+ */
+int verify_sector(uint16_t sector) {
+    bool match = flash_crc32(sector, 0, crc_length[sector]) ==
+                 table.sector_crc[sector];
+    map_set(verified_map, sector, match);
+    stats.sectors_verified++;
+    if (!match) {
+        stats.corrupt_sectors++;
+    }
+    return match;
+}
+
+/**
+ * @brief Checks whether a sector has writes buffered in a cache slot, in which
+ * case flash does not hold what its CRC32 will cover yet.
+ *
+ * @param sector The sector to check.
+ * @return 1 if a slot holds writes to it, otherwise 0.
+ */
+int sector_pending(uint16_t sector) {
+    for (int i = 0; i < FS_CACHE_SLOTS; i++) {
+        if (cache[i].fd >= 0 && cache[i].sector == sector &&
+            cache[i].dirty_from != cache[i].dirty_to) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes the contents of a whole sector, erasing it first unless it is
+ * erased already.
+ *
+ * @param sector The sector to write.
+ * @param data The new contents of the sector.
+ * @param length The length of the contents, the rest is left erased.
+ */
+void write_sector(uint16_t sector, const char *data, uint32_t length) {
+    if (map_test(erased_map, sector)) {
+        flash_program_safe(sector, 0, (const uint8_t *)data, length);
+    } else {
+        table.erase_count[sector]++;
+        flash_write_safe(sector, (const uint8_t *)data, length);
+    }
+    map_set(erased_map, sector, false);
+    seal_sector(sector, length);
+}
+
+/**
+ * @brief Picks the free sector to allocate next.
+ *
+ * This is the least worn of the free sectors known to be erased, so that the
+ * write needs no erase, or the least worn free sector if none are. The sector
+ * right after the given one is picked instead if it is just as erased and not
+ * more than FS_WEAR_SLACK erases more worn, so the file stays contiguous in
+ * the XIP view.
+ *
+ * @param after The sector the new one follows in its chain, 0 if none.
+ * @return The free sector, or 0 if there is none.
+ */
+uint16_t least_worn_free(uint16_t after) {
+    // Only the erased free sectors are candidates, unless there are none
+    bool have_erased = false;
+    for (int w = 0; w < FS_MAP_WORDS; w++) {
+        have_erased |= (free_map[w] & erased_map[w]) != 0;
+    }
+
+    uint16_t best = 0;
+    for (int w = 0; w < FS_MAP_WORDS; w++) {
+        uint32_t bits = free_map[w];
+        if (have_erased) {
+            bits &= erased_map[w];
+        }
+        while (bits != 0) {
+            uint16_t i = w * 32 + __builtin_ctz(bits);
+            bits &= bits - 1;
+            if (best == 0 || table.erase_count[i] < table.erase_count[best]) {
+                best = i;
+            }
+        }
+    }
+    uint16_t next = after + 1;
+    if (best != 0 && after != 0 && next < FS_NUM_SECTORS &&
+        map_test(free_map, next) &&
+        map_test(erased_map, next) >= map_test(erased_map, best) &&
+        table.erase_count[next] <= table.erase_count[best] + FS_WEAR_SLACK) {
+        return next;
+    }
+    return best;
+}
+
+/**
+ * @brief Drops a chain's hold on a sector, which is returned to the free pool
+ * as it is once no chain holds it, for fs_idle to erase.
+ *
+ * @param sector The sector leaving the chain.
+ */
+void release_sector(uint16_t sector) {
+    if (sector_refs[sector] > 1) {
+        sector_refs[sector]--;
+        return;
+    }
+    sector_refs[sector] = 0;
+    table.fat[sector] = FAT_FREE;
+    map_set(free_map, sector, true);
+    map_set(erased_map, sector, false);
+}
+
+/**
+ * @brief Moves a sector of a file that is about to be rewritten to a free
+ * sector, so that the rewrite needs no erase and rewriting the same part of a
+ * file does not keep erasing the same sector.
+ *
+ * The sector is moved if the free one is known to be erased, or else once it
+ * has been erased FS_WEAR_SLACK times more than the free one. The old sector
+ * is freed as it is and left for fs_idle to erase, so its data stays intact
+ * until the new chain is in the file table. A sector shared with other files
+ * is always moved, and stays in their chains. The sector before it must not
+ * be shared.
+ *
+ * @param entry The file entry.
+ * @param prev The sector before it in the chain, 0 if it is the first.
+ * @param sector The sector about to be rewritten.
+ * @return The sector to write the new contents to.
+ */
+uint16_t move_sector(FileEntry *entry, uint16_t prev, uint16_t sector) {
+    uint16_t free = least_worn_free(prev);
+    if (free == 0 ||
+        (sector_refs[sector] <= 1 && !map_test(erased_map, free) &&
+         table.erase_count[free] + FS_WEAR_SLACK > table.erase_count[sector])) {
+        return sector;
+    }
+
+    // Swap the free sector into the chain
+    table.fat[free] = table.fat[sector];
+    map_set(free_map, free, false);
+    sector_refs[free] = 1;
+    release_sector(sector);
+    if (prev == 0) {
+        entry->first_sector = free;
+    } else {
+        table.fat[prev] = free;
+    }
+    chain_generation++;
+    table_dirty = true;
+    return free;
+}
+
+/**
+ * @brief Finds the sector holding an offset of an open file.
+ *
+ * The descriptor remembers the last sector it resolved, so sequential access
+ * only follows one link of the chain per sector instead of walking it from
+ * the start every time.
+ *
+ * @param fd The file descriptor of the open file.
+ * @param offset The offset in the file, which must be within its chain.
+ * @return The sector holding the offset.
+ */
+uint16_t file_sector(int fd, uint32_t offset) {
+    FS_FILE *file = &open_files[fd];
+    uint32_t start = offset - offset % FS_SECTOR_SIZE;
+
+    // Start again from the head if the cached sector is stale or past the
+    // offset
+    if (file->sector == 0 || file->generation != chain_generation ||
+        file->sector_start > start) {
+        file->sector = file->entry->first_sector;
+        file->sector_start = 0;
+        file->generation = chain_generation;
+    }
+    while (file->sector_start < start) {
+        file->sector = table.fat[file->sector];
+        file->sector_start += FS_SECTOR_SIZE;
+    }
+    return file->sector;
+}
+
+/**
+ * @brief Grows or shrinks a file's chain to fit a new size.
+ *
+ * Sectors removed from the chain are released with release_sector. Sectors
+ * added to it are picked by least_worn_free and are left as they are, so the
+ * caller has to write them. The last sector kept must not be shared unless
+ * the chain keeps its length or is emptied.
+ * Nothing changes if there are not enough free sectors.
+ *
+ * @param entry The file entry.
+ * @param size The new size of the file in bytes.
+ * @return 0 if successful, otherwise NO_SPACE.
+ */
+int resize_chain(FileEntry *entry, uint32_t size) {
+    uint32_t have = sectors_for(entry->size);
+    uint32_t want = sectors_for(size);
+    if (want > have && want - have > count_free_sectors()) {
+        return NO_SPACE;
+    }
+
+    // Walk to the last sector that is kept
+    uint16_t last = 0;
+    uint16_t sector = entry->first_sector;
+    for (uint32_t i = 0; i < have && i < want; i++) {
+        last = sector;
+        sector = table.fat[sector];
+    }
+
+    // Free the rest of the old chain
+    if (want < have) {
+        chain_generation++;
+    }
+    for (uint32_t i = want; i < have; i++) {
+        uint16_t next = table.fat[sector];
+        release_sector(sector);
+        sector = next;
+    }
+
+    // Append free sectors to the chain
+    for (uint32_t i = have; i < want; i++) {
+        uint16_t free = least_worn_free(last);
+        if (last == 0) {
+            entry->first_sector = free;
+        } else {
+            table.fat[last] = free;
+        }
+        last = free;
+        table.fat[free] = FAT_END;
+        map_set(free_map, free, false);
+        sector_refs[free] = 1;
+    }
+
+    // Terminate the chain
+    if (last == 0) {
+        entry->first_sector = 0;
+    } else {
+        table.fat[last] = FAT_END;
+    }
+    return 0;
+}
+
+/**
+ * @brief Counts the sectors of a file's chain that are shared with other
+ * files and hold bytes before an offset.
+ *
+ * @param entry The file entry.
+ * @param end The offset in the file.
+ * @return The number of shared sectors.
+ */
+uint32_t shared_sectors(const FileEntry *entry, uint32_t end) {
+    uint32_t count = 0;
+    uint16_t sector = entry->first_sector;
+    for (uint32_t start = 0; start < end && start < entry->size;
+         start += FS_SECTOR_SIZE) {
+        count += sector_refs[sector] > 1;
+        sector = table.fat[sector];
+    }
+    return count;
+}
+
+/**
+ * @brief Gives a file its own copy of each sector of its chain that is shared
+ * with other files and holds bytes before an offset, so that those sectors and
+ * their links can be changed.
+ *
+ * The copies are linked into the file's chain in place of the shared sectors,
+ * which stay in the other chains, and cache slots holding the shared sectors
+ * are pointed at the copies. The caller has to check there are enough free
+ * sectors with shared_sectors.
+ *
+ * @param entry The file entry.
+ * @param end The offset in the file.
+ */
+void unshare_chain(FileEntry *entry, uint32_t end) {
+    uint16_t prev = 0;
+    uint16_t sector = entry->first_sector;
+    for (uint32_t start = 0; start < end && start < entry->size;
+         start += FS_SECTOR_SIZE) {
+        if (sector_refs[sector] > 1) {
+            // Copy the bytes of the file in the sector to a free one
+            uint32_t length = entry->size - start;
+            if (length > FS_SECTOR_SIZE) {
+                length = FS_SECTOR_SIZE;
+            }
+            uint16_t copy = least_worn_free(prev);
+            flash_read_safe(sector, (uint8_t *)temp_buffer, length);
+            write_sector(copy, temp_buffer, length);
+
+            // Swap the copy into the chain
+            table.fat[copy] = table.fat[sector];
+            map_set(free_map, copy, false);
+            sector_refs[copy] = 1;
+            sector_refs[sector]--;
+            if (prev == 0) {
+                entry->first_sector = copy;
+            } else {
+                table.fat[prev] = copy;
+            }
+            for (int i = 0; i < FS_CACHE_SLOTS; i++) {
+                if (cache[i].fd >= 0 && cache[i].sector == sector &&
+                    open_files[cache[i].fd].entry == entry) {
+                    cache[i].sector = copy;
+                }
+            }
+            chain_generation++;
+            table_dirty = true;
+            sector = copy;
+        }
+        prev = sector;
+        sector = table.fat[sector];
+    }
+}
+
+/**
+ * @brief Finds the cache slot holding a sector of an open file.
+ *
+ * @param fd The file descriptor of the open file.
+ * @param sector_start The offset in the file where the sector starts.
+ * @return The cache slot, or NULL if the sector is not cached.
+ */
+CacheSlot *cache_find(int fd, uint32_t sector_start) {
+    for (int i = 0; i < FS_CACHE_SLOTS; i++) {
+        if (cache[i].fd == fd && cache[i].sector_start == sector_start) {
+            cache[i].last_used = ++cache_clock;
+            stats.cache_hits++;
+            return &cache[i];
+        }
+    }
+    stats.cache_misses++;
+    return NULL;
+}
+
+/**
+ * @brief Writes the bytes of a cache slot that are not yet in flash.
+ *
+ * The bytes are programmed in place if the flash under them is still erased,
+ * as it is when appending, otherwise the whole sector is rewritten, moving it
+ * to a less worn sector if there is one. Either way the sector's CRC32 is
+ * recorded again.
+ *
+ * @param slot The cache slot to flush.
+ */
+void cache_flush(CacheSlot *slot) {
+    if (slot->fd < 0 || slot->dirty_from == slot->dirty_to) {
+        return;
+    }
+
+    // A write that spans several sectors only updates the file size once it
+    // has filled them all, so a slot evicted before then holds bytes past it
+    FileEntry *entry = open_files[slot->fd].entry;
+    uint32_t used = entry->size > slot->sector_start
+                        ? entry->size - slot->sector_start
+                        : 0;
+    if (used < slot->dirty_to) {
+        used = slot->dirty_to;
+    }
+    if (used > FS_SECTOR_SIZE) {
+        used = FS_SECTOR_SIZE;
+    }
+    uint32_t length = slot->dirty_to - slot->dirty_from;
+    if (is_erased(slot->sector, slot->dirty_from, length)) {
+        flash_program_safe(slot->sector, slot->dirty_from,
+                           (const uint8_t *)slot->data + slot->dirty_from,
+                           length);
+        map_set(erased_map, slot->sector, false);
+        seal_sector(slot->sector, used);
+    } else {
+        uint16_t prev = slot->sector_start == 0
+                            ? 0
+                            : file_sector(slot->fd,
+                                          slot->sector_start - FS_SECTOR_SIZE);
+        slot->sector = move_sector(entry, prev, slot->sector);
+        write_sector(slot->sector, slot->data, used);
+    }
+    slot->dirty_from = 0;
+    slot->dirty_to = 0;
+}
+
+/**
+ * @brief Gets a cache slot holding a sector of an open file, loading the
+ * sector into a free or the least recently used slot if it is not cached.
+ *
+ * @param fd The file descriptor of the open file.
+ * @param sector_start The offset in the file where the sector starts, which
+ * must be within its chain.
+ * @return The cache slot.
+ */
+CacheSlot *cache_load(int fd, uint32_t sector_start) {
+    CacheSlot *slot = cache_find(fd, sector_start);
+    if (slot != NULL) {
+        return slot;
+    }
+
+    // Evict the least recently used slot unless one is free
+    slot = &cache[0];
+    for (int i = 0; i < FS_CACHE_SLOTS; i++) {
+        if (cache[i].fd < 0) {
+            slot = &cache[i];
+            break;
+        }
+        if (cache[i].last_used < slot->last_used) {
+            slot = &cache[i];
+        }
+    }
+    cache_flush(slot);
+
+    slot->fd = fd;
+    slot->sector = file_sector(fd, sector_start);
+    slot->sector_start = sector_start;
+    slot->dirty_from = 0;
+    slot->dirty_to = 0;
+    slot->last_used = ++cache_clock;
+
+    // Load the part of the sector the file already uses
+    uint32_t size = open_files[fd].entry->size;
+    uint32_t used = size > sector_start ? size - sector_start : 0;
+    memcpy(slot->data, flash_xip_address(slot->sector),
+           used < FS_SECTOR_SIZE ? used : FS_SECTOR_SIZE);
+    return slot;
+}
+
+/**
+ * @brief Frees the cache slots of an open file without flushing them.
+ *
+ * @param entry The file entry whose descriptors' slots are dropped, or NULL
+ * to drop every slot.
+ */
+void cache_drop(const FileEntry *entry) {
+    for (int i = 0; i < FS_CACHE_SLOTS; i++) {
+        if (entry == NULL ||
+            (cache[i].fd >= 0 && open_files[cache[i].fd].entry == entry)) {
+            cache[i].fd = -1;
+        }
+    }
+}
+
+/**
+ * @brief Flushes the cache slots of an open file.
+ *
+ * @param entry The file entry whose descriptors' slots are flushed.
+ */
+void cache_flush_entry(const FileEntry *entry) {
+    for (int i = 0; i < FS_CACHE_SLOTS; i++) {
+        if (cache[i].fd >= 0 && open_files[cache[i].fd].entry == entry) {
+            cache_flush(&cache[i]);
+        }
+    }
+}
+
+/**
+ * @brief Initializes the filesystem.
+ *
+ * This function loads the newest complete copy of the file table from the
+ * metadata sectors and checks if the filesystem has already been initialized.
+ * If the filesystem has not been initialized, it initializes the file table
+ * with a magic string and default values.
+ */
+void init_filesystem() {
+    cache_drop(NULL);
+
+    // Find the newest complete copy of the file table
+    int newest = -1;
+    for (int i = 0; i < (int)META_RECORDS; i++) {
+        const MetaHeader *header = (const MetaHeader *)meta_record(i);
+        if (!meta_valid(i)) {
+            continue;
+        }
+        if (newest < 0 || header->sequence > meta_sequence) {
+            newest = i;
+            meta_sequence = header->sequence;
+        }
+    }
+
+    // Initialize the file table
+    if (newest >= 0) {
+        memcpy(&table, meta_record(newest) + sizeof(MetaHeader),
+               sizeof(table));
+        meta_next = (newest + 1) % META_RECORDS;
+
+        // A power loss while the next copy was programmed leaves it cut
+        // short in the slot after the newest, which cannot be programmed
+        // again until its group is erased, so the copies go on in the next
+        if (meta_next % META_RECORDS_PER_GROUP != 0 &&
+            !meta_erased(meta_next)) {
+            meta_next = meta_next_group(meta_next);
+        }
+    } else {
+        memset(&table, 0, sizeof(table));
+        meta_sequence = 0;
+        meta_next = 0;
+    }
+    for (int i = 1; i < FS_FILE_ENTRIES; i++) {
+        table.files[i].in_use = 0;
+    }
+
+    // Find out which sectors are erased. None has been verified yet.
+    volume_sectors = FS_NUM_SECTORS;
+    if (flash_sector_count() < FS_NUM_SECTORS) {
+        volume_sectors = flash_sector_count();
+    }
+    memset(erased_map, 0, sizeof(erased_map));
+    memset(verified_map, 0, sizeof(verified_map));
+    for (int i = 0; i < volume_sectors; i++) {
+        map_set(erased_map, i, is_erased(i, 0, FS_SECTOR_SIZE));
+    }
+
+    if (strcmp(table.files[0].filename, FS_MAGIC) == 0) {
+        index_build();
+        return;
+    }
+
+    // Initialize the first entry with a magic string and default values
+    memcpy(table.files[0].filename, FS_MAGIC, sizeof(FS_MAGIC));
+    table.files[0].size = 0;
+    table.files[0].in_use = 0;
+    table.files[0].first_sector = 0;
+
+    // Initialize other entries with default values
+    for (int i = 1; i < FS_FILE_ENTRIES; i++) {
+        table.files[i].filename[0] = '\0';
+        table.files[i].size = 0;
+        table.files[i].in_use = 0;
+        table.files[i].first_sector = 0;
+    }
+
+    // Every sector but the table's own and those past the end of flash is
+    // free
+    for (int i = 0; i < FS_NUM_SECTORS; i++) {
+        table.fat[i] = i < FS_META_SECTORS || i >= volume_sectors
+                           ? FAT_RESERVED
+                           : FAT_FREE;
+    }
+
+    // Update the file table in flash memory
+    update_file_table();
+    index_build();
+}
 
 /**
- * @brief Clears the temporary buffer.
+ * @brief Adds up the lengths of the buffers of a vector.
+ *
+ * @param iov The buffers.
+ * @param count The number of buffers.
+ * @return The total length, or OVERFLOW if a length is negative or the total
+ * does not fit in an int.
  */
-void clear_buffer() { memset(temp_buffer, 0, sizeof(temp_buffer)); }
+int iov_total(const FsIoVec *iov, int count) {
+    int64_t total = 0;
+    for (int i = 0; i < count; i++) {
+        if (iov[i].len < 0) {
+            return OVERFLOW;
+        }
+        total += iov[i].len;
+    }
+    return count < 0 || total > INT32_MAX ? OVERFLOW : (int)total;
+}
 
 /**
- * @brief Searches for a file in the file table by its path.
+ * @brief Copies bytes between a flat buffer and a vector of buffers, taken
+ * as one run of bytes.
  *
- * @param path The path of the file to search for.
- * @return The index of the file entry if found, otherwise FILE_NOT_FOUND.
+ * @param iov The buffers.
+ * @param count The number of buffers.
+ * @param offset Where in the run of bytes the copy starts.
+ * @param data The flat buffer.
+ * @param length The number of bytes to copy.
+ * @param scatter Copy from data into the vector if set, otherwise from the
+ * vector into data.
  */
-int get_file(const char *path) {
-    for (int i = 1; i < 25; i++) {
-        if (strcmp(file_table[i].filename, path) == 0) {
-            return i;
+void iov_copy(const FsIoVec *iov, int count, uint32_t offset, char *data,
+              uint32_t length, bool scatter) {
+    for (int i = 0; i < count && length > 0; i++) {
+        uint32_t len = iov[i].len;
+        if (offset >= len) {
+            offset -= len;
+            continue;
         }
+        uint32_t chunk = len - offset < length ? len - offset : length;
+        char *base = (char *)iov[i].base + offset;
+        if (scatter) {
+            memcpy(base, data, chunk);
+        } else {
+            memcpy(data, base, chunk);
+        }
+        data += chunk;
+        length -= chunk;
+        offset = 0;
     }
-    return FILE_NOT_FOUND;
 }
 
 /**
- * @brief Retrieves an available file descriptor.
+ * @brief Copies bytes of an open file, as they are stored, into a vector of
+ * buffers.
  *
- * @return The index of an available file descriptor if found, otherwise
- * OPENED_FILES_FULL.
+ * The bytes are copied straight out of the XIP view of each sector holding
+ * them, or out of the cache for sectors with buffered writes.
+ *
+ * @param fd The file descriptor of the open file.
+ * @param offset Where in the file the bytes start.
+ * @param iov The buffers to fill, from the start of the first.
+ * @param count The number of buffers.
+ * @param length The number of bytes, which must be within the file.
  */
-int get_fd() {
-    for (int i = 0; i < 10; i++) {
-        if (open_files[i].entry == NULL) {
-            return i;
+void read_stored(int fd, uint32_t offset, const FsIoVec *iov, int count,
+                 uint32_t length) {
+    uint32_t done = 0;
+    while (done < length) {
+        uint32_t at = (offset + done) % FS_SECTOR_SIZE;
+        uint32_t chunk = FS_SECTOR_SIZE - at;
+        if (chunk > length - done) {
+            chunk = length - done;
         }
+        CacheSlot *slot =
+            check_mode(open_files[fd].m, MODE_WRITEBACK)
+                ? cache_find(fd, offset + done - at)
+                : NULL;
+        const char *data =
+            slot != NULL
+                ? slot->data
+                : (const char *)flash_xip_address(
+                      file_sector(fd, offset + done));
+        iov_copy(iov, count, done, (char *)data + at, chunk, true);
+        done += chunk;
     }
-    return OPENED_FILES_FULL;
 }
 
 /**
- * @brief Checks if a specific mode is set.
+ * @brief Checks the sectors holding a range of an open file against their
+ * CRC32 if the file was opened with MODE_VERIFY.
  *
- * @param mode The mode to check.
- * @param flag The flag to check for.
- * @return 1 if the flag is set in the mode, otherwise 0.
+ * Each sector is only checked the first time it is read after the filesystem
+ * is initialized, and not at all while its data is still in a cache slot.
+ *
+ * @param fd The file descriptor of the open file.
+ * @param offset Where in the file the range starts.
+ * @param length The length of the range, which must be within the file.
+ * @return 0 if the sectors match, otherwise DATA_CORRUPT.
  */
-int check_mode(int mode, int flag) {
-    return mode & flag; // Check if the flag is set
+int verify_range(int fd, uint32_t offset, uint32_t length) {
+    if (!check_mode(open_files[fd].m, MODE_VERIFY)) {
+        return 0;
+    }
+    uint32_t start = offset - offset % FS_SECTOR_SIZE;
+    for (; start < offset + length; start += FS_SECTOR_SIZE) {
+        uint16_t sector = file_sector(fd, start);
+        if (!map_test(verified_map, sector) && !sector_pending(sector) &&
+            !verify_sector(sector)) {
+            return DATA_CORRUPT;
+        }
+    }
+    return 0;
 }
 
 /**
- * @brief Updates the file table in the flash memory.
+ * @brief Reads the header of each block of an open compressed file to find
+ * the size of its data, and starts the walk of block_start over.
+ *
+ * Reading stops at a header that does not fit in the file or makes no sense,
+ * as if the file ended there.
+ *
+ * @param fd The file descriptor of the open file.
  */
-void update_file_table() {
-    flash_write_safe(0, &file_table, sizeof(FileEntry) * 25);
+void index_blocks(int fd) {
+    FS_FILE *file = &open_files[fd];
+    uint32_t size = file->entry->size;
+    uint32_t at = 0;
+    file->raw_size = 0;
+    // Only the last block can be shorter than FS_BLOCK_SIZE
+    while (at + sizeof(BlockHeader) <= size &&
+           file->raw_size % FS_BLOCK_SIZE == 0) {
+        BlockHeader header;
+        FsIoVec iov = {&header, sizeof(header)};
+        read_stored(fd, at, &iov, 1, sizeof(header));
+        if (header.raw == 0 || header.raw > FS_BLOCK_SIZE ||
+            header.stored > header.raw ||
+            at + sizeof(header) + header.stored > size) {
+            break;
+        }
+        file->raw_size += header.raw;
+        at += sizeof(header) + header.stored;
+    }
+    file->block = 0;
+    file->block_start = 0;
+    file->block_generation = chain_generation;
 }
 
 /**
- * @brief Initializes the filesystem.
+ * @brief Gets the size of the data of an open file, which for a compressed
+ * file is the size before compression.
  *
- * This function initializes the file table and checks if the filesystem has
- * already been initialized. If the filesystem has not been initialized, it
- * initializes the file table with a magic string and default values.
+ * @param fd The file descriptor of the open file.
+ * @return The size of the data in bytes.
  */
-void init_filesystem() {
-    // Initialize the file table
-    flash_read_safe(0, &file_table, sizeof(FileEntry) * 25);
-    for (int i = 1; i < 25; i++) {
-        file_table[i].in_use = 0;
+uint32_t data_size(int fd) {
+    FS_FILE *file = &open_files[fd];
+    if (!file->entry->compressed) {
+        return file->entry->size;
+    }
+    if (file->block_generation != chain_generation) {
+        index_blocks(fd);
     }
+    return file->raw_size;
+}
 
-    if (strcmp(file_table[0].filename, "magic string for initing\0") == 0) {
-        return;
+/**
+ * @brief Finds where the header of a block of an open compressed file is.
+ *
+ * Like file_sector, the descriptor remembers the last block it found, so
+ * sequential access only reads one header per block instead of every header
+ * from the start of the file.
+ *
+ * @param fd The file descriptor of the open file.
+ * @param index The block, which may be the one after the last.
+ * @return The offset of the block's header in the file.
+ */
+uint32_t block_start(int fd, uint32_t index) {
+    FS_FILE *file = &open_files[fd];
+    if (file->block_generation != chain_generation || file->block > index) {
+        index_blocks(fd);
     }
+    while (file->block < index && file->block_start < file->entry->size) {
+        BlockHeader header;
+        FsIoVec iov = {&header, sizeof(header)};
+        read_stored(fd, file->block_start, &iov, 1, sizeof(header));
+        file->block_start += sizeof(header) + header.stored;
+        file->block++;
+    }
+    return file->block_start;
+}
 
-    // Initialize the first entry with a magic string and default values
-    memcpy(file_table[0].filename, "magic string for initing\0", 25);
-    file_table[0].size = 0;
-    file_table[0].in_use = 0;
+/**
+ * @brief Loads a block of an open compressed file into block_data,
+ * decompressing it if it was stored compressed.
+ *
+ * A corrupt block is loaded as far as it can be decompressed, the rest being
+ * read as zeros, unless the file was opened with MODE_VERIFY and the sectors
+ * holding the block do not match their CRC32. Loading the block block_data
+ * already holds does nothing.
+ *
+ * @param fd The file descriptor of the open file.
+ * @param index The block, which must be within the file.
+ * @return The length of the block's data, or DATA_CORRUPT.
+ */
+int load_block(int fd, uint32_t index) {
+    FileEntry *entry = open_files[fd].entry;
+    if (block_entry == entry && block_index == index &&
+        block_generation == chain_generation) {
+        return block_length;
+    }
 
-    // Initialize other entries with default values
-    for (int i = 1; i < 25; i++) {
-        file_table[i].filename[0] = '\0';
-        file_table[i].size = 0;
-        file_table[i].in_use = 0;
+    uint32_t at = block_start(fd, index);
+    BlockHeader header;
+    FsIoVec iov = {&header, sizeof(header)};
+    if (verify_range(fd, at, sizeof(header)) < 0) {
+        return DATA_CORRUPT;
+    }
+    read_stored(fd, at, &iov, 1, sizeof(header));
+    at += sizeof(header);
+    if (verify_range(fd, at, header.stored) < 0) {
+        return DATA_CORRUPT;
+    }
+    if (header.stored < header.raw) {
+        iov = (FsIoVec){block_packed, header.stored};
+        read_stored(fd, at, &iov, 1, header.stored);
+        int length = lz_decompress(block_packed, header.stored,
+                                   (uint8_t *)block_data, header.raw);
+        if (length != header.raw) {
+            memset(block_data + (length > 0 ? length : 0), 0,
+                   header.raw - (length > 0 ? length : 0));
+        }
+    } else {
+        iov = (FsIoVec){block_data, header.raw};
+        read_stored(fd, at, &iov, 1, header.raw);
     }
 
-    // Update the file table in flash memory
-    update_file_table();
+    block_entry = entry;
+    block_index = index;
+    block_generation = chain_generation;
+    block_length = header.raw;
+    return block_length;
 }
 
 /**
@@ -108,7 +1469,7 @@ void init_filesystem() {
  * @param m The mode for opening the file.
  * @return A file descriptor if successful, otherwise an error code.
  */
-int fs_open(const char *path, int m) {
+int open_helper(const char *path, int m) {
     // Check if both read and append modes are set
     if (check_mode(m, MODE_WRITE) && check_mode(m, MODE_APPEND)) {
         return INCORRECT_MODE;
@@ -120,13 +1481,18 @@ int fs_open(const char *path, int m) {
         file = fs_create(path);
     }
 
-    // Return error if file not found
-    if (file == FILE_NOT_FOUND) {
-        return FILE_NOT_FOUND;
+    // Return error if file not found or could not be created
+    if (file < 0) {
+        return file;
+    }
+
+    // Directories cannot be opened
+    if (table.files[file].is_dir) {
+        return IS_A_DIRECTORY;
     }
 
     // Return error if file is already open
-    if (file_table[file].in_use == 1) {
+    if (table.files[file].in_use == 1) {
         return FILE_ALREADY_OPEN;
     }
 
@@ -137,10 +1503,36 @@ int fs_open(const char *path, int m) {
     }
 
     // Update file table and open_files with file information
-    file_table[file].in_use = 1;
-    open_files[fd].entry = &file_table[file];
+    table.files[file].in_use = 1;
+    open_files[fd].entry = &table.files[file];
     open_files[fd].m = m;
     open_files[fd].position = 0;
+    open_files[fd].sector = 0;
+
+    // A new or empty file opened with MODE_COMPRESS is compressed from now on
+    FileEntry *entry = &table.files[file];
+    if (check_mode(m, MODE_COMPRESS) && entry->size == 0 &&
+        !entry->compressed) {
+        entry->compressed = true;
+        update_file_table();
+    }
+    if (entry->compressed) {
+        index_blocks(fd);
+    }
+    return fd;
+}
+
+/**
+ * @brief Opens a file with open_helper, recording how long it took.
+ *
+ * @param path The path of the file to open.
+ * @param m The mode for opening the file.
+ * @return A file descriptor if successful, otherwise an error code.
+ */
+int fs_open(const char *path, int m) {
+    uint64_t start = time_us_64();
+    int fd = open_helper(path, m);
+    record_latency(FS_OP_OPEN, start);
     return fd;
 }
 
@@ -150,6 +1542,19 @@ int fs_open(const char *path, int m) {
  * @param fd The file descriptor of the file to close.
  */
 void fs_close(int fd) {
+    // Ignore descriptors that were never opened
+    if (fd < 0 || fd >= FS_MAX_OPEN || open_files[fd].entry == NULL) {
+        return;
+    }
+
+    // Save anything still buffered for the file and free its cache slots
+    fs_sync(fd);
+    for (int i = 0; i < FS_CACHE_SLOTS; i++) {
+        if (cache[i].fd == fd) {
+            cache[i].fd = -1;
+        }
+    }
+
     open_files[fd].entry->in_use = 0;
     open_files[fd].m = 0;
     open_files[fd].position = 0;
@@ -158,20 +1563,22 @@ void fs_close(int fd) {
 
 /**
  * @brief Reads data from the file associated with the given file descriptor
- * into the buffer.
+ * into a vector of buffers.
  *
  * This function reads data from the file associated with the given file
- * descriptor into the buffer. Returns the number of bytes read if successful,
- * otherwise returns an error code.
+ * descriptor, filling the buffers in order in one pass over the sectors.
+ * Returns the number of bytes read if successful, otherwise returns an error
+ * code.
  *
  * @param fd The file descriptor of the file to read from.
- * @param buffer The buffer to store the read data.
- * @param size The maximum number of bytes to read.
+ * @param iov The buffers to store the read data.
+ * @param count The number of buffers.
+ * @param size The maximum number of bytes to read, their total length.
  * @return The number of bytes read if successful, otherwise an error code.
  */
-int fs_read(int fd, char *buffer, int size) {
+int read_helper(int fd, const FsIoVec *iov, int count, int size) {
     // Return error if file not open
-    if (open_files[fd].entry->in_use == 0) {
+    if (!is_open(fd)) {
         return FILE_NOT_OPEN;
     }
 
@@ -180,65 +1587,561 @@ int fs_read(int fd, char *buffer, int size) {
         return INCORRECT_MODE;
     }
 
-    // Return 0 if file size is 0
-    if (open_files[fd].entry->size == 0) {
+    // Return 0 if there is nothing left to read
+    FileEntry *entry = open_files[fd].entry;
+    uint32_t position = open_files[fd].position;
+    if (position >= entry->size) {
         return 0;
     }
 
     // Adjust size if reading beyond file size
-    if (open_files[fd].position + size > open_files[fd].entry->size) {
-        size = open_files[fd].entry->size - open_files[fd].position;
+    if (position + size > entry->size) {
+        size = entry->size - position;
     }
 
-    // Read data from flash memory into buffer
-    clear_buffer();
-    flash_read_safe(get_file(open_files[fd].entry->filename), temp_buffer,
-                    open_files[fd].entry->size);
-    memcpy(buffer, temp_buffer + open_files[fd].position, size);
+    if (verify_range(fd, position, size) < 0) {
+        return DATA_CORRUPT;
+    }
+    read_stored(fd, position, iov, count, size);
     open_files[fd].position += size;
+    stats.bytes_read += size;
     return size;
 }
 
 /**
- * @brief Helper function to write data from the buffer to the file.
+ * @brief Reads data from a compressed file into a vector of buffers.
  *
- * This function writes data from the buffer to the file associated with the
- * given file descriptor. Returns the number of bytes written if successful,
- * otherwise returns an error code.
+ * Each block the read covers is decompressed into block_data once, and the
+ * part of it that was asked for is copied out.
+ *
+ * @param fd The file descriptor of the file to read from.
+ * @param iov The buffers to store the read data.
+ * @param count The number of buffers.
+ * @param size The maximum number of bytes to read, their total length.
+ * @return The number of bytes read if successful, otherwise an error code.
+ */
+int compressed_read_helper(int fd, const FsIoVec *iov, int count, int size) {
+    // Return error if file not open
+    if (!is_open(fd)) {
+        return FILE_NOT_OPEN;
+    }
+
+    // Return error if read mode not set
+    if (!check_mode(open_files[fd].m, MODE_READ)) {
+        return INCORRECT_MODE;
+    }
+
+    // Return 0 if there is nothing left to read, and adjust size if reading
+    // beyond the end of the data
+    uint32_t position = open_files[fd].position;
+    uint32_t raw_size = data_size(fd);
+    if (position >= raw_size) {
+        return 0;
+    }
+    if (position + size > raw_size) {
+        size = raw_size - position;
+    }
+
+    int done = 0;
+    while (done < size) {
+        uint32_t offset = (position + done) % FS_BLOCK_SIZE;
+        int length = load_block(fd, (position + done) / FS_BLOCK_SIZE);
+        if (length < 0) {
+            return length;
+        }
+        uint32_t chunk = length - offset;
+        if (chunk > (uint32_t)(size - done)) {
+            chunk = size - done;
+        }
+        iov_copy(iov, count, done, block_data + offset, chunk, true);
+        done += chunk;
+    }
+
+    open_files[fd].position += size;
+    stats.bytes_read += size;
+    return size;
+}
+
+/**
+ * @brief Reads from a file into one buffer with fs_readv.
+ *
+ * @param fd The file descriptor of the file to read from.
+ * @param buffer The buffer to store the read data.
+ * @param size The maximum number of bytes to read.
+ * @return The number of bytes read if successful, otherwise an error code.
+ */
+int fs_read(int fd, char *buffer, int size) {
+    FsIoVec iov = {buffer, size};
+    return fs_readv(fd, &iov, 1);
+}
+
+/**
+ * @brief Reads from a file into several buffers with read_helper, recording
+ * how long it took.
+ *
+ * The buffers are filled in order, as if by one fs_read of their total
+ * length, so only the last one filled can be left short at the end of the
+ * file.
+ *
+ * @param fd The file descriptor of the file to read from.
+ * @param iov The buffers to store the read data.
+ * @param count The number of buffers.
+ * @return The number of bytes read if successful, otherwise an error code.
+ */
+int fs_readv(int fd, const FsIoVec *iov, int count) {
+    uint64_t start = time_us_64();
+    int read = iov_total(iov, count);
+    if (read >= 0 && is_open(fd) && open_files[fd].entry->compressed) {
+        read = compressed_read_helper(fd, iov, count, read);
+    } else if (read >= 0) {
+        read = read_helper(fd, iov, count, read);
+    }
+    record_latency(FS_OP_READ, start);
+    return read;
+}
+
+/**
+ * @brief Checks that the unused tail of a file's last sector is erased up to
+ * the given end, so that it can be programmed without an erase.
+ *
+ * @param fd The file descriptor of the file.
+ * @param end The end of the range about to be written.
+ * @return 1 if the range is erased or the file ends on a sector boundary,
+ * otherwise 0.
+ */
+int tail_is_erased(int fd, uint32_t end) {
+    const FileEntry *entry = open_files[fd].entry;
+    uint32_t used = entry->size % FS_SECTOR_SIZE;
+    if (used == 0) {
+        return 1;
+    }
+    uint32_t sector_start = entry->size - used;
+    uint32_t to = end - sector_start;
+    if (to > FS_SECTOR_SIZE) {
+        to = FS_SECTOR_SIZE;
+    }
+    return is_erased(file_sector(fd, sector_start), used, to - used);
+}
+
+/**
+ * @brief Helper function to write data past the end of a file.
+ *
+ * Bytes past the end of a file in its last sector are always left erased, so
+ * the new data is programmed straight into them without erasing the sector.
+ * Sectors added to the chain are only erased if they are not blank already.
+ * A gap between the end of the file and the position is filled with zeros.
  *
  * @param fd The file descriptor of the file to write to.
- * @param buffer The buffer containing the data to write.
- * @param size The number of bytes to write.
+ * @param iov The buffers containing the data to write.
+ * @param count The number of buffers.
+ * @param size The number of bytes to write, their total length.
+ * @return The number of bytes written if successful, otherwise an error code.
+ */
+int append_helper(int fd, const FsIoVec *iov, int count, int size) {
+    FileEntry *entry = open_files[fd].entry;
+    uint32_t position = open_files[fd].position;
+    uint32_t old_size = entry->size;
+    uint32_t end = position + size;
+    uint32_t have = sectors_for(old_size);
+
+    // Extend the chain before touching any data
+    if (resize_chain(entry, end) == NO_SPACE) {
+        return NO_SPACE;
+    }
+
+    uint32_t sector_start = old_size - old_size % FS_SECTOR_SIZE;
+    for (uint32_t i = sector_start / FS_SECTOR_SIZE; sector_start < end; i++) {
+        uint16_t sector = file_sector(fd, sector_start);
+        uint32_t from = old_size > sector_start ? old_size - sector_start : 0;
+        uint32_t to = end - sector_start;
+        if (to > FS_SECTOR_SIZE) {
+            to = FS_SECTOR_SIZE;
+        }
+
+        // A sector new to the chain may hold stale data
+        if (i >= have && !map_test(erased_map, sector)) {
+            erase_sector(sector);
+        }
+
+        // Gather the gap and the new data for this sector, then program it
+        uint32_t data_from = position > sector_start ? position - sector_start
+                                                     : 0;
+        if (data_from < from) {
+            data_from = from;
+        } else if (data_from > to) {
+            data_from = to;
+        }
+        memset(temp_buffer + from, 0, data_from - from);
+        iov_copy(iov, count, sector_start + data_from - position,
+                 temp_buffer + data_from, to - data_from, false);
+        flash_program_safe(sector, from, (const uint8_t *)temp_buffer + from,
+                           to - from);
+        map_set(erased_map, sector, false);
+        seal_sector(sector, to);
+        sector_start += FS_SECTOR_SIZE;
+    }
+
+    // Update the position and the file size
+    open_files[fd].position = end;
+    entry->size = end;
+    update_file_table();
+
+    // Return the size of data copied
+    return size;
+}
+
+/**
+ * @brief Helper function to write data into the cache of a file opened with
+ * MODE_WRITEBACK.
+ *
+ * The sectors covering the write are loaded into cache slots and only the
+ * slots are changed. Flash is written when a slot is evicted, and the file
+ * table when the file is synced or closed. A gap between the end of the file
+ * and the position is filled with zeros.
+ *
+ * @param fd The file descriptor of the file to write to.
+ * @param iov The buffers containing the data to write.
+ * @param count The number of buffers.
+ * @param size The number of bytes to write, their total length.
+ * @return The number of bytes written if successful, otherwise an error code.
+ */
+int writeback_helper(int fd, const FsIoVec *iov, int count, int size) {
+    FileEntry *entry = open_files[fd].entry;
+    uint32_t position = open_files[fd].position;
+    uint32_t old_size = entry->size;
+    uint32_t end = position + size;
+    uint32_t new_size = end > old_size ? end : old_size;
+    uint32_t start = position < old_size ? position : old_size;
+
+    // Extend the chain before touching any data
+    if (resize_chain(entry, new_size) == NO_SPACE) {
+        return NO_SPACE;
+    }
+
+    uint32_t sector_start = start - start % FS_SECTOR_SIZE;
+    for (; sector_start < end; sector_start += FS_SECTOR_SIZE) {
+        CacheSlot *slot = cache_load(fd, sector_start);
+
+        // Bytes of this sector the file used, and the part of the new data
+        // that lands in it
+        uint32_t used = old_size > sector_start ? old_size - sector_start : 0;
+        uint32_t from = position > sector_start ? position - sector_start : 0;
+        uint32_t to = end - sector_start;
+        if (used > FS_SECTOR_SIZE) {
+            used = FS_SECTOR_SIZE;
+        }
+        if (from > FS_SECTOR_SIZE) {
+            from = FS_SECTOR_SIZE;
+        }
+        if (to > FS_SECTOR_SIZE) {
+            to = FS_SECTOR_SIZE;
+        }
+
+        // Fill the gap with zeros and copy the new data
+        uint32_t dirty_from = from;
+        if (used < from) {
+            memset(slot->data + used, 0, from - used);
+            dirty_from = used;
+        }
+        iov_copy(iov, count, sector_start + from - position, slot->data + from,
+                 to - from, false);
+
+        // Grow the range of bytes to flush
+        if (slot->dirty_from == slot->dirty_to) {
+            slot->dirty_from = dirty_from;
+            slot->dirty_to = to;
+        } else {
+            if (dirty_from < slot->dirty_from) {
+                slot->dirty_from = dirty_from;
+            }
+            if (to > slot->dirty_to) {
+                slot->dirty_to = to;
+            }
+        }
+    }
+
+    // Update the position and the file size, leaving the file table in flash
+    // as it is until the file is synced
+    open_files[fd].position = end;
+    if (new_size != old_size) {
+        entry->size = new_size;
+        table_dirty = true;
+    }
+
+    // Return the size of data copied
+    return size;
+}
+
+/**
+ * @brief Helper function to write data from a vector of buffers to the file.
+ *
+ * This function writes the buffers, one after the other, to the file
+ * associated with the given file descriptor. Each sector they cover is
+ * written once and the file table is updated once, however many buffers
+ * there are. Returns the number of bytes written if successful, otherwise
+ * returns an error code.
+ *
+ * @param fd The file descriptor of the file to write to.
+ * @param iov The buffers containing the data to write.
+ * @param count The number of buffers.
+ * @param size The number of bytes to write, their total length.
+ * @return The number of bytes written if successful, otherwise an error code.
+ */
+int write_helper(int fd, const FsIoVec *iov, int count, int size) {
+    FileEntry *entry = open_files[fd].entry;
+    uint32_t position = open_files[fd].position;
+    uint32_t old_size = entry->size;
+
+    // Check if the write could ever fit in the volume
+    if (size < 0 ||
+        position + size >
+            (uint32_t)(volume_sectors - FS_META_SECTORS) * FS_SECTOR_SIZE) {
+        return OVERFLOW;
+    }
+    uint32_t end = position + size;
+    uint32_t new_size = end > old_size ? end : old_size;
+
+    // Rewrite every sector from the start of the write, or from the old end
+    // of the file if the write leaves a gap, which reads back as zeros
+    uint32_t start = position < old_size ? position : old_size;
+    if (start == end) {
+        return size;
+    }
+
+    // Sectors shared with copies of the file have to be copied before they,
+    // or the links leading to them, change. A rewrite moves the sectors it
+    // covers anyway, so only the ones before it are copied, unless the chain
+    // grows, which changes its last link, or the write is buffered, as a flush
+    // can program a sector in place
+    bool buffered = check_mode(open_files[fd].m, MODE_WRITEBACK);
+    uint32_t covered = new_size > old_size ? old_size : end;
+    uint32_t shared = shared_sectors(entry, covered);
+    if (shared > 0) {
+        if (sectors_for(new_size) - sectors_for(old_size) + shared >
+            count_free_sectors()) {
+            return NO_SPACE;
+        }
+        unshare_chain(entry, new_size > old_size || buffered
+                                 ? covered
+                                 : start - start % FS_SECTOR_SIZE);
+    }
+
+    // Buffer the write if the file was opened for write-back
+    if (buffered) {
+        return writeback_helper(fd, iov, count, size);
+    }
+
+    // Writing at or past the end of the file does not need an erase
+    if (position >= old_size && tail_is_erased(fd, end)) {
+        return append_helper(fd, iov, count, size);
+    }
+
+    // Extend the chain before touching any data
+    if (resize_chain(entry, new_size) == NO_SPACE) {
+        return NO_SPACE;
+    }
+
+    uint32_t sector_start = start - start % FS_SECTOR_SIZE;
+    uint16_t prev = sector_start == 0
+                        ? 0
+                        : file_sector(fd, sector_start - FS_SECTOR_SIZE);
+    for (; sector_start < end; sector_start += FS_SECTOR_SIZE) {
+        uint16_t sector = prev == 0 ? entry->first_sector : table.fat[prev];
+
+        // Read the existing data of this sector into temp_buffer
+        clear_buffer();
+        if (old_size > sector_start) {
+            uint32_t existing = old_size - sector_start;
+            flash_read_safe(sector, (uint8_t *)temp_buffer,
+                            existing < FS_SECTOR_SIZE ? existing
+                                                      : FS_SECTOR_SIZE);
+        }
+
+        // Copy the part of the new data that lands in this sector
+        uint32_t from = position > sector_start ? position : sector_start;
+        uint32_t to = end < sector_start + FS_SECTOR_SIZE
+                          ? end
+                          : sector_start + FS_SECTOR_SIZE;
+        if (from < to) {
+            iov_copy(iov, count, from - position,
+                     temp_buffer + from - sector_start, to - from, false);
+        }
+
+        // Write back the sector up to the new end of the file, moving it to
+        // a less worn sector if there is one
+        uint32_t length = new_size - sector_start;
+        sector = move_sector(entry, prev, sector);
+        write_sector(sector, temp_buffer,
+                     length < FS_SECTOR_SIZE ? length : FS_SECTOR_SIZE);
+        prev = sector;
+    }
+
+    // Update the position and the file size, and the file table if either
+    // the size or the chain changed
+    open_files[fd].position = end;
+    if (new_size != old_size) {
+        entry->size = new_size;
+        table_dirty = true;
+    }
+    if (table_dirty) {
+        update_file_table();
+    }
+
+    // Return the size of data copied
+    return size;
+}
+
+/**
+ * @brief Writes a block of a compressed file where its header goes, dropping
+ * whatever was stored from there on.
+ *
+ * The old blocks are dropped in RAM only, so the file table is written once
+ * with the new block. Before anything changes, the sectors the write copies
+ * or adds are checked to fit in the free ones and those dropped.
+ *
+ * @param fd The file descriptor of the file to write to.
+ * @param at The offset in the file where the block's header goes.
+ * @param record The header and the block as it is stored.
+ * @param length The total length of the two.
  * @return The number of bytes written if successful, otherwise an error code.
  */
-int write_helper(int fd, const char *buffer, int size) {
-    // Check if the position and size exceed the buffer
-    if (open_files[fd].position + size > sizeof(temp_buffer)) {
-        // Handle buffer overflow
-        return OVERFLOW; // or any appropriate error code
+int store_block(int fd, uint32_t at, const FsIoVec *record, uint32_t length) {
+    FileEntry *entry = open_files[fd].entry;
+    if (entry->size > at) {
+        uint32_t kept = sectors_for(at);
+        uint32_t dropped = sectors_for(entry->size) - kept -
+                           (shared_sectors(entry, entry->size) -
+                            shared_sectors(entry, kept * FS_SECTOR_SIZE));
+        if (shared_sectors(entry, at) + sectors_for(at + length) - kept >
+            count_free_sectors() + dropped) {
+            return NO_SPACE;
+        }
+
+        // The cache slots of dropped sectors go with them
+        for (int i = 0; i < FS_CACHE_SLOTS; i++) {
+            if (cache[i].fd == fd &&
+                cache[i].sector_start >= kept * FS_SECTOR_SIZE) {
+                cache[i].fd = -1;
+            }
+        }
+        unshare_chain(entry, at);
+        resize_chain(entry, at);
+        entry->size = at;
+        table_dirty = true;
+    }
+    open_files[fd].position = at;
+    return write_helper(fd, record, 2, length);
+}
+
+/**
+ * @brief Helper function to write data from a vector of buffers to a
+ * compressed file.
+ *
+ * The file is stored as blocks of FS_BLOCK_SIZE bytes, each compressed on its
+ * own with lz_compress, or stored as it is if that is not smaller. A block
+ * that changes size moves every block after it, so a write has to start in
+ * the last block or past it: the last block is loaded, the new data is added
+ * to it, and it and any new blocks are stored again with store_block.
+ *
+ * @param fd The file descriptor of the file to write to.
+ * @param iov The buffers containing the data to write.
+ * @param count The number of buffers.
+ * @param size The number of bytes to write, their total length.
+ * @return The number of bytes written, fewer than size if a block after the
+ * first does not fit, INVALID_POSITION if the write starts before the last
+ * block, otherwise an error code.
+ */
+int compressed_write_helper(int fd, const FsIoVec *iov, int count, int size) {
+    FS_FILE *file = &open_files[fd];
+    uint32_t position = file->position;
+    uint32_t raw_size = data_size(fd);
+
+    // Check if the write could ever fit in the volume
+    if (size < 0 ||
+        position + size >
+            (uint32_t)(volume_sectors - FS_META_SECTORS) * FS_SECTOR_SIZE) {
+        return OVERFLOW;
+    }
+    uint32_t end = position + size;
+    uint32_t new_size = end > raw_size ? end : raw_size;
+
+    // Start from the block of the write, or of the old end of the data if
+    // the write leaves a gap, which reads back as zeros
+    uint32_t start = position < raw_size ? position : raw_size;
+    if (start == end) {
+        return size;
+    }
+    uint32_t last = raw_size == 0 ? 0 : (raw_size - 1) / FS_BLOCK_SIZE;
+    uint32_t index = start / FS_BLOCK_SIZE;
+    if (index < last) {
+        return INVALID_POSITION;
+    }
+
+    // Load what the block holds, as it is rebuilt in block_data
+    int have = 0;
+    if (index * FS_BLOCK_SIZE < raw_size) {
+        have = load_block(fd, index);
+        if (have < 0) {
+            return have;
+        }
     }
+    uint32_t at = block_start(fd, index);
+    block_entry = NULL;
 
-    // Read existing data into temp_buffer
-    clear_buffer();
-    flash_read_safe(get_file(open_files[fd].entry->filename), temp_buffer,
-                    open_files[fd].entry->size);
+    uint32_t block_pos = index * FS_BLOCK_SIZE;
+    for (; block_pos < end; block_pos += FS_BLOCK_SIZE, index++) {
+        uint32_t length = new_size - block_pos;
+        if (length > FS_BLOCK_SIZE) {
+            length = FS_BLOCK_SIZE;
+        }
 
-    // Copy new data into temp_buffer at the appropriate position
-    memcpy(temp_buffer + open_files[fd].position, buffer, size);
+        // Fill the gap with zeros and copy the part of the new data that
+        // lands in this block
+        uint32_t from = position > block_pos ? position - block_pos : 0;
+        uint32_t to = end - block_pos;
+        if (from > length) {
+            from = length;
+        }
+        if (to > length) {
+            to = length;
+        }
+        if ((uint32_t)have < from) {
+            memset(block_data + have, 0, from - have);
+        }
+        iov_copy(iov, count, block_pos + from - position, block_data + from,
+                 to - from, false);
+        have = 0;
 
-    // Update the position
-    open_files[fd].position += size;
+        // Compress the block, or store it as it is if that is not smaller
+        int packed = lz_compress((const uint8_t *)block_data, length,
+                                 block_packed, length - 1);
+        BlockHeader header = {packed < 0 ? length : (uint32_t)packed, length};
+        FsIoVec record[2] = {
+            {&header, sizeof(header)},
+            {packed < 0 ? (void *)block_data : block_packed, header.stored}};
+        int written =
+            store_block(fd, at, record, sizeof(header) + header.stored);
+        if (written < 0) {
+            // The blocks before this one are stored, so the data they took
+            // is written
+            index_blocks(fd);
+            if (block_pos > position) {
+                file->position = block_pos;
+                return block_pos - position;
+            }
+            file->position = position;
+            return written;
+        }
 
-    // Update the file size
-    if (open_files[fd].entry->size < open_files[fd].position) {
-        open_files[fd].entry->size = open_files[fd].position;
+        // Remember where the block went for the next write
+        file->block = index;
+        file->block_start = at;
+        at += written;
     }
 
-    // Write back to the file
-    flash_write_safe(get_file(open_files[fd].entry->filename), temp_buffer,
-                     open_files[fd].entry->size);
-
-    // Return the size of data copied
+    file->position = end;
+    file->raw_size = new_size;
+    file->block_generation = chain_generation;
     return size;
 }
 
@@ -256,26 +2159,53 @@ int write_helper(int fd, const char *buffer, int size) {
  * @return The number of bytes written if successful, otherwise an error code.
  */
 int fs_write(int fd, const char *buffer, int size) {
-    // Return error if file not open
-    if (open_files[fd].entry->in_use == 0) {
-        return FILE_NOT_OPEN;
-    }
+    FsIoVec iov = {(char *)buffer, size};
+    return fs_writev(fd, &iov, 1);
+}
 
-    int t_size = size;
-    if (check_mode(open_files[fd].m, MODE_WRITE)) {
+/**
+ * @brief Writes several buffers to the file associated with the given file
+ * descriptor in one call.
+ *
+ * The buffers are written one after the other, as if by one fs_write of
+ * them joined together, so each sector they cover is erased and programmed
+ * at most once and the file table is updated once. Returns the number of
+ * bytes written if successful, otherwise returns an error code.
+ *
+ * @param fd The file descriptor of the file to write to.
+ * @param iov The buffers containing the data to write.
+ * @param count The number of buffers.
+ * @return The number of bytes written if successful, otherwise an error code.
+ */
+int fs_writev(int fd, const FsIoVec *iov, int count) {
+    uint64_t start = time_us_64();
+    int size = iov_total(iov, count);
+    int t_size;
+    if (!is_open(fd)) {
+        // Return error if file not open
+        t_size = FILE_NOT_OPEN;
+    } else if (check_mode(open_files[fd].m, MODE_WRITE)) {
         // Write data using helper function for MODE_WRITE
-        t_size = write_helper(fd, buffer, size);
+        t_size = open_files[fd].entry->compressed
+                     ? compressed_write_helper(fd, iov, count, size)
+                     : write_helper(fd, iov, count, size);
     } else if (check_mode(open_files[fd].m, MODE_APPEND)) {
         // Save current position, move to end of file, write data, then move
         // back to original position
         int cur_pos = open_files[fd].position;
         fs_seek(fd, 0, SEEK_END);
-        t_size = write_helper(fd, buffer, size);
+        t_size = open_files[fd].entry->compressed
+                     ? compressed_write_helper(fd, iov, count, size)
+                     : write_helper(fd, iov, count, size);
         fs_seek(fd, cur_pos, SEEK_SET);
     } else {
-        return INCORRECT_MODE;
+        t_size = INCORRECT_MODE;
     }
 
+    if (t_size > 0) {
+        stats.bytes_written += t_size;
+    }
+    record_latency(FS_OP_WRITE, start);
     return t_size;
 }
 
@@ -294,7 +2224,7 @@ int fs_write(int fd, const char *buffer, int size) {
  */
 int fs_seek(int fd, long offset, int whence) {
     // Return error if file not open
-    if (open_files[fd].entry->in_use == 0) {
+    if (!is_open(fd)) {
         return FILE_NOT_OPEN;
     }
 
@@ -307,195 +2237,797 @@ int fs_seek(int fd, long offset, int whence) {
         open_files[fd].position += offset;
         break;
     case SEEK_END:
-        open_files[fd].position = open_files[fd].entry->size - offset;
+        open_files[fd].position = data_size(fd) - offset;
         break;
     }
 
     return open_files[fd].position;
 }
 
+/**
+ * @brief Maps the file associated with the given file descriptor for reading
+ * without a copy.
+ *
+ * This function returns a pointer into the memory mapped (XIP) view of flash
+ * at the current position, along with how many bytes of the file can be read
+ * through it. That is up to the end of the file if its sectors are
+ * contiguous, which the allocator tries to keep them, otherwise up to the end
+ * of the contiguous run. Seeking past the mapped bytes and mapping again gives
+ * the next run. The position is left unchanged, and the pointer is only valid
+ * until the file is next written, formatted or removed.
+ *
+ * @param fd The file descriptor of the file to map.
+ * @param ptr Set to the start of the mapping.
+ * @param len Set to the number of bytes mapped, 0 at the end of the file.
+ * @return 0 if successful, otherwise an error code.
+ */
+int fs_mmap(int fd, const char **ptr, int *len) {
+    // Return error if file not open
+    if (!is_open(fd)) {
+        return FILE_NOT_OPEN;
+    }
+
+    // Return error if read mode not set, or if the bytes stored are not the
+    // data because the file is compressed
+    if (!check_mode(open_files[fd].m, MODE_READ) ||
+        open_files[fd].entry->compressed) {
+        return INCORRECT_MODE;
+    }
+
+    // Buffered writes have to reach flash to be mapped
+    fs_sync(fd);
+
+    // Nothing to map at or past the end of the file
+    FileEntry *entry = open_files[fd].entry;
+    uint32_t position = open_files[fd].position;
+    *ptr = NULL;
+    *len = 0;
+    if (position >= entry->size) {
+        return 0;
+    }
+
+    // Extend the mapping while the next sector follows on in flash
+    uint16_t first = file_sector(fd, position);
+    uint16_t sector = first;
+    uint32_t end = position - position % FS_SECTOR_SIZE + FS_SECTOR_SIZE;
+    while (end < entry->size && table.fat[sector] == sector + 1) {
+        sector++;
+        end += FS_SECTOR_SIZE;
+    }
+    if (end > entry->size) {
+        end = entry->size;
+    }
+    if (verify_range(fd, position, end - position) < 0) {
+        return DATA_CORRUPT;
+    }
+
+    *ptr = (const char *)flash_xip_address(first) + position % FS_SECTOR_SIZE;
+    *len = end - position;
+    return 0;
+}
+
+/**
+ * @brief Writes everything buffered for the file associated with the given
+ * file descriptor to flash.
+ *
+ * This function flushes the cache slots of a file opened with MODE_WRITEBACK
+ * and then the file table, if it has changed. It does nothing for files
+ * opened without MODE_WRITEBACK.
+ *
+ * @param fd The file descriptor of the file to sync.
+ * @return 0 if successful, otherwise an error code.
+ */
+int fs_sync(int fd) {
+    // Return error if file not open
+    if (!is_open(fd)) {
+        return FILE_NOT_OPEN;
+    }
+
+    // Flush the data before the table that refers to it
+    for (int i = 0; i < FS_CACHE_SLOTS; i++) {
+        if (cache[i].fd == fd) {
+            cache_flush(&cache[i]);
+        }
+    }
+    if (table_dirty) {
+        update_file_table();
+    }
+    return 0;
+}
+
+/**
+ * @brief Creates a new file or directory with the specified path.
+ *
+ * @param path The path of the entry to create, whose directory must exist.
+ * @param is_dir Whether the entry is a directory.
+ * @return The index of the new entry if successful, otherwise an error code.
+ */
+int create_entry(const char *path, bool is_dir) {
+    // Find the directory the entry goes in
+    const char *name;
+    int dir = resolve_parent(path, &name);
+    if (dir < 0) {
+        return dir;
+    }
+    if (!valid_name(name)) {
+        return INVALID_PATH;
+    }
+
+    // Check if file already exists
+    if (get_child(dir, name, strlen(name)) != FILE_NOT_FOUND) {
+        return FILE_ALREADY_EXISTS;
+    }
+
+    // Return error if file table is full
+    int i = free_entry;
+    if (i == 0) {
+        return FILE_TABLE_FULL;
+    }
+
+    // Take an unused entry and create the file
+    free_entry = name_next[i];
+    free_entries--;
+    strcpy(table.files[i].filename, name);
+    table.files[i].size = 0;
+    table.files[i].in_use = 0;
+    table.files[i].is_dir = is_dir;
+    table.files[i].compressed = false;
+    table.files[i].first_sector = 0;
+    table.files[i].parent = dir;
+    index_add(i);
+    update_file_table();
+    return i;
+}
+
+/**
+ * @brief Returns an entry to the list of unused entries and updates the file
+ * table. The entry must not own any sectors.
+ *
+ * @param file The index of the entry.
+ */
+void release_entry(int file) {
+    index_remove(file);
+    table.files[file].filename[0] = '\0';
+    table.files[file].size = 0;
+    table.files[file].in_use = 0;
+    table.files[file].is_dir = false;
+    table.files[file].compressed = false;
+    table.files[file].parent = 0;
+    name_next[file] = free_entry;
+    free_entry = file;
+    free_entries++;
+    update_file_table();
+}
+
 /**
  * @brief Creates a new file with the specified path.
  *
  * This function creates a new file with the specified path if it does not
- * already exist. Returns the index of the newly created file if successful,
- * otherwise returns an error code.
+ * already exist. The directories on the path must exist. Returns the index of
+ * the newly created file if successful, otherwise returns an error code.
  *
  * @param path The path of the file to create.
  * @return The index of the newly created file if successful, otherwise an error
  * code.
  */
-int fs_create(const char *path) {
-    // Check if file already exists
-    if (get_file(path) != FILE_NOT_FOUND) {
-        return FILE_ALREADY_EXISTS;
-    }
+int fs_create(const char *path) { return create_entry(path, false); }
 
-    // Find an empty slot in the file table and create the file
-    for (int i = 1; i < 25; i++) {
-        if (strcmp(file_table[i].filename, "\0") == 0) {
-            strcpy(file_table[i].filename, path);
-            file_table[i].size = 0;
-            file_table[i].in_use = 0;
-            update_file_table();
-            return i;
+/**
+ * @brief Prints the full path of an entry.
+ *
+ * The path is printed from the root down, looking each directory up from the
+ * entry again rather than recursing, as directories can nest deeper than the
+ * stack allows.
+ *
+ * @param file The index of the entry.
+ */
+void print_path(int file) {
+    int depth = 0;
+    for (int i = file; i != 0; i = table.files[i].parent) {
+        depth++;
+    }
+    for (int level = depth - 1; level >= 0; level--) {
+        int i = file;
+        for (int up = 0; up < level; up++) {
+            i = table.files[i].parent;
         }
+        printf("/%s", table.files[i].filename);
     }
-
-    // Return error if file table is full
-    return FILE_TABLE_FULL;
 }
 
 /**
- * @brief Lists all files in the filesystem along with their attributes.
- * @return The number of files in the filesystem.
+ * @brief Lists all files and directories in the filesystem by their full
+ * paths, along with their attributes.
+ *
+ * The directory tree is walked depth first through the entries of each
+ * directory, so only entries in use are visited.
+ *
+ * @return The number of files in the filesystem, not counting directories.
  */
 int fs_ls() {
     int count = 0;
     printf("\nfilename size in_use\n");
-    for (int i = 1; i < 25; i++) {
-        if (strcmp(file_table[i].filename, "\0") == 0) {
+    int i = first_child[0];
+    while (i != 0) {
+        print_path(i);
+        if (table.files[i].is_dir) {
+            printf("/ - -\n");
+        } else {
+            printf(" %d %d\n", table.files[i].size, table.files[i].in_use);
+            count++;
+        }
+
+        // Go into a directory, else on to the next entry, climbing out of
+        // directories that have none left
+        if (table.files[i].is_dir && first_child[i] != 0) {
+            i = first_child[i];
             continue;
         }
-        printf("%s %d %d\n", file_table[i].filename, file_table[i].size,
-               file_table[i].in_use);
-        count++;
+        while (i != 0 && next_sibling[i] == 0) {
+            i = table.files[i].parent;
+        }
+        if (i != 0) {
+            i = next_sibling[i];
+        }
     }
     return count;
 }
 
+/**
+ * @brief Finds a directory by its path, which can name the root.
+ *
+ * @param path The path of the directory, "" or "/" for the root.
+ * @return The entry of the directory, 0 for the root, otherwise
+ * FILE_NOT_FOUND or NOT_A_DIRECTORY.
+ */
+int get_dir(const char *path) {
+    if (path[0] == '\0' || strcmp(path, "/") == 0) {
+        return 0;
+    }
+    int dir = get_file(path);
+    if (dir > 0 && !table.files[dir].is_dir) {
+        return NOT_A_DIRECTORY;
+    }
+    return dir;
+}
+
+/**
+ * @brief Fills in the attributes of an entry.
+ *
+ * @param file The entry, 0 for the root.
+ * @param st Filled with its attributes.
+ */
+void stat_entry(int file, FsStat *st) {
+    // Entry 0 holds the magic string rather than the root
+    if (file == 0) {
+        st->size = 0;
+        st->is_dir = true;
+        st->compressed = false;
+        return;
+    }
+    st->size = table.files[file].size;
+    st->is_dir = table.files[file].is_dir;
+    st->compressed = table.files[file].compressed;
+}
+
+/**
+ * @brief Gets the attributes of a file or directory.
+ *
+ * @param path The path of the file or directory, "" or "/" for the root.
+ * @param st Filled with its attributes.
+ * @return 0 if successful, otherwise FILE_NOT_FOUND or NOT_A_DIRECTORY if a
+ * directory on the way is a file.
+ */
+int fs_stat(const char *path, FsStat *st) {
+    int file = get_dir(path);
+    if (file == NOT_A_DIRECTORY) {
+        file = get_file(path);
+    }
+    if (file < 0) {
+        return file;
+    }
+    stat_entry(file, st);
+    return 0;
+}
+
+/**
+ * @brief Reads the entries of a directory one at a time.
+ *
+ * Each call fills in the entry after the one the cookie stands for, and
+ * returns the cookie of the entry it filled in, so a directory is listed by
+ * passing 0 and then each returned cookie until 0 comes back. Entries are
+ * read from the lists kept in RAM, so each call takes constant time.
+ *
+ * @param path The path of the directory, "" or "/" for the root.
+ * @param cookie 0 for the first entry, otherwise what the last call returned.
+ * @param name Filled with the name of the entry, it must have room for
+ * FS_NAME_SIZE bytes.
+ * @param st Filled with its attributes.
+ * @return The cookie of the entry, 0 if there are no entries left,
+ * FILE_NOT_FOUND or NOT_A_DIRECTORY if the path is not a directory, or
+ * INVALID_POSITION if the cookie is not one of its entries.
+ */
+int fs_readdir(const char *path, int cookie, char *name, FsStat *st) {
+    int dir = get_dir(path);
+    if (dir < 0) {
+        return dir;
+    }
+    int file = first_child[dir];
+    if (cookie != 0) {
+        if (cookie < 0 || cookie >= FS_FILE_ENTRIES ||
+            table.files[cookie].filename[0] == '\0' ||
+            table.files[cookie].parent != dir) {
+            return INVALID_POSITION;
+        }
+        file = next_sibling[cookie];
+    }
+    if (file == 0) {
+        return 0;
+    }
+    memcpy(name, table.files[file].filename, FS_NAME_SIZE);
+    stat_entry(file, st);
+    return file;
+}
+
 /**
  * @brief Formats the file with the specified path.
  *
  * This function formats the file with the specified path, resetting its size to
- * 0.
+ * 0 and freeing its sectors.
  *
  * @param path The path of the file to format.
- * @return FILE_NOT_FOUND if the file does not exist, otherwise no return value.
+ * @return FILE_NOT_FOUND if the file does not exist, IS_A_DIRECTORY if it is
+ * a directory, otherwise 0.
  */
 int fs_format(const char *path) {
     // Find the file and reset its size to 0
     int file = get_file(path);
-    if (file == FILE_NOT_FOUND) {
-        return FILE_NOT_FOUND;
+    if (file < 0) {
+        return file;
+    }
+    if (table.files[file].is_dir) {
+        return IS_A_DIRECTORY;
+    }
+    cache_drop(&table.files[file]);
+    resize_chain(&table.files[file], 0);
+    table.files[file].size = 0;
+    update_file_table();
+    return 0;
+}
+
+/**
+ * @brief Removes every file and directory with a single update of the file
+ * table, freeing their sectors without erasing them.
+ */
+void wipe_table() {
+    // Drop everything buffered and clear file table
+    cache_drop(NULL);
+    for (int i = 1; i < FS_FILE_ENTRIES; i++) {
+        table.files[i].filename[0] = '\0';
+        table.files[i].size = 0;
+        table.files[i].in_use = 0;
+        table.files[i].is_dir = false;
+        table.files[i].compressed = false;
+        table.files[i].first_sector = 0;
+        table.files[i].parent = 0;
+    }
+
+    // Free every data sector
+    for (int i = FS_META_SECTORS; i < volume_sectors; i++) {
+        table.fat[i] = FAT_FREE;
     }
-    file_table[file].size = 0;
+    chain_generation++;
     update_file_table();
-    flash_erase_safe(file);
+    index_build();
 }
 
 /**
  * @brief Wipes all files and resets the filesystem.
  *
  * This function wipes all files and resets the filesystem, clearing all data
- * and erasing flash memory.
+ * and erasing flash memory. The files are removed from the file table before
+ * any sector is erased, so a power loss never leaves a file whose data is
+ * gone. The data sectors are then erased as one run, which takes the 64 KB
+ * blocks of the volume a block at a time, and the wear is recorded with a
+ * second update of the table.
  */
 void fs_wipe() {
-    // Clear file table and erase flash memory for each file
-    for (int i = 1; i < 25; i++) {
-        file_table[i].filename[0] = '\0';
-        file_table[i].size = 0;
-        file_table[i].in_use = 0;
-        flash_erase_safe(i);
-    }
+    wipe_table();
+    erase_sectors(FS_META_SECTORS, volume_sectors - FS_META_SECTORS);
     update_file_table();
 }
 
 /**
- * @brief Moves a file from the old path to the new path.
+ * @brief Wipes all files without erasing flash memory.
+ *
+ * The files are removed with a single update of the file table, so this
+ * takes the same short time however much data there is, and a power loss
+ * leaves either every file or none. Their sectors are free but not erased:
+ * fs_idle erases them in the background, and a write given one before then
+ * erases it first. Nothing else keeps track of them, as the allocation table
+ * already tells the free sectors apart and the erased ones are found again by
+ * init_filesystem.
+ */
+void fs_wipe_lazy() { wipe_table(); }
+
+/**
+ * @brief Moves a file or directory from the old path to the new path.
  *
- * This function moves a file from the old path to the new path. If the file at
- * the new path already exists, it overwrites the existing file with the content
- * of the file at the old path.
+ * This function moves a file or directory from the old path to the new path,
+ * which can be in another directory. A directory is moved with everything in
+ * it. If a file at the new path already exists, it is replaced by the file at
+ * the old path in a single update of the file table, so after a power loss
+ * the new path holds either the old or the new content.
  *
  * @param old_path The old path of the file to move.
  * @param new_path The new path of the file.
- * @return FILE_NOT_FOUND if the file at the old path does not exist, otherwise
- * no return value.
+ * @return 0 if successful, FILE_NOT_FOUND if the file at the old path or the
+ * directory of the new path does not exist, INVALID_PATH if a directory would
+ * move into itself, FILE_ALREADY_EXISTS or IS_A_DIRECTORY if a directory is
+ * in the way.
  */
-int fs_mv(const char *old_path, const char *new_path) {
+int mv_helper(const char *old_path, const char *new_path) {
     // Get the index of the file at the old path
     int old_file = get_file(old_path);
-    if (old_file == FILE_NOT_FOUND) {
-        return FILE_NOT_FOUND;
+    if (old_file < 0) {
+        return old_file;
+    }
+
+    // Find the directory the file moves into
+    const char *name;
+    int dir = resolve_parent(new_path, &name);
+    if (dir < 0) {
+        return dir;
+    }
+    if (!valid_name(name)) {
+        return INVALID_PATH;
+    }
+
+    // A directory cannot move into itself or anything below it
+    for (int i = dir; i != 0; i = table.files[i].parent) {
+        if (i == old_file) {
+            return INVALID_PATH;
+        }
     }
 
     // Check if a file exists at the new path
-    int new_file = get_file(new_path);
-    if (new_file == FILE_NOT_FOUND) {
-        // Update the filename and update the file table if no file exists at
-        // the new path
-        strcpy(file_table[old_file].filename, new_path);
+    int new_file = get_child(dir, name, strlen(name));
+    if (new_file == old_file) {
+        return 0;
+    } else if (new_file == FILE_NOT_FOUND) {
+        // Update the name and directory and update the file table if no file
+        // exists at the new path
+        index_remove(old_file);
+        strcpy(table.files[old_file].filename, name);
+        table.files[old_file].parent = dir;
+        index_add(old_file);
         update_file_table();
+    } else if (table.files[old_file].is_dir) {
+        return FILE_ALREADY_EXISTS;
+    } else if (table.files[new_file].is_dir) {
+        return IS_A_DIRECTORY;
     } else {
-        // Copy the file from the old path to the new path and then remove the
-        // file at the old path
-        fs_cp(old_path, new_path);
-        file_table[old_file].in_use = file_table[new_file].in_use;
-        if (strcmp(old_path, new_path) != 0) {
-            fs_rm(old_path);
-        }
+        // Hand the old file's sectors to the file at the new path, whose entry
+        // is kept so descriptors open on it stay valid, and release its own
+        // sectors for fs_idle to erase. Releasing the old entry writes the
+        // file table once with all of it
+        FileEntry *from = &table.files[old_file];
+        FileEntry *to = &table.files[new_file];
+        cache_flush_entry(from);
+        cache_drop(to);
+        resize_chain(to, 0);
+        to->first_sector = from->first_sector;
+        to->size = from->size;
+        to->compressed = from->compressed;
+        from->first_sector = 0;
+        from->size = 0;
+        chain_generation++;
+        release_entry(old_file);
     }
 
     return 0;
 }
 
+/**
+ * @brief Moves a file with mv_helper, recording how long it took.
+ *
+ * @param old_path The old path of the file to move.
+ * @param new_path The new path of the file.
+ * @return 0 if successful, otherwise an error code.
+ */
+int fs_mv(const char *old_path, const char *new_path) {
+    uint64_t start = time_us_64();
+    int result = mv_helper(old_path, new_path);
+    record_latency(FS_OP_MV, start);
+    return result;
+}
+
 /**
  * @brief Copies a file from the source path to the destination path.
  *
  * This function copies a file from the source path to the destination path.
  * If the destination file already exists, it overwrites the existing file.
+ * No data is copied: both files share the source's sectors until one of them
+ * is written.
  *
  * @param source_path The path of the source file to copy.
  * @param dest_path The path of the destination file.
- * @return FILE_NOT_FOUND if the source file does not exist, otherwise no return
- * value.
+ * @return 0 if successful, FILE_NOT_FOUND if the source file does not exist,
+ * IS_A_DIRECTORY if either path is a directory, FILE_TABLE_FULL if the
+ * destination cannot be created.
  */
-int fs_cp(const char *source_path, const char *dest_path) {
+int cp_helper(const char *source_path, const char *dest_path) {
     // Get the index of the source file
     int source = get_file(source_path);
     int dest = get_file(dest_path);
 
     // Check if the source file exists
-    if (source == FILE_NOT_FOUND) {
-        return FILE_NOT_FOUND;
+    if (source < 0) {
+        return source;
+    }
+
+    // Only files can be copied
+    if (table.files[source].is_dir || (dest > 0 && table.files[dest].is_dir)) {
+        return IS_A_DIRECTORY;
+    }
+
+    // Copying a file onto itself leaves it as it is
+    if (dest == source) {
+        return 0;
     }
 
     // Create or get the index of the destination file
-    if (dest == FILE_NOT_FOUND) {
+    if (dest < 0) {
         dest = fs_create(dest_path);
+        if (dest < 0) {
+            return dest;
+        }
     }
 
-    // Copy the size and content of the source file to the destination file
-    file_table[dest].size = file_table[source].size;
+    // Release the destination's old sectors, and share the source's chain
+    // with it instead of copying the data. The source's buffered writes have
+    // to be in flash to be shared, and each sector is copied once either file
+    // changes it
+    FileEntry *from = &table.files[source];
+    FileEntry *to = &table.files[dest];
+    cache_flush_entry(from);
+    cache_drop(to);
+    resize_chain(to, 0);
+    to->first_sector = from->first_sector;
+    to->size = from->size;
+    to->compressed = from->compressed;
+    for (uint16_t sector = from->first_sector; sector != 0 && sector != FAT_END;
+         sector = table.fat[sector]) {
+        sector_refs[sector]++;
+    }
+    chain_generation++;
     update_file_table();
-    clear_buffer();
-    flash_read_safe(source, temp_buffer, file_table[source].size);
-    flash_write_safe(dest, temp_buffer, file_table[dest].size);
     return 0;
 }
 
+/**
+ * @brief Copies a file with cp_helper, recording how long it took.
+ *
+ * @param source_path The path of the source file to copy.
+ * @param dest_path The path of the destination file.
+ * @return 0 if successful, otherwise an error code.
+ */
+int fs_cp(const char *source_path, const char *dest_path) {
+    uint64_t start = time_us_64();
+    int result = cp_helper(source_path, dest_path);
+    record_latency(FS_OP_CP, start);
+    return result;
+}
+
 /**
  * @brief Removes the file at the specified path.
  *
  * This function removes the file at the specified path from the filesystem.
  *
  * @param path The path of the file to remove.
- * @return FILE_NOT_FOUND if the file does not exist, otherwise no return value.
+ * @return FILE_NOT_FOUND if the file does not exist, IS_A_DIRECTORY if it is
+ * a directory, otherwise 0.
  */
-int fs_rm(const char *path) {
+int rm_helper(const char *path) {
     // Get the index of the file to remove
     int file = get_file(path);
-    if (file == FILE_NOT_FOUND) {
-        return FILE_NOT_FOUND;
+    if (file < 0) {
+        return file;
+    }
+    if (table.files[file].is_dir) {
+        return IS_A_DIRECTORY;
     }
 
-    // Clear the filename, size, and in_use flag of the file, erase flash memory
-    // for the file, and update the file table
-    file_table[file].filename[0] = '\0';
-    file_table[file].size = 0;
-    file_table[file].in_use = 0;
-    update_file_table();
-    flash_erase_safe(file);
+    // Free the file's sectors, clear the filename, size, and in_use flag of
+    // the file, and update the file table
+    cache_drop(&table.files[file]);
+    resize_chain(&table.files[file], 0);
+    release_entry(file);
+    return 0;
+}
+
+/**
+ * @brief Removes a file with rm_helper, recording how long it took.
+ *
+ * @param path The path of the file to remove.
+ * @return 0 if successful, FILE_NOT_FOUND if the file does not exist.
+ */
+int fs_rm(const char *path) {
+    uint64_t start = time_us_64();
+    int result = rm_helper(path);
+    record_latency(FS_OP_RM, start);
+    return result;
+}
+
+/**
+ * @brief Creates a new directory with the specified path.
+ *
+ * @param path The path of the directory to create, whose parent must exist.
+ * @return 0 if successful, FILE_ALREADY_EXISTS if something exists at the
+ * path, otherwise an error code.
+ */
+int fs_mkdir(const char *path) {
+    int dir = create_entry(path, true);
+    return dir < 0 ? dir : 0;
+}
+
+/**
+ * @brief Removes the empty directory at the specified path.
+ *
+ * @param path The path of the directory to remove.
+ * @return 0 if successful, FILE_NOT_FOUND if it does not exist,
+ * NOT_A_DIRECTORY if it is a file or DIRECTORY_NOT_EMPTY if anything is in
+ * it.
+ */
+int fs_rmdir(const char *path) {
+    int dir = get_file(path);
+    if (dir < 0) {
+        return dir;
+    }
+    if (!table.files[dir].is_dir) {
+        return NOT_A_DIRECTORY;
+    }
+    if (first_child[dir] != 0) {
+        return DIRECTORY_NOT_EMPTY;
+    }
+    release_entry(dir);
     return 0;
 }
+
+/**
+ * @brief Does one step of background work while the system is idle.
+ *
+ * This function erases a sector of the metadata group the file table moves
+ * into next or, failing that, a free sector not known to be erased, so that
+ * later writes and table updates only have to program. It erases at most one
+ * sector per call, so it can be called whenever there is nothing else to do
+ * without holding anything up for long. Free sectors are left alone while the
+ * file table has changes not yet in flash, as the copy in flash may still
+ * refer to them.
+ *
+ * @return The number of sectors still waiting to be erased.
+ */
+int fs_idle() {
+    int waiting = 0;
+    bool erased = false;
+    uint32_t group = next_meta_group();
+    for (uint32_t i = 0; i < META_GROUP_SECTORS; i++) {
+        uint32_t sector = group * META_GROUP_SECTORS + i;
+        if (map_test(erased_map, sector)) {
+            continue;
+        }
+        if (erased) {
+            waiting++;
+        } else {
+            erase_sector(sector);
+            erased = true;
+        }
+    }
+    for (int w = 0; w < FS_MAP_WORDS && !table_dirty; w++) {
+        uint32_t bits = free_map[w] & ~erased_map[w];
+        if (bits != 0 && !erased) {
+            erase_sector(w * 32 + __builtin_ctz(bits));
+            erased = true;
+            bits &= bits - 1;
+        }
+        waiting += __builtin_popcount(bits);
+    }
+    return waiting;
+}
+
+/**
+ * @brief Checks the next sectors holding file data against their CRC32,
+ * carrying on from the sector the last call stopped at.
+ *
+ * A call is meant to take little time, so data going bad is found in the
+ * background, a few sectors at a time, before it is read. Sectors whose data
+ * is still in a cache slot are passed over. A corrupt sector is checked again
+ * the next time it is read with MODE_VERIFY.
+ *
+ * @param sectors The number of sectors to check.
+ * @return The number of them that did not match.
+ */
+int fs_scrub(int sectors) {
+    int corrupt = 0;
+    for (int i = FS_META_SECTORS; i < volume_sectors && sectors > 0; i++) {
+        if (scrub_next < FS_META_SECTORS || scrub_next >= volume_sectors) {
+            scrub_next = FS_META_SECTORS;
+        }
+        uint16_t sector = scrub_next++;
+        if (table.fat[sector] == FAT_FREE || sector_pending(sector)) {
+            continue;
+        }
+        sectors--;
+        corrupt += !verify_sector(sector);
+    }
+    return corrupt;
+}
+
+/**
+ * @brief Does the idle work of a loop waiting for input.
+ *
+ * A sector is erased ahead of writes or, once there are none left to erase,
+ * a sector of file data is checked. Nothing is done while the flash worker
+ * has requests outstanding, as it runs them on the same file table.
+ */
+void fs_idle_step() {
+    if (fs_async_poll() == 0 && fs_idle() == 0) {
+        fs_scrub(1);
+    }
+}
+
+/**
+ * @brief Reports the free space of the volume.
+ *
+ * The sectors are counted a word of the free and erased bitmaps at a time,
+ * and the unused entries are counted as they are handed out and returned, so
+ * this is cheap enough to call before every write.
+ *
+ * @return The free space.
+ */
+FsSpace fs_df() {
+    FsSpace space = {volume_sectors - FS_META_SECTORS, 0, 0, free_entries};
+    for (int w = 0; w < FS_MAP_WORDS; w++) {
+        space.free_sectors += __builtin_popcount(free_map[w]);
+        space.erased_sectors += __builtin_popcount(free_map[w] & erased_map[w]);
+    }
+    return space;
+}
+
+/**
+ * @brief Reports how many times each sector of the volume has been erased.
+ *
+ * The counts are kept in the file table, so erases since the table was last
+ * written are lost if power fails.
+ *
+ * @param counts Filled with the erase count of each sector, it must have room
+ * for FS_NUM_SECTORS counts.
+ * @return The number of sectors in the volume, at most FS_NUM_SECTORS.
+ */
+int fs_wear(uint32_t *counts) {
+    memcpy(counts, table.erase_count, sizeof(table.erase_count));
+    return volume_sectors;
+}
+
+/**
+ * @brief Gets the performance counters.
+ *
+ * The counters cover the flash operations made, including erases and
+ * programs of the file table and the time spent with interrupts disabled for
+ * them, as well as the work done by the filesystem itself since the last call
+ * to fs_reset_stats.
+ *
+ * @return The counters.
+ */
+FsStats fs_get_stats() {
+    stats.flash = flash_get_stats();
+    return stats;
+}
+
+/**
+ * @brief Sets every performance counter back to zero.
+ */
+void fs_reset_stats() {
+    memset(&stats, 0, sizeof(stats));
+    flash_reset_stats();
+}
@@ -1,19 +1,71 @@
 #ifndef FILESYSTEM_H
 #define FILESYSTEM_H
 
+#include "flash_ops.h"
+#include "pico/stdlib.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 
-#define MAX_FILES 10 // Maximum number of files in the filesystem
+#define FS_PAGE_SIZE 256    // Size of a flash page, the unit of programming
+#define FS_SECTOR_SIZE 4096 // Size of a flash sector, the unit of allocation
 
-#define MODE_READ (1 << 0)   // 0001
-#define MODE_WRITE (1 << 1)  // 0010
-#define MODE_APPEND (1 << 2) // 0100
-#define MODE_CREATE (1 << 3) // 1000
+// Capacities, which can be set at build time. The metadata sectors have to
+// hold at least two copies of the file table, which grows with FS_MAX_FILES
+// and FS_NUM_SECTORS. Setting FS_NUM_SECTORS or FS_META_SECTORS to 0 sizes
+// them from the flash, see below.
+#ifndef FS_MAX_FILES
+#define FS_MAX_FILES 24 // Files and directories the file table holds
+#endif
+#ifndef FS_MAX_OPEN
+#define FS_MAX_OPEN 10 // Files that can be open at once
+#endif
+#ifndef FS_NUM_SECTORS
+#define FS_NUM_SECTORS 26 // Sectors in the volume, including the table's
+#endif
+#ifndef FS_META_SECTORS
+#define FS_META_SECTORS 2 // Sectors at the start the file table rotates in
+#endif
+
+// The volume starts at the first sector after the firmware image and uses at
+// most FS_NUM_SECTORS sectors of what is left. 0 leaves room for the whole
+// flash, so that every sector after the image is used whatever its size.
+#if FS_NUM_SECTORS == 0
+#undef FS_NUM_SECTORS
+#define FS_NUM_SECTORS (PICO_FLASH_SIZE_BYTES / FS_SECTOR_SIZE)
+#endif
+
+#define FS_FILE_ENTRIES (FS_MAX_FILES + 1) // Entries of the file table
+
+#define FS_NAME_SIZE 25 // Room for a name within its directory, with its NUL
+
+#define FS_META_COMMIT 0x434D4954 // Commit word of a complete table copy
+
+#define FS_CACHE_SLOTS 2 // Sector buffers shared by write-back descriptors
+
+#define FS_BLOCK_SIZE 4096 // Data compressed at once in a compressed file
+
+#define FS_WEAR_SLACK 8     // Extra erases accepted to keep a file contiguous
+#define FS_ENDURANCE 100000 // Rated erase cycles of a flash sector
+
+#define FAT_FREE 0x0000     // Sector is not part of any file
+#define FAT_END 0xFFFF      // Last sector of a chain
+#define FAT_RESERVED 0xFFFE // Sector holds copies of the file table
+
+#define MODE_READ (1 << 0)      // 00001
+#define MODE_WRITE (1 << 1)     // 00010
+#define MODE_APPEND (1 << 2)    // 00100
+#define MODE_CREATE (1 << 3)    // 01000
+#define MODE_WRITEBACK (1 << 4) // 10000, buffer writes until fs_sync or close
+#define MODE_COMPRESS (1 << 5)  // 100000, compress a new or empty file
+#define MODE_VERIFY (1 << 6)    // 1000000, check the CRC32 of sectors read
 
 enum whence { FS_SEEK_SET, FS_SEEK_CUR, FS_SEEK_END };
 
+// Operations whose latency is recorded
+enum fs_ops { FS_OP_OPEN, FS_OP_READ, FS_OP_WRITE, FS_OP_CP, FS_OP_MV, FS_OP_RM,
+              FS_OPS };
+
 enum errors {
     FILE_NOT_FOUND = -1,
     FILE_ALREADY_EXISTS = -2,
@@ -23,22 +75,123 @@ enum errors {
     FILE_ALREADY_OPEN = -6,
     OPENED_FILES_FULL = -7,
     OVERFLOW = -8,
+    NO_SPACE = -9,
+    QUEUE_FULL = -10,
+    INVALID_PATH = -11,
+    NOT_A_DIRECTORY = -12,
+    IS_A_DIRECTORY = -13,
+    DIRECTORY_NOT_EMPTY = -14,
+    INVALID_POSITION = -15,
+    DATA_CORRUPT = -16,
 };
 
-// Structure to hold metadata for a file
+// Structure to hold metadata for a file or directory
 typedef struct {
-    char filename[25]; // Filename of the file
-    uint32_t size;     // Size of the file in bytes
-    bool in_use;       // Flag indicating if the file entry is in use
+    char filename[25];     // Name of the file within its directory
+    uint32_t size;         // Size of the file in bytes
+    bool in_use;           // Flag indicating if the file entry is in use
+    bool is_dir;           // Set if the entry is a directory
+    bool compressed;       // Set if the data is stored as compressed blocks
+    uint16_t first_sector; // First sector of the file, 0 if it has none
+    uint16_t parent;       // Entry of the directory holding it, 0 for the root
 } FileEntry;
 
+// Structure of the file table. Like FAT, a file's data is a chain of
+// sectors where fat[sector] holds the next sector of the chain.
+typedef struct {
+    FileEntry files[FS_FILE_ENTRIES];     // File entries, 0 holds the magic
+    uint16_t fat[FS_NUM_SECTORS];         // Allocation table
+    uint32_t erase_count[FS_NUM_SECTORS]; // Times each sector was erased
+    uint32_t sector_crc[FS_NUM_SECTORS];  // CRC32 of each sector's file data
+} FileTable;
+
+// Header of a copy of the file table in the metadata sectors, followed by the
+// table itself. The commit word is programmed last, so a copy cut short by a
+// power loss is never taken as valid.
+typedef struct {
+    uint32_t sequence; // Number of the update, the newest copy has the highest
+    uint32_t crc;      // CRC32 of the table
+    uint32_t commit;   // FS_META_COMMIT once the copy is complete
+    uint32_t reserved; // Left erased
+} MetaHeader;
+
+// 0 metadata sectors gives the file table four groups of as many sectors as
+// a copy takes, so it rotates over four times the room it needs
+#if FS_META_SECTORS == 0
+#undef FS_META_SECTORS
+#define FS_META_SECTORS                                                        \
+    ((int)(4 * ((sizeof(MetaHeader) + sizeof(FileTable) + FS_SECTOR_SIZE - 1) \
+                / FS_SECTOR_SIZE)))
+#endif
+
+// Header of a block of a compressed file, followed by the block as it is
+// stored. The blocks follow one another in the file's sectors.
+typedef struct {
+    uint16_t stored; // Length stored, less than raw if the block is compressed
+    uint16_t raw;    // Length of the data, FS_BLOCK_SIZE but for the last block
+} BlockHeader;
+
 // Structure representing a file handle
 typedef struct {
-    FileEntry *entry;  // Pointer to the file's metadata
-    uint32_t position; // Current position in the file
-    int m;             // Mode of file operation
+    FileEntry *entry;      // Pointer to the file's metadata
+    uint32_t position;     // Current position in the file
+    int m;                 // Mode of file operation
+    uint16_t sector;       // Last sector of the chain resolved, 0 if none
+    uint32_t sector_start; // Offset in the file where that sector starts
+    uint32_t generation;   // Chain generation the cached sector belongs to
+    uint32_t raw_size;     // Size of the data of a compressed file
+    uint32_t block;        // Last block of a compressed file resolved
+    uint32_t block_start;  // Offset in the file where that block's header is
+    uint32_t block_generation; // Chain generation the three above belong to
 } FS_FILE;
 
+// Structure of a write-back cache slot, holding one sector of an open file
+typedef struct {
+    int fd;                    // Descriptor owning the slot, -1 if free
+    uint16_t sector;           // Sector of the chain the data belongs to
+    uint32_t sector_start;     // Offset in the file where the sector starts
+    uint32_t dirty_from;       // Start of the bytes not yet in flash
+    uint32_t dirty_to;         // End of those bytes, dirty_from if clean
+    uint32_t last_used;        // When the slot was last used, for eviction
+    char data[FS_SECTOR_SIZE]; // Contents of the sector
+} CacheSlot;
+
+// Structure describing one buffer of a vectored read or write. The buffer is
+// only read from by fs_writev.
+typedef struct {
+    void *base; // Start of the buffer
+    int len;    // Length of the buffer in bytes
+} FsIoVec;
+
+// Attributes of a file or directory, as reported by fs_stat and fs_readdir
+typedef struct {
+    uint32_t size;   // Size of the file in bytes, as stored if compressed
+    bool is_dir;     // Set if it is a directory
+    bool compressed; // Set if the data is stored as compressed blocks
+} FsStat;
+
+// Free space of the volume, as reported by fs_df
+typedef struct {
+    uint32_t sectors;        // Data sectors in the volume
+    uint32_t free_sectors;   // Sectors no file uses
+    uint32_t erased_sectors; // Free sectors that can be written without erase
+    uint32_t free_entries;   // Unused entries of the file table
+} FsSpace;
+
+// Counters of the work done by the filesystem since the last reset
+typedef struct {
+    FlashStats flash;       // Flash operations, including the file table's
+    uint32_t table_updates; // Copies of the file table written
+    uint32_t buffer_clears; // Times the temporary buffer was cleared
+    uint32_t cache_hits;    // Sectors found in the write-back cache
+    uint32_t cache_misses;  // Sectors that had to be loaded into it
+    uint64_t bytes_read;    // Bytes returned by fs_read and fs_readv
+    uint64_t bytes_written; // Bytes accepted by fs_write and fs_writev
+    uint32_t sectors_verified; // Sectors checked against their CRC32
+    uint32_t corrupt_sectors;  // Sectors found not to match it
+    Histogram latency[FS_OPS]; // Time each call took, indexed by FS_OP_*
+} FsStats;
+
 // Function to check if a specific mode flag is set
 int check_mode(int mode, int flag);
 
@@ -50,15 +203,38 @@ int fs_open(const char *path, int m);
 void fs_close(int fd);
 int fs_read(int fd, char *buffer, int size);
 int fs_write(int fd, const char *buffer, int size);
+int fs_readv(int fd, const FsIoVec *iov, int count);
+int fs_writev(int fd, const FsIoVec *iov, int count);
 int fs_seek(int fd, long offset, int whence);
+int fs_mmap(int fd, const char **ptr, int *len);
+int fs_sync(int fd);
 
 // File manipulation functions
 int fs_create(const char *path);
 int fs_ls();
 int fs_format(const char *path);
 void fs_wipe();
+void fs_wipe_lazy();
 int fs_mv(const char *old_path, const char *new_path);
 int fs_cp(const char *source_path, const char *dest_path);
 int fs_rm(const char *path);
+int fs_mkdir(const char *path);
+int fs_rmdir(const char *path);
+int fs_wear(uint32_t *counts);
+int fs_stat(const char *path, FsStat *st);
+int fs_readdir(const char *path, int cookie, char *name, FsStat *st);
+FsSpace fs_df();
+
+// Background maintenance
+int fs_idle();
+int fs_scrub(int sectors);
+void fs_idle_step();
+
+// CRC32 (IEEE 802.3) of a buffer, the one the file table copies carry
+uint32_t crc32(const void *data, size_t length);
+
+// Performance counters
+FsStats fs_get_stats();
+void fs_reset_stats();
 
 #endif // FILESYSTEM_H
@@ -2,14 +2,66 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "hardware/dma.h"
 #include "hardware/flash.h"
 #include "hardware/sync.h"
+#include "pico/multicore.h"
 #include "pico/stdlib.h"
 
+// Offset in flash where the firmware image ends. The linker script puts
+// __flash_binary_end there; the host build has no image and defines
+// FLASH_BINARY_END itself.
+#ifndef FLASH_BINARY_END
+extern char __flash_binary_end;
+#define FLASH_BINARY_END ((uint32_t)((uintptr_t)&__flash_binary_end - XIP_BASE))
+#endif
+
+// Offset where user data starts, the first sector after the firmware image
 #define FLASH_TARGET_OFFSET                                                    \
-    (256 * 1024) // Offset where user data starts (256KB into flash)
+    ((FLASH_BINARY_END + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1))
 #define FLASH_SIZE PICO_FLASH_SIZE_BYTES // Total flash size available
 
+// Set while both cores run from flash, once the flash worker is on core 1, so
+// the other core has to be paused for every flash operation, whichever core
+// makes it
+bool flash_lockout;
+
+// Counters of the flash operations made, and when interrupts were last
+// disabled
+FlashStats flash_stats;
+uint64_t irq_off_since;
+
+// Function: flash_set_lockout
+// Sets whether flash operations pause the other core.
+//
+// Parameters:
+// - enabled: true once both cores have called multicore_lockout_victim_init.
+void flash_set_lockout(bool enabled) { flash_lockout = enabled; }
+
+// Function: flash_begin
+// Makes it safe to erase or program flash: pauses the other core if needed,
+// then disables interrupts. Returns the interrupt state for flash_end.
+static uint32_t flash_begin(void) {
+    if (flash_lockout) {
+        multicore_lockout_start_blocking();
+    }
+    uint32_t ints = save_and_disable_interrupts();
+    irq_off_since = time_us_64();
+    return ints;
+}
+
+// Function: flash_end
+// Undoes flash_begin once a flash operation is done.
+static void flash_end(uint32_t ints) {
+    uint64_t irq_off = time_us_64() - irq_off_since;
+    flash_stats.irq_off_us += irq_off;
+    hist_add(&flash_stats.irq_off, irq_off);
+    restore_interrupts(ints);
+    if (flash_lockout) {
+        multicore_lockout_end_blocking();
+    }
+}
+
 // Function: flash_write_safe
 // Writes data to flash memory at a specified offset, ensuring safety checks.
 //
@@ -24,23 +76,106 @@ void flash_write_safe(uint32_t offset, const uint8_t *data, size_t data_len) {
     uint32_t flash_offset = FLASH_TARGET_OFFSET + (FLASH_SECTOR_SIZE * offset);
 
     // Check if the write operation is within bounds
-    if (flash_offset + data_len > FLASH_TARGET_OFFSET + FLASH_SIZE ||
-        flash_offset < FLASH_TARGET_OFFSET) {
+    if (flash_offset + data_len > FLASH_SIZE ||
+        flash_offset < FLASH_TARGET_OFFSET || data_len > FLASH_SECTOR_SIZE) {
         printf("\nError: Write out of bounds\n");
         return;
     }
 
-    // Disable interrupts for a safe flash operation
-    uint32_t ints = save_and_disable_interrupts();
+    // flash_range_program only takes whole pages, so a partial last page is
+    // padded with 0xFF, which leaves the erased bytes untouched
+    size_t whole_pages = data_len & ~(FLASH_PAGE_SIZE - 1);
+    uint8_t last_page[FLASH_PAGE_SIZE];
+    memset(last_page, 0xFF, sizeof(last_page));
+    memcpy(last_page, data + whole_pages, data_len - whole_pages);
 
-    // Erase the flash sector before writing
+    // Erase the flash sector before writing, letting interrupts and the other
+    // core run between the erase and the program
+    uint32_t ints = flash_begin();
     flash_range_erase(flash_offset, FLASH_SECTOR_SIZE);
+    flash_end(ints);
+    flash_stats.erases++;
 
     // Write data to flash
-    flash_range_program(flash_offset, data, data_len);
+    ints = flash_begin();
+    if (whole_pages > 0) {
+        flash_range_program(flash_offset, data, whole_pages);
+    }
+    if (data_len > whole_pages) {
+        flash_range_program(flash_offset + whole_pages, last_page,
+                            FLASH_PAGE_SIZE);
+    }
+    flash_end(ints);
+    flash_stats.programs += (data_len + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE;
+    flash_stats.bytes_programmed += data_len;
+}
+
+// Function: flash_program_safe
+// Programs data into part of a sector without erasing it first.
+//
+// Parameters:
+// - offset: The sector, counted from FLASH_TARGET_OFFSET, to program.
+// - start: Where in the sector the data goes.
+// - data: Pointer to the data to be written.
+// - data_len: Length of the data to be written.
+//
+// Note: Programming can only clear bits, so the range must already be erased.
+// Only the pages the range touches are programmed. Bytes of those pages
+// outside the range are programmed as 0xFF, which leaves them unchanged.
+void flash_program_safe(uint32_t offset, uint32_t start, const uint8_t *data,
+                        size_t data_len) {
+    // Calculate absolute flash offset
+    uint32_t flash_offset =
+        FLASH_TARGET_OFFSET + (FLASH_SECTOR_SIZE * offset) + start;
+
+    // Check if the program operation is within bounds
+    if (flash_offset + data_len > FLASH_SIZE ||
+        flash_offset < FLASH_TARGET_OFFSET ||
+        start + data_len > FLASH_SECTOR_SIZE) {
+        printf("\nError: Program out of bounds\n");
+        return;
+    }
+
+    // Split the range into a partial first page, whole pages that can be
+    // programmed straight from data, and a partial last page
+    uint32_t head = flash_offset % FLASH_PAGE_SIZE;
+    size_t head_len = 0;
+    if (head != 0) {
+        head_len = FLASH_PAGE_SIZE - head;
+        if (head_len > data_len) {
+            head_len = data_len;
+        }
+    }
+    size_t whole_pages = (data_len - head_len) & ~(FLASH_PAGE_SIZE - 1);
+    size_t tail_len = data_len - head_len - whole_pages;
+
+    uint8_t first_page[FLASH_PAGE_SIZE];
+    uint8_t last_page[FLASH_PAGE_SIZE];
+    memset(first_page, 0xFF, sizeof(first_page));
+    memset(last_page, 0xFF, sizeof(last_page));
+    memcpy(first_page + head, data, head_len);
+    memcpy(last_page, data + head_len + whole_pages, tail_len);
+
+    // Disable interrupts for a safe flash operation
+    uint32_t ints = flash_begin();
+
+    if (head_len > 0) {
+        flash_range_program(flash_offset - head, first_page, FLASH_PAGE_SIZE);
+    }
+    if (whole_pages > 0) {
+        flash_range_program(flash_offset + head_len, data + head_len,
+                            whole_pages);
+    }
+    if (tail_len > 0) {
+        flash_range_program(flash_offset + head_len + whole_pages, last_page,
+                            FLASH_PAGE_SIZE);
+    }
 
     // Restore interrupts
-    restore_interrupts(ints);
+    flash_end(ints);
+    flash_stats.programs += (head_len > 0) + whole_pages / FLASH_PAGE_SIZE +
+                            (tail_len > 0);
+    flash_stats.bytes_programmed += data_len;
 }
 
 // Function: flash_read_safe
@@ -58,7 +193,7 @@ void flash_read_safe(uint32_t offset, uint8_t *buffer, size_t buffer_len) {
     uint32_t flash_offset = FLASH_TARGET_OFFSET + (FLASH_SECTOR_SIZE * offset);
 
     // Check if the read operation is within bounds
-    if (flash_offset + buffer_len > FLASH_TARGET_OFFSET + FLASH_SIZE ||
+    if (flash_offset + buffer_len > FLASH_SIZE ||
         flash_offset < FLASH_TARGET_OFFSET) {
         printf("\nError: Read out of bounds\n");
         return;
@@ -66,6 +201,8 @@ void flash_read_safe(uint32_t offset, uint8_t *buffer, size_t buffer_len) {
 
     // Perform the memory copy from flash to buffer
     memcpy(buffer, (void *)(XIP_BASE + flash_offset), buffer_len);
+    flash_stats.reads++;
+    flash_stats.bytes_read += buffer_len;
 }
 
 // Function: flash_erase_safe
@@ -81,18 +218,158 @@ void flash_erase_safe(uint32_t offset) {
     uint32_t flash_offset = FLASH_TARGET_OFFSET + (FLASH_SECTOR_SIZE * offset);
 
     // Check if the erase operation is within bounds
-    if (flash_offset >= FLASH_TARGET_OFFSET + FLASH_SIZE ||
+    if (flash_offset >= FLASH_SIZE ||
         flash_offset < FLASH_TARGET_OFFSET) {
         printf("Error: Erase out of bounds\n");
         return;
     }
 
     // Disable interrupts for a safe flash operation
-    uint32_t ints = save_and_disable_interrupts();
+    uint32_t ints = flash_begin();
 
     // Erase the flash sector
     flash_range_erase(flash_offset, FLASH_SECTOR_SIZE);
 
     // Restore interrupts
-    restore_interrupts(ints);
+    flash_end(ints);
+    flash_stats.erases++;
 }
+
+// Function: flash_erase_range_safe
+// Erases consecutive sectors of the flash memory, taking every 64KB block
+// that lies wholly in the range with a single block erase.
+//
+// Parameters:
+// - offset: The offset from FLASH_TARGET_OFFSET of the first sector.
+// - count: The number of sectors to erase.
+//
+// Note: A block erase takes about as long as three or four sector erases
+// instead of sixteen. Interrupts are enabled again after each block or
+// sector, so they are never disabled for longer than one block erase.
+void flash_erase_range_safe(uint32_t offset, uint32_t count) {
+    // Calculate absolute flash offsets of the range
+    uint32_t flash_offset = FLASH_TARGET_OFFSET + (FLASH_SECTOR_SIZE * offset);
+    uint32_t flash_end_offset = flash_offset + FLASH_SECTOR_SIZE * count;
+
+    // Check if the erase operation is within bounds
+    if (flash_end_offset > FLASH_SIZE || flash_offset < FLASH_TARGET_OFFSET ||
+        flash_end_offset < flash_offset) {
+        printf("Error: Erase out of bounds\n");
+        return;
+    }
+
+    while (flash_offset < flash_end_offset) {
+        uint32_t length = FLASH_SECTOR_SIZE;
+        if (flash_offset % FLASH_BLOCK_SIZE == 0 &&
+            flash_end_offset - flash_offset >= FLASH_BLOCK_SIZE) {
+            length = FLASH_BLOCK_SIZE;
+            flash_stats.block_erases++;
+        }
+
+        // flash_range_erase uses a block erase for an aligned block
+        uint32_t ints = flash_begin();
+        flash_range_erase(flash_offset, length);
+        flash_end(ints);
+        flash_stats.erases += length / FLASH_SECTOR_SIZE;
+        flash_offset += length;
+    }
+}
+
+// Function: flash_crc32
+// Computes the CRC32 (IEEE 802.3) of part of a sector as it is in flash, the
+// same CRC32 as crc32 in filesystem.c computes.
+//
+// Parameters:
+// - offset: The sector, counted from FLASH_TARGET_OFFSET.
+// - start: Where in the sector the range starts.
+// - data_len: Length of the range.
+//
+// Note: A DMA channel streams the range out of the XIP view into a single
+// byte while the DMA sniffer computes the CRC, so the CPU only waits for the
+// transfer instead of running the CRC itself. Returns 0 if the range is out
+// of bounds.
+uint32_t flash_crc32(uint32_t offset, uint32_t start, size_t data_len) {
+    // Calculate absolute flash offset
+    uint32_t flash_offset =
+        FLASH_TARGET_OFFSET + (FLASH_SECTOR_SIZE * offset) + start;
+
+    // Check if the range is within bounds
+    if (flash_offset + data_len > FLASH_SIZE ||
+        flash_offset < FLASH_TARGET_OFFSET) {
+        printf("\nError: CRC out of bounds\n");
+        return 0;
+    }
+    flash_stats.crcs++;
+    flash_stats.bytes_crc += data_len;
+    if (data_len == 0) {
+        return 0;
+    }
+
+    // The channel is claimed on first use and kept
+    static int channel = -1;
+    static uint8_t sink;
+    if (channel < 0) {
+        channel = dma_claim_unused_channel(true);
+    }
+
+    // The sniffer takes each byte bit reversed, and its result is reversed
+    // and inverted when read, which gives the reflected CRC32 with its final
+    // XOR from the usual all ones seed
+    dma_channel_config config = dma_channel_get_default_config(channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_sniff_enable(&config, true);
+    dma_sniffer_enable(channel, DMA_SNIFF_CTRL_CALC_VALUE_CRC32R, true);
+    dma_sniffer_set_output_reverse_enabled(true);
+    dma_sniffer_set_output_invert_enabled(true);
+    dma_sniffer_set_data_accumulator(0xFFFFFFFF);
+
+    dma_channel_configure(channel, &config, &sink,
+                          (const void *)(XIP_BASE + flash_offset), data_len,
+                          true);
+    dma_channel_wait_for_finish_blocking(channel);
+    uint32_t crc = dma_sniffer_get_data_accumulator();
+    dma_sniffer_disable();
+    return crc;
+}
+
+// Function: flash_xip_address
+// Returns where a sector appears in the memory mapped (XIP) view of flash.
+//
+// Parameters:
+// - offset: The sector, counted from FLASH_TARGET_OFFSET.
+//
+// Note: Reading through the returned pointer needs no copy, but the contents
+// change if the sector is erased or programmed. Returns NULL if the sector is
+// out of bounds.
+const uint8_t *flash_xip_address(uint32_t offset) {
+    // Calculate absolute flash offset
+    uint32_t flash_offset = FLASH_TARGET_OFFSET + (FLASH_SECTOR_SIZE * offset);
+
+    // Check if the sector is within bounds
+    if (flash_offset >= FLASH_SIZE || flash_offset < FLASH_TARGET_OFFSET) {
+        printf("Error: Map out of bounds\n");
+        return NULL;
+    }
+
+    return (const uint8_t *)(XIP_BASE + flash_offset);
+}
+
+// Function: flash_sector_count
+// Returns how many sectors there are from FLASH_TARGET_OFFSET to the end of
+// flash, which is all the room the volume has.
+uint32_t flash_sector_count(void) {
+    if (FLASH_TARGET_OFFSET >= FLASH_SIZE) {
+        return 0;
+    }
+    return (FLASH_SIZE - FLASH_TARGET_OFFSET) / FLASH_SECTOR_SIZE;
+}
+
+// Function: flash_get_stats
+// Returns the counters of the flash operations made since the last reset.
+FlashStats flash_get_stats(void) { return flash_stats; }
+
+// Function: flash_reset_stats
+// Sets every flash operation counter back to zero.
+void flash_reset_stats(void) { memset(&flash_stats, 0, sizeof(flash_stats)); }
@@ -1,11 +1,36 @@
 #ifndef FLASH_OPS_H
 #define FLASH_OPS_H
 
+#include "histogram.h"
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+// Counters of the flash operations made since the last reset
+typedef struct {
+    uint32_t erases;           // Sectors erased
+    uint32_t block_erases;     // 64KB blocks erased with a single command
+    uint32_t programs;         // Pages programmed
+    uint64_t bytes_programmed; // Bytes of data programmed, without padding
+    uint32_t reads;            // Calls of flash_read_safe
+    uint64_t bytes_read;       // Bytes copied by flash_read_safe
+    uint32_t crcs;             // Calls of flash_crc32
+    uint64_t bytes_crc;        // Bytes they ran through the CRC
+    uint64_t irq_off_us;       // Time spent with interrupts disabled
+    Histogram irq_off;         // Length of each window they were disabled
+} FlashStats;
+
 void flash_write_safe(uint32_t offset, const uint8_t *data, size_t data_len);
+void flash_program_safe(uint32_t offset, uint32_t start, const uint8_t *data,
+                        size_t data_len);
 void flash_read_safe(uint32_t offset, uint8_t *buffer, size_t buffer_len);
 void flash_erase_safe(uint32_t offset);
+void flash_erase_range_safe(uint32_t offset, uint32_t count);
+uint32_t flash_crc32(uint32_t offset, uint32_t start, size_t data_len);
+const uint8_t *flash_xip_address(uint32_t offset);
+uint32_t flash_sector_count(void);
+void flash_set_lockout(bool enabled);
+FlashStats flash_get_stats(void);
+void flash_reset_stats(void);
 
 #endif // FLASH_OPS_H
@@ -0,0 +1,315 @@
+#include "fs_async.h"
+#include "filesystem.h"
+#include "flash_ops.h"
+#include "pico/multicore.h"
+#include "pico/stdlib.h"
+#include "pico/util/queue.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Structure of a request for the flash worker, which sends it back with the
+// result once it has run
+typedef struct {
+    FsAsyncOp op;      // What to do
+    uint64_t deadline; // When it is due, in time_us_64 time
+    bool more;         // Set if the rest of its batch follows it
+    int result;        // What fs_write or fs_sync returned
+} AsyncRequest;
+
+queue_t async_requests; // Requests waiting for the worker
+queue_t async_done;     // Requests the worker has finished
+
+// Requests submitted whose callbacks have not run yet. Only touched by the
+// core that submits and polls, so it needs no lock.
+int async_pending;
+
+bool async_started;
+
+/**
+ * @brief Runs writes to the same file that followed one another in a round.
+ *
+ * The writes are merged into one fs_writev, which programs each sector they
+ * cover once and updates the file table once. Should that write nothing, they
+ * are run one by one instead, so each gets the result it would have had on
+ * its own. Should it stop part way, as a compressed file that fills the
+ * volume does, each write gets the bytes of it that were written, and those
+ * after it none, as running them would put their data in the wrong place.
+ *
+ * @param writes The writes, in the order they were queued.
+ * @param count The number of writes.
+ */
+void run_writes(AsyncRequest **writes, int count) {
+    if (count == 0) {
+        return;
+    }
+    int fd = writes[0]->op.fd;
+    if (count > 1) {
+        FsIoVec iov[FS_ASYNC_QUEUE];
+        for (int i = 0; i < count; i++) {
+            iov[i].base = (char *)writes[i]->op.buffer;
+            iov[i].len = writes[i]->op.size;
+        }
+        int written = fs_writev(fd, iov, count);
+        if (written > 0) {
+            for (int i = 0; i < count; i++) {
+                int size = writes[i]->op.size;
+                writes[i]->result = written < size ? written : size;
+                written -= writes[i]->result;
+            }
+            return;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        writes[i]->result =
+            fs_write(fd, writes[i]->op.buffer, writes[i]->op.size);
+    }
+}
+
+/**
+ * @brief Runs the requests of a round for one file, in the order they were
+ * queued, merging the writes between syncs.
+ *
+ * @param round The requests of the round.
+ * @param count The number of requests.
+ * @param fd The file descriptor of the file.
+ */
+void run_file(AsyncRequest *round, int count, int fd) {
+    AsyncRequest *writes[FS_ASYNC_QUEUE];
+    int merged = 0;
+    for (int i = 0; i < count; i++) {
+        if (round[i].op.fd != fd) {
+            continue;
+        }
+        if (round[i].op.buffer != NULL) {
+            writes[merged++] = &round[i];
+            continue;
+        }
+        run_writes(writes, merged);
+        merged = 0;
+        round[i].result = fs_sync(fd);
+    }
+    run_writes(writes, merged);
+}
+
+/**
+ * @brief Runs a round of requests taken off the queue together.
+ *
+ * Files are independent, as a file cannot be open twice, so only the
+ * requests of a file have to keep their order. The files take turns earliest
+ * deadline first, a file being due when its most urgent request is, so a sync
+ * is not held up behind writes to other files queued before it, and writes
+ * queued before a sync of their file run first.
+ *
+ * @param round The requests, in the order they were queued.
+ * @param count The number of requests.
+ */
+void run_round(AsyncRequest *round, int count) {
+    bool done[FS_ASYNC_QUEUE] = {false};
+    while (true) {
+        // Find the file due first
+        int next = -1;
+        uint64_t due = UINT64_MAX;
+        for (int i = 0; i < count; i++) {
+            if (!done[i] && round[i].deadline < due) {
+                next = i;
+                due = round[i].deadline;
+            }
+        }
+        if (next < 0) {
+            return;
+        }
+
+        int fd = round[next].op.fd;
+        run_file(round, count, fd);
+        for (int i = 0; i < count; i++) {
+            done[i] = done[i] || round[i].op.fd == fd;
+        }
+    }
+}
+
+/**
+ * @brief Runs requests on core 1 as they arrive.
+ *
+ * The worker first makes core 1 a lockout victim, which core 0 pauses for
+ * each erase or program it makes, and tells fs_async_init it is ready. It
+ * then takes every request queued by the time it gets to them, and waits for
+ * the rest of a batch, then runs them as a round and sends them back in the
+ * order they were queued.
+ */
+void flash_worker() {
+#ifndef FS_COPY_TO_RAM
+    multicore_lockout_victim_init();
+#endif
+    AsyncRequest ready = {0};
+    queue_add_blocking(&async_done, &ready);
+
+    AsyncRequest round[FS_ASYNC_QUEUE];
+    while (true) {
+        int count = 0;
+        queue_remove_blocking(&async_requests, &round[count++]);
+        while (count < FS_ASYNC_QUEUE) {
+            if (round[count - 1].more) {
+                queue_remove_blocking(&async_requests, &round[count]);
+            } else if (!queue_try_remove(&async_requests, &round[count])) {
+                break;
+            }
+            count++;
+        }
+        run_round(round, count);
+        for (int i = 0; i < count; i++) {
+            queue_add_blocking(&async_done, &round[i]);
+        }
+    }
+}
+
+/**
+ * @brief Starts the flash worker on core 1.
+ *
+ * This function must be called from core 0, and does nothing if the worker
+ * is already running. Unless the binary runs from RAM (FS_COPY_TO_RAM), both
+ * cores execute from flash and cannot run while it is being written, so each
+ * is made a lockout victim that the other pauses for every erase or program:
+ * core 0 while the worker writes, and the worker, idle or not, while core 0
+ * does. This function waits for the worker to be ready before returning, so
+ * the lockout is in place before the first flash operation either core makes.
+ * A core is then only stalled for single flash operations instead of whole
+ * writes.
+ */
+void fs_async_init() {
+    if (async_started) {
+        return;
+    }
+    queue_init(&async_requests, sizeof(AsyncRequest), FS_ASYNC_QUEUE);
+    queue_init(&async_done, sizeof(AsyncRequest), FS_ASYNC_QUEUE);
+#ifndef FS_COPY_TO_RAM
+    multicore_lockout_victim_init();
+#endif
+    multicore_launch_core1(flash_worker);
+    AsyncRequest ready;
+    queue_remove_blocking(&async_done, &ready);
+#ifndef FS_COPY_TO_RAM
+    flash_set_lockout(true);
+#endif
+    async_started = true;
+}
+
+/**
+ * @brief Queues requests for the flash worker, all of them or none.
+ *
+ * @param ops The requests to queue.
+ * @param count The number of requests.
+ * @return 0 if successful, otherwise QUEUE_FULL.
+ */
+int async_submit(const FsAsyncOp *ops, int count) {
+    fs_async_init();
+    if (count > FS_ASYNC_QUEUE - async_pending) {
+        return QUEUE_FULL;
+    }
+    uint64_t now = time_us_64();
+    for (int i = 0; i < count; i++) {
+        AsyncRequest request = {ops[i], now + ops[i].deadline_us,
+                                i < count - 1, 0};
+        async_pending++;
+        queue_add_blocking(&async_requests, &request);
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes data to the file associated with the given file descriptor on
+ * the flash worker.
+ *
+ * This function queues the write and returns straight away. The buffer is
+ * not copied, so it must stay unchanged until the callback has run. Until
+ * then no other filesystem function may be called, apart from the fs_async
+ * ones.
+ *
+ * @param fd The file descriptor of the file to write to.
+ * @param buffer The buffer containing the data to write.
+ * @param size The number of bytes to write.
+ * @param callback Called by fs_async_poll with what fs_write returned, may be
+ * NULL.
+ * @param context Passed to the callback.
+ * @return 0 if the write was queued, otherwise QUEUE_FULL.
+ */
+int fs_write_async(int fd, const char *buffer, int size,
+                   FsAsyncCallback callback, void *context) {
+    FsAsyncOp op = {fd, buffer, size, FS_ASYNC_WRITE_DEADLINE, callback,
+                    context};
+    return async_submit(&op, 1);
+}
+
+/**
+ * @brief Syncs the file associated with the given file descriptor on the
+ * flash worker.
+ *
+ * This function queues a call to fs_sync, which runs after every write
+ * queued before it.
+ *
+ * @param fd The file descriptor of the file to sync.
+ * @param callback Called by fs_async_poll with what fs_sync returned, may be
+ * NULL.
+ * @param context Passed to the callback.
+ * @return 0 if the sync was queued, otherwise QUEUE_FULL.
+ */
+int fs_flush_async(int fd, FsAsyncCallback callback, void *context) {
+    FsAsyncOp op = {fd, NULL, 0, FS_ASYNC_SYNC_DEADLINE, callback, context};
+    return async_submit(&op, 1);
+}
+
+/**
+ * @brief Queues several requests for the flash worker at once.
+ *
+ * The requests are queued together, so the worker runs them as one round:
+ * writes to a file that follow one another are merged into a single
+ * fs_writev, and the files take turns by deadline, keeping the order of the
+ * requests of each file. The callbacks still run in the order of the
+ * requests. The same rules apply to the buffers as for fs_write_async.
+ *
+ * @param ops The requests. A NULL buffer syncs the file instead of writing.
+ * @param count The number of requests.
+ * @return 0 if they were queued, otherwise QUEUE_FULL, in which case none
+ * were.
+ */
+int fs_async_batch(const FsAsyncOp *ops, int count) {
+    return async_submit(ops, count);
+}
+
+/**
+ * @brief Hands a finished request back to the caller.
+ *
+ * @param request The request the flash worker has finished.
+ */
+void async_finish(const AsyncRequest *request) {
+    async_pending--;
+    if (request->op.callback != NULL) {
+        request->op.callback(request->result, request->op.context);
+    }
+}
+
+/**
+ * @brief Runs the callbacks of the requests the flash worker has finished.
+ *
+ * The callbacks run on the calling core, in the order the requests were
+ * queued.
+ *
+ * @return The number of requests still outstanding.
+ */
+int fs_async_poll() {
+    AsyncRequest request;
+    while (async_pending > 0 && queue_try_remove(&async_done, &request)) {
+        async_finish(&request);
+    }
+    return async_pending;
+}
+
+/**
+ * @brief Waits for every queued request to finish and runs their callbacks.
+ */
+void fs_async_wait() {
+    AsyncRequest request;
+    while (async_pending > 0) {
+        queue_remove_blocking(&async_done, &request);
+        async_finish(&request);
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef FS_ASYNC_H
+#define FS_ASYNC_H
+
+#include <stdint.h>
+
+#define FS_ASYNC_QUEUE 8 // Requests that can be outstanding at once
+
+// How soon after being queued requests are due, in microseconds. A sync
+// commits the file table, so it is more urgent than a write.
+#define FS_ASYNC_WRITE_DEADLINE 100000
+#define FS_ASYNC_SYNC_DEADLINE 10000
+
+// Called by fs_async_poll once a request has finished, with the value the
+// synchronous function returned
+typedef void (*FsAsyncCallback)(int result, void *context);
+
+// Structure of a request given to fs_async_batch
+typedef struct {
+    int fd;                   // File descriptor of the file
+    const char *buffer;       // Data to write, NULL to sync the file
+    int size;                 // Number of bytes to write
+    uint32_t deadline_us;     // How soon after being queued it is due
+    FsAsyncCallback callback; // Called with the result, may be NULL
+    void *context;            // Passed to the callback
+} FsAsyncOp;
+
+// Starts the flash worker on core 1
+void fs_async_init();
+
+// Queue work for the flash worker
+int fs_write_async(int fd, const char *buffer, int size,
+                   FsAsyncCallback callback, void *context);
+int fs_flush_async(int fd, FsAsyncCallback callback, void *context);
+int fs_async_batch(const FsAsyncOp *ops, int count);
+
+// Deliver completions
+int fs_async_poll();
+void fs_async_wait();
+
+#endif // FS_ASYNC_H
@@ -0,0 +1,53 @@
+#include "histogram.h"
+
+/**
+ * @brief Adds a latency to a histogram.
+ *
+ * @param hist The histogram.
+ * @param us The latency in microseconds.
+ */
+void hist_add(Histogram *hist, uint64_t us) {
+    // The bucket is the number of bits the latency needs
+    int bucket = 0;
+    for (uint64_t rest = us; rest != 0 && bucket < HIST_BUCKETS - 1;
+         rest >>= 1) {
+        bucket++;
+    }
+    hist->counts[bucket]++;
+    hist->samples++;
+    if (us > hist->max_us) {
+        hist->max_us = us;
+    }
+}
+
+/**
+ * @brief Estimates a percentile of the latencies in a histogram.
+ *
+ * As only the bucket of each latency is kept, this is the upper bound of the
+ * bucket the percentile falls in, or the longest latency if that is lower or
+ * the percentile falls in the last bucket, which has no upper bound.
+ *
+ * @param hist The histogram.
+ * @param percent The percentile, from 0 to 100.
+ * @return The percentile in microseconds, 0 if the histogram is empty.
+ */
+uint64_t hist_percentile(const Histogram *hist, uint32_t percent) {
+    // The rank of the sample the percentile falls on, rounded up
+    uint64_t rank = ((uint64_t)hist->samples * percent + 99) / 100;
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS && hist->samples > 0; i++) {
+        seen += hist->counts[i];
+        if (seen >= rank) {
+            uint64_t upper = i == 0 ? 0 : ((uint64_t)1 << i) - 1;
+            if (i == HIST_BUCKETS - 1 || upper > hist->max_us) {
+                return hist->max_us;
+            }
+            return upper;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,19 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+#define HIST_BUCKETS 24 // Bucket i > 0 holds latencies of 2^(i-1) to 2^i - 1 us
+
+// Log-bucketed histogram of latencies in microseconds. Bucket 0 holds 0 us
+// and the last bucket also holds everything longer.
+typedef struct {
+    uint32_t counts[HIST_BUCKETS]; // Samples in each bucket
+    uint32_t samples;              // Samples in all buckets
+    uint64_t max_us;               // Longest sample
+} Histogram;
+
+void hist_add(Histogram *hist, uint64_t us);
+uint64_t hist_percentile(const Histogram *hist, uint32_t percent);
+
+#endif // HISTOGRAM_H
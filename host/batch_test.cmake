@@ -0,0 +1,12 @@
+# Runs fs_host on batch_input.txt and checks its output is batch_expected.txt
+# byte for byte. Invoked by ctest with -DFS_HOST=<path of fs_host>.
+execute_process(
+  COMMAND ${FS_HOST}
+  INPUT_FILE ${CMAKE_CURRENT_LIST_DIR}/batch_input.txt
+  OUTPUT_VARIABLE output
+  RESULT_VARIABLE result
+)
+file(READ ${CMAKE_CURRENT_LIST_DIR}/batch_expected.txt expected)
+if (NOT result EQUAL 0 OR NOT output STREQUAL expected)
+  message(FATAL_ERROR "Batch output differs, got:\n${output}")
+endif ()
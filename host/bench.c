@@ -0,0 +1,256 @@
+#include "filesystem.h"
+#include "flash_emu.h"
+#include "pico/stdlib.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_IO_SIZE 64     // Bytes moved by each read, write or append
+#define BENCH_FILE_SIZE 4096 // Size of the files used by read, write and cp
+
+// Measurements accumulated over the timed part of a workload
+typedef struct {
+    uint64_t us;
+    FlashEmuCounters flash;
+} Sample;
+
+static Sample total;
+static Sample start;
+
+static char io_buffer[BENCH_FILE_SIZE];
+
+/**
+ * @brief Starts timing an operation.
+ */
+static void measure_begin() {
+    start.us = time_us_64();
+    start.flash = flash_emu_counters;
+}
+
+/**
+ * @brief Stops timing an operation and adds its cost to the running total.
+ */
+static void measure_end() {
+    total.us += time_us_64() - start.us;
+    total.flash.erase_ops +=
+        flash_emu_counters.erase_ops - start.flash.erase_ops;
+    total.flash.erase_bytes +=
+        flash_emu_counters.erase_bytes - start.flash.erase_bytes;
+    total.flash.program_ops +=
+        flash_emu_counters.program_ops - start.flash.program_ops;
+    total.flash.program_bytes +=
+        flash_emu_counters.program_bytes - start.flash.program_bytes;
+    total.flash.busy_us += flash_emu_counters.busy_us - start.flash.busy_us;
+}
+
+/**
+ * @brief Creates a file filled with BENCH_FILE_SIZE bytes.
+ */
+static void make_file(const char *path) {
+    int fd = fs_open(path, MODE_CREATE | MODE_WRITE);
+    fs_write(fd, io_buffer, BENCH_FILE_SIZE);
+    fs_close(fd);
+}
+
+static void bench_create(int iterations) {
+    for (int i = 0; i < iterations; i++) {
+        measure_begin();
+        fs_create("bench");
+        measure_end();
+        fs_rm("bench");
+    }
+}
+
+static void bench_open(int iterations) {
+    fs_create("bench");
+    for (int i = 0; i < iterations; i++) {
+        measure_begin();
+        int fd = fs_open("bench", MODE_READ);
+        fs_close(fd);
+        measure_end();
+    }
+}
+
+static void bench_read(int iterations) {
+    char buffer[BENCH_IO_SIZE];
+    make_file("bench");
+    int fd = fs_open("bench", MODE_READ);
+    for (int i = 0; i < iterations; i++) {
+        if (i % (BENCH_FILE_SIZE / BENCH_IO_SIZE) == 0) {
+            fs_seek(fd, 0, FS_SEEK_SET);
+        }
+        measure_begin();
+        fs_read(fd, buffer, BENCH_IO_SIZE);
+        measure_end();
+    }
+    fs_close(fd);
+}
+
+static void bench_write(int iterations) {
+    make_file("bench");
+    int fd = fs_open("bench", MODE_WRITE);
+    for (int i = 0; i < iterations; i++) {
+        if (i % (BENCH_FILE_SIZE / BENCH_IO_SIZE) == 0) {
+            fs_seek(fd, 0, FS_SEEK_SET);
+        }
+        measure_begin();
+        fs_write(fd, io_buffer, BENCH_IO_SIZE);
+        measure_end();
+    }
+    fs_close(fd);
+}
+
+static void bench_write_idle(int iterations) {
+    make_file("bench");
+    int fd = fs_open("bench", MODE_WRITE);
+    for (int i = 0; i < iterations; i++) {
+        if (i % (BENCH_FILE_SIZE / BENCH_IO_SIZE) == 0) {
+            fs_seek(fd, 0, FS_SEEK_SET);
+        }
+        // Erasing in idle time between writes is not part of their cost
+        while (fs_idle() > 0) {
+        }
+        measure_begin();
+        fs_write(fd, io_buffer, BENCH_IO_SIZE);
+        measure_end();
+    }
+    fs_close(fd);
+}
+
+static void bench_append(int iterations) {
+    int fd = fs_open("bench", MODE_CREATE | MODE_APPEND);
+    for (int i = 0; i < iterations; i++) {
+        if (i % (BENCH_FILE_SIZE / BENCH_IO_SIZE) == 0) {
+            fs_format("bench");
+        }
+        measure_begin();
+        fs_write(fd, io_buffer, BENCH_IO_SIZE);
+        measure_end();
+    }
+    fs_close(fd);
+}
+
+static void bench_append_writeback(int iterations) {
+    int fd = fs_open("bench", MODE_CREATE | MODE_APPEND | MODE_WRITEBACK);
+    for (int i = 0; i < iterations; i++) {
+        if (i % (BENCH_FILE_SIZE / BENCH_IO_SIZE) == 0) {
+            // Writing the buffered data out is part of the workload's cost
+            measure_begin();
+            fs_sync(fd);
+            measure_end();
+            fs_format("bench");
+        }
+        measure_begin();
+        fs_write(fd, io_buffer, BENCH_IO_SIZE);
+        measure_end();
+    }
+    measure_begin();
+    fs_close(fd);
+    measure_end();
+}
+
+static void bench_cp(int iterations) {
+    make_file("bench");
+    for (int i = 0; i < iterations; i++) {
+        measure_begin();
+        fs_cp("bench", "bench.copy");
+        measure_end();
+    }
+}
+
+static void bench_mv(int iterations) {
+    make_file("bench");
+    for (int i = 0; i < iterations; i++) {
+        measure_begin();
+        if (i % 2 == 0) {
+            fs_mv("bench", "bench.moved");
+        } else {
+            fs_mv("bench.moved", "bench");
+        }
+        measure_end();
+    }
+}
+
+static void bench_rm(int iterations) {
+    for (int i = 0; i < iterations; i++) {
+        int fd = fs_open("bench", MODE_CREATE | MODE_WRITE);
+        fs_write(fd, io_buffer, BENCH_IO_SIZE);
+        fs_close(fd);
+        measure_begin();
+        fs_rm("bench");
+        measure_end();
+    }
+}
+
+// A workload, the number of bytes of user data each operation moves and
+// whether those bytes are written, which makes write amplification apply
+typedef struct {
+    const char *name;
+    void (*run)(int iterations);
+    int bytes_per_op;
+    bool writes;
+} Workload;
+
+static const Workload workloads[] = {
+    {"create", bench_create, 0, false},
+    {"open", bench_open, 0, false},
+    {"read", bench_read, BENCH_IO_SIZE, false},
+    {"write", bench_write, BENCH_IO_SIZE, true},
+    {"write-idle", bench_write_idle, BENCH_IO_SIZE, true},
+    {"append", bench_append, BENCH_IO_SIZE, true},
+    {"append-wb", bench_append_writeback, BENCH_IO_SIZE, true},
+    {"cp", bench_cp, BENCH_FILE_SIZE, true},
+    {"mv", bench_mv, 0, false},
+    {"rm", bench_rm, 0, false},
+};
+
+/**
+ * @brief Runs every workload on a freshly wiped filesystem and prints a table
+ * of throughput, flash commands and estimated on-device flash time.
+ *
+ * Usage: fs_bench [iterations] [flash image]
+ */
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 200;
+    if (iterations <= 0) {
+        fprintf(stderr, "usage: %s [iterations] [flash image]\n", argv[0]);
+        return 1;
+    }
+    if (flash_emu_init(argc > 2 ? argv[2] : NULL) != 0) {
+        return 1;
+    }
+    init_filesystem();
+
+    for (int i = 0; i < BENCH_FILE_SIZE; i++) {
+        io_buffer[i] = 'a' + i % 26;
+    }
+
+    printf("%-10s %8s %12s %12s %10s %10s %10s %8s %14s\n", "workload", "ops",
+           "ops/s", "bytes/s", "erases", "programs", "erase/op", "w-amp",
+           "flash ms/op");
+
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+        fs_wipe();
+        memset(&total, 0, sizeof(total));
+        workloads[w].run(iterations);
+
+        double seconds = total.us ? total.us / 1e6 : 1e-6;
+        double user_bytes = (double)workloads[w].bytes_per_op * iterations;
+        printf("%-10s %8d %12.0f %12.0f %10llu %10llu %10.2f ",
+               workloads[w].name, iterations, iterations / seconds,
+               user_bytes / seconds,
+               (unsigned long long)total.flash.erase_ops,
+               (unsigned long long)total.flash.program_ops,
+               (double)total.flash.erase_ops / iterations);
+        // Write amplification: bytes programmed per byte of user data
+        if (workloads[w].writes) {
+            printf("%8.1f ", total.flash.program_bytes / user_bytes);
+        } else {
+            printf("%8s ", "-");
+        }
+        printf("%14.2f\n", total.flash.busy_us / 1000.0 / iterations);
+    }
+
+    fs_wipe();
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include "fs_client.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static void usage() {
+    fprintf(stderr,
+            "usage: fs_client <device> <command> [args]\n"
+            "       fs_client -s <server> <command> [args]\n"
+            "commands:\n"
+            "  put <local> <remote>  copy a file to the filesystem\n"
+            "  get <remote> <local>  copy a file from it\n"
+            "  stat <remote>         print the size and kind of a file\n"
+            "  ls [dir]              list a directory, the root by default\n"
+            "-s runs the server, such as fs_host, on a pseudo terminal\n");
+}
+
+static double seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Runs one command of the client.
+ *
+ * @param client The connection.
+ * @param argc The number of arguments from the command on.
+ * @param argv The command and its arguments.
+ * @return 0 if successful, otherwise an error code.
+ */
+static int run(FsClient *client, int argc, char **argv) {
+    const char *command = argv[0];
+    if (strcmp(command, "put") == 0 || strcmp(command, "get") == 0) {
+        if (argc != 3) {
+            usage();
+            return -1;
+        }
+        bool put = command[0] == 'p';
+        const char *local = argv[put ? 1 : 2];
+        const char *remote = argv[put ? 2 : 1];
+        FILE *file = fopen(local, put ? "rb" : "wb");
+        if (file == NULL) {
+            perror(local);
+            return -1;
+        }
+        double start = seconds();
+        int result = put ? client_put(client, remote, file)
+                         : client_get(client, remote, file);
+        double elapsed = seconds() - start;
+        fclose(file);
+        if (result >= 0) {
+            printf("%d bytes in %.3f s, %.1f KB/s\n", result, elapsed,
+                   elapsed > 0 ? result / elapsed / 1024 : 0);
+        }
+        return result < 0 ? result : 0;
+    } else if (strcmp(command, "stat") == 0 && argc == 2) {
+        ClientStat st;
+        int result = client_stat(client, argv[1], &st);
+        if (result == 0) {
+            printf("%s: %s, %u bytes%s\n", argv[1],
+                   st.is_dir ? "directory" : "file", st.size,
+                   st.compressed ? ", compressed" : "");
+        }
+        return result;
+    } else if (strcmp(command, "ls") == 0 && argc <= 2) {
+        int result = client_ls(client, argc == 2 ? argv[1] : "/", stdout);
+        return result < 0 ? result : 0;
+    }
+    usage();
+    return -1;
+}
+
+// Moves files to and from the filesystem over the binary protocol, on a
+// Pico's USB serial port or on fs_host run on a pseudo terminal
+int main(int argc, char **argv) {
+    bool spawn = argc > 1 && strcmp(argv[1], "-s") == 0;
+    if (argc < 3 + spawn) {
+        usage();
+        return 2;
+    }
+
+    FsClient client;
+    char *server[] = {argv[1 + spawn], NULL};
+    int result = spawn ? client_spawn(&client, server)
+                       : client_open(&client, argv[1]);
+    if (result < 0) {
+        fprintf(stderr, "%s: could not connect, error %d\n", argv[1 + spawn],
+                result);
+        return 1;
+    }
+    result = run(&client, argc - 2 - spawn, argv + 2 + spawn);
+    if (result < -1) {
+        fprintf(stderr, "%s: error %d\n", argv[2 + spawn], result);
+    }
+    client_close(&client);
+    return result < 0;
+}
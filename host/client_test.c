@@ -0,0 +1,101 @@
+#define _DEFAULT_SOURCE
+#include "filesystem.h"
+#include "fs_client.h"
+#include "proto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_SIZE (64 * 1024) // Bytes of the file moved both ways
+
+static uint8_t sent[TEST_SIZE];
+static uint8_t received[TEST_SIZE + 1];
+
+static void report(int number, bool passed) {
+    printf("Client test %d: %s\n", number, passed ? "Passed" : "Failed");
+}
+
+// Runs the server given as the argument, fs_host, on a pseudo terminal and
+// moves a file to and from it through the client. ctest treats any "Failed"
+// line in the output as a failure.
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: fs_client_test <fs_host>\n");
+        return 2;
+    }
+
+    // Every byte value, including the magic byte and the newlines a terminal
+    // would translate, in an order that repeats rarely
+    uint32_t seed = 1;
+    for (int i = 0; i < TEST_SIZE; i++) {
+        seed = seed * 1103515245 + 12345;
+        sent[i] = i < 256 ? (uint32_t)i : seed >> 16;
+    }
+
+    FsClient client;
+    char *server[] = {argv[1], NULL};
+    int result = client_spawn(&client, server);
+    report(1, result == 0);
+    if (result != 0) {
+        return 1;
+    }
+
+    // Put the file, then check it is there with its size
+    FILE *in = fmemopen(sent, TEST_SIZE, "rb");
+    result = client_put(&client, "/blob", in);
+    fclose(in);
+    ClientStat st;
+    report(2, result == TEST_SIZE && client_stat(&client, "/blob", &st) == 0 &&
+                  st.size == TEST_SIZE && !st.is_dir);
+
+    // Get it back
+    FILE *out = fmemopen(received, sizeof(received), "wb");
+    result = client_get(&client, "/blob", out);
+    fclose(out);
+    report(3, result == TEST_SIZE && memcmp(sent, received, TEST_SIZE) == 0);
+
+    // List the root, which holds only the file
+    char listing[256] = "";
+    out = fmemopen(listing, sizeof(listing), "w");
+    result = client_ls(&client, "/", out);
+    fclose(out);
+    report(4, result == 1 && strcmp(listing, "blob 65536 bytes\n") == 0);
+
+    // Errors of the filesystem come back as they are
+    report(5, client_stat(&client, "/missing", &st) == FILE_NOT_FOUND &&
+                  client_get(&client, "/missing", stdout) == FILE_NOT_FOUND);
+
+    // A damaged frame is refused, and the session carries on
+    static uint8_t frame[PROTO_FRAME_MAX];
+    int length = client_frame(frame, PROTO_STAT, "/blob", 5);
+    frame[PROTO_HEADER + 2] ^= 0x01;
+    int type = 0;
+    static uint8_t reply[PROTO_MAX_DATA];
+    int reply_length;
+    result = client_send(&client, frame, length);
+    if (result == 0) {
+        result = client_read_reply(&client, &type, reply, &reply_length);
+    }
+    report(6, result == PROTO_BAD_FRAME &&
+                  type == (PROTO_ERROR | PROTO_REPLY) &&
+                  client_stat(&client, "/blob", &st) == 0 &&
+                  st.size == TEST_SIZE);
+
+    // A DATA frame sent again, as after a lost reply, is written once, and
+    // one at any other offset is refused
+    uint8_t put[4 + 3] = {0, 0, 0, 0, 'a', 'b', 'c'};
+    bool passed =
+        client_request(&client, PROTO_PUT, "/again", 6, NULL, NULL) == 0 &&
+        client_request(&client, PROTO_DATA, put, 7, NULL, NULL) == 3 &&
+        client_request(&client, PROTO_DATA, put, 7, NULL, NULL) == 3;
+    put[0] = 10;
+    passed = passed && client_request(&client, PROTO_DATA, put, 7, NULL,
+                                      NULL) == PROTO_BAD_OFFSET;
+    passed = passed &&
+             client_request(&client, PROTO_CLOSE, NULL, 0, NULL, NULL) == 0;
+    report(7, passed && client_stat(&client, "/again", &st) == 0 &&
+                  st.size == 3);
+
+    client_close(&client);
+    return 0;
+}
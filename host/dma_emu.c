@@ -0,0 +1,147 @@
+#include "hardware/dma.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define DMA_EMU_CHANNELS 12 // Channels of the RP2040
+
+static uint32_t channels_claimed;
+
+// State of the sniffer, which watches at most one channel
+static struct {
+    bool enabled;
+    unsigned int channel;
+    unsigned int mode;
+    bool reverse;
+    bool invert;
+    uint32_t data;
+} sniffer;
+
+int dma_claim_unused_channel(bool required) {
+    for (int i = 0; i < DMA_EMU_CHANNELS; i++) {
+        if (!(channels_claimed & (1u << i))) {
+            channels_claimed |= 1u << i;
+            return i;
+        }
+    }
+    if (required) {
+        fprintf(stderr, "dma_emu: no free channel\n");
+        abort();
+    }
+    return -1;
+}
+
+dma_channel_config dma_channel_get_default_config(unsigned int channel) {
+    (void)channel;
+    dma_channel_config config = {DMA_SIZE_32, true, false, false};
+    return config;
+}
+
+/**
+ * @brief Reverses the order of the bits of a byte.
+ */
+static uint8_t reverse8(uint8_t byte) {
+    uint8_t reversed = 0;
+    for (int bit = 0; bit < 8; bit++) {
+        reversed |= ((byte >> bit) & 1) << (7 - bit);
+    }
+    return reversed;
+}
+
+/**
+ * @brief Reverses the order of the bits of a word.
+ */
+static uint32_t reverse32(uint32_t word) {
+    uint32_t reversed = 0;
+    for (int bit = 0; bit < 32; bit++) {
+        reversed |= ((word >> bit) & 1) << (31 - bit);
+    }
+    return reversed;
+}
+
+/**
+ * @brief Feeds a byte to the sniffer, which shifts it most significant bit
+ * first into a CRC32 with the IEEE 802.3 polynomial, bit reversing it first
+ * in DMA_SNIFF_CTRL_CALC_VALUE_CRC32R mode. The CRC goes a byte at a time
+ * through tables built on first use, as the sniffer sees every byte of a
+ * transfer.
+ */
+static void sniff_byte(uint8_t byte) {
+    static uint32_t crc_table[256];
+    static uint8_t reversed[256];
+    if (crc_table[1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i << 24;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc << 1) ^ (0x04C11DB7 & -(crc >> 31));
+            }
+            crc_table[i] = crc;
+            reversed[i] = reverse8(i);
+        }
+    }
+    if (sniffer.mode == DMA_SNIFF_CTRL_CALC_VALUE_CRC32R) {
+        byte = reversed[byte];
+    }
+    sniffer.data = (sniffer.data << 8) ^ crc_table[(sniffer.data >> 24) ^ byte];
+}
+
+/**
+ * @brief Runs a transfer straight away if it is triggered, feeding every byte
+ * read to the sniffer if the channel is the one it watches.
+ */
+void dma_channel_configure(unsigned int channel,
+                           const dma_channel_config *config,
+                           volatile void *write_addr,
+                           const volatile void *read_addr,
+                           unsigned int transfer_count, bool trigger) {
+    if (!trigger) {
+        return;
+    }
+    unsigned int width = 1u << config->size;
+    const volatile uint8_t *from = read_addr;
+    volatile uint8_t *to = write_addr;
+    bool sniff = config->sniff && sniffer.enabled && sniffer.channel == channel;
+    for (unsigned int i = 0; i < transfer_count; i++) {
+        for (unsigned int b = 0; b < width; b++) {
+            to[b] = from[b];
+            if (sniff) {
+                sniff_byte(from[b]);
+            }
+        }
+        from += config->read_increment ? width : 0;
+        to += config->write_increment ? width : 0;
+    }
+}
+
+void dma_sniffer_enable(unsigned int channel, unsigned int mode,
+                        bool force_channel_enable) {
+    (void)force_channel_enable;
+    if (mode != DMA_SNIFF_CTRL_CALC_VALUE_CRC32 &&
+        mode != DMA_SNIFF_CTRL_CALC_VALUE_CRC32R) {
+        fprintf(stderr, "dma_emu: sniffer mode %u not emulated\n", mode);
+        abort();
+    }
+    sniffer.enabled = true;
+    sniffer.channel = channel;
+    sniffer.mode = mode;
+}
+
+void dma_sniffer_disable(void) { sniffer.enabled = false; }
+
+void dma_sniffer_set_output_reverse_enabled(bool enable) {
+    sniffer.reverse = enable;
+}
+
+void dma_sniffer_set_output_invert_enabled(bool enable) {
+    sniffer.invert = enable;
+}
+
+void dma_sniffer_set_data_accumulator(uint32_t seed) { sniffer.data = seed; }
+
+/**
+ * @brief Reads the sniffer's result, which like the hardware's is reversed
+ * and inverted on the way out if the sniffer is set to.
+ */
+uint32_t dma_sniffer_get_data_accumulator(void) {
+    uint32_t data = sniffer.reverse ? reverse32(sniffer.data) : sniffer.data;
+    return sniffer.invert ? ~data : data;
+}
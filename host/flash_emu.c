@@ -0,0 +1,122 @@
+#include "flash_emu.h"
+#include "hardware/flash.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+FlashEmuCounters flash_emu_counters;
+
+static uint8_t *flash_mem;
+
+/**
+ * @brief Aborts on a call the real flash_range_* functions would not accept.
+ */
+static void check_range(const char *op, uint32_t flash_offs, size_t count,
+                        size_t align) {
+    if (flash_offs % align != 0 || count % align != 0 ||
+        flash_offs + count > PICO_FLASH_SIZE_BYTES) {
+        fprintf(stderr, "flash_emu: bad %s at 0x%x, %zu bytes\n", op,
+                flash_offs, count);
+        abort();
+    }
+}
+
+/**
+ * @brief Maps the emulated flash onto a file, creating a blank image if the
+ * file does not exist yet.
+ *
+ * @param image_path Path of the image file, or NULL for a RAM only flash.
+ * @return 0 on success, -1 if the image could not be mapped.
+ */
+int flash_emu_init(const char *image_path) {
+    if (image_path == NULL) {
+        flash_mem = malloc(PICO_FLASH_SIZE_BYTES);
+        memset(flash_mem, 0xFF, PICO_FLASH_SIZE_BYTES);
+        return 0;
+    }
+
+    int fd = open(image_path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror(image_path);
+        return -1;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    if (st.st_size != PICO_FLASH_SIZE_BYTES) {
+        // A new image starts out erased like a factory fresh chip
+        uint8_t blank[FLASH_SECTOR_SIZE];
+        memset(blank, 0xFF, sizeof(blank));
+        ftruncate(fd, 0);
+        for (size_t i = 0; i < PICO_FLASH_SIZE_BYTES; i += sizeof(blank)) {
+            write(fd, blank, sizeof(blank));
+        }
+    }
+
+    flash_mem = mmap(NULL, PICO_FLASH_SIZE_BYTES, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    close(fd);
+    if (flash_mem == MAP_FAILED) {
+        perror(image_path);
+        flash_mem = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+uint8_t *flash_emu_base(void) {
+    if (flash_mem == NULL) {
+        flash_emu_init(NULL);
+    }
+    return flash_mem;
+}
+
+void flash_emu_reset_counters(void) {
+    memset(&flash_emu_counters, 0, sizeof(flash_emu_counters));
+}
+
+/**
+ * @brief Erases whole sectors, setting every bit to 1.
+ */
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+    check_range("erase", flash_offs, count, FLASH_SECTOR_SIZE);
+    memset(flash_emu_base() + flash_offs, 0xFF, count);
+
+    // Like the SDK, erase the aligned 64KB blocks with a single command each
+    // and the rest a sector at a time
+    flash_emu_counters.erase_bytes += count;
+    for (uint32_t at = flash_offs; at < flash_offs + count;) {
+        if (at % FLASH_BLOCK_SIZE == 0 &&
+            flash_offs + count - at >= FLASH_BLOCK_SIZE) {
+            flash_emu_counters.block_erase_ops++;
+            flash_emu_counters.busy_us += FLASH_EMU_BLOCK_ERASE_US;
+            at += FLASH_BLOCK_SIZE;
+        } else {
+            flash_emu_counters.erase_ops++;
+            flash_emu_counters.busy_us += FLASH_EMU_SECTOR_ERASE_US;
+            at += FLASH_SECTOR_SIZE;
+        }
+    }
+}
+
+/**
+ * @brief Programs whole pages. Like NOR flash, programming can only clear
+ * bits, so anything not erased beforehand ends up ANDed with the new data.
+ */
+void flash_range_program(uint32_t flash_offs, const uint8_t *data,
+                         size_t count) {
+    check_range("program", flash_offs, count, FLASH_PAGE_SIZE);
+    uint8_t *dst = flash_emu_base() + flash_offs;
+    for (size_t i = 0; i < count; i++) {
+        dst[i] &= data[i];
+    }
+
+    flash_emu_counters.program_ops += count / FLASH_PAGE_SIZE;
+    flash_emu_counters.program_bytes += count;
+    flash_emu_counters.busy_us +=
+        (count / FLASH_PAGE_SIZE) * FLASH_EMU_PAGE_PROGRAM_US;
+}
@@ -0,0 +1,43 @@
+#ifndef FLASH_EMU_H
+#define FLASH_EMU_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef PICO_FLASH_SIZE_BYTES
+#define PICO_FLASH_SIZE_BYTES (2 * 1024 * 1024) // Same as the Pico board
+#endif
+
+// The emulated flash is taken to start with a 256KB firmware image, which the
+// volume is placed after as on the Pico
+#ifndef FLASH_BINARY_END
+#define FLASH_BINARY_END (256 * 1024)
+#endif
+
+// Typical W25Q16JV timings, used to estimate time spent on real hardware
+#define FLASH_EMU_SECTOR_ERASE_US 45000
+#define FLASH_EMU_BLOCK_ERASE_US 150000
+#define FLASH_EMU_PAGE_PROGRAM_US 400
+
+// Counters of the flash commands issued since the last reset
+typedef struct {
+    uint64_t erase_ops;       // Number of sector erases
+    uint64_t block_erase_ops; // Number of 64KB block erases
+    uint64_t erase_bytes;     // Bytes erased
+    uint64_t program_ops;     // Number of page programs
+    uint64_t program_bytes;   // Bytes programmed
+    uint64_t busy_us;         // Estimated time the flash would have been busy
+} FlashEmuCounters;
+
+extern FlashEmuCounters flash_emu_counters;
+
+// Maps the emulated flash onto a file so its contents survive between runs.
+// Without a call to this function a blank, RAM only flash is used.
+int flash_emu_init(const char *image_path);
+
+// Returns the start of the emulated flash, which stands in for XIP_BASE
+uint8_t *flash_emu_base(void);
+
+void flash_emu_reset_counters(void);
+
+#endif // FLASH_EMU_H
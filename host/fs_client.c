@@ -0,0 +1,517 @@
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include "fs_client.h"
+#include "proto.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+// Frame being sent, and the data of the reply read
+static uint8_t frame_out[PROTO_FRAME_MAX];
+static uint8_t reply_data[PROTO_MAX_PAYLOAD];
+
+static uint32_t get_u32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_u32(uint8_t *p, uint32_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+/**
+ * @brief Computes the CRC32 (IEEE 802.3) of a buffer, as the device does.
+ *
+ * @param data The buffer.
+ * @param length Its length in bytes.
+ * @return The CRC32.
+ */
+static uint32_t client_crc32(const uint8_t *data, size_t length) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+static uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Reads a byte from the connection, waiting until a deadline.
+ *
+ * @param client The connection.
+ * @param deadline When to give up, in milliseconds of now_ms.
+ * @return The byte, CLIENT_TIMEOUT or CLIENT_IO_ERROR.
+ */
+static int read_byte(FsClient *client, uint64_t deadline) {
+    while (client->in_start == client->in_end) {
+        uint64_t now = now_ms();
+        if (now >= deadline) {
+            return CLIENT_TIMEOUT;
+        }
+        struct pollfd pfd = {client->fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, (int)(deadline - now));
+        if (ready < 0 && errno != EINTR) {
+            return CLIENT_IO_ERROR;
+        }
+        if (ready <= 0) {
+            continue;
+        }
+        ssize_t count = read(client->fd, client->in, sizeof(client->in));
+        if (count < 0 && errno != EINTR && errno != EAGAIN) {
+            return CLIENT_IO_ERROR;
+        }
+        if (count == 0) {
+            return CLIENT_IO_ERROR;
+        }
+        if (count > 0) {
+            client->in_start = 0;
+            client->in_end = count;
+        }
+    }
+    return client->in[client->in_start++];
+}
+
+/**
+ * @brief Builds a frame.
+ *
+ * @param frame Filled with the frame, it must have room for PROTO_FRAME_MAX
+ * bytes.
+ * @param type The type of the frame.
+ * @param payload Its payload, which may be NULL if the length is 0.
+ * @param length The length of the payload, at most PROTO_MAX_PAYLOAD.
+ * @return The length of the frame.
+ */
+int client_frame(uint8_t *frame, int type, const void *payload, int length) {
+    frame[0] = PROTO_MAGIC;
+    frame[1] = type;
+    frame[2] = length & 0xFF;
+    frame[3] = length >> 8;
+    if (length > 0) {
+        memcpy(frame + PROTO_HEADER, payload, length);
+    }
+    put_u32(frame + PROTO_HEADER + length,
+            client_crc32(frame + 1, PROTO_HEADER - 1 + length));
+    return PROTO_HEADER + length + PROTO_TRAILER;
+}
+
+/**
+ * @brief Sends bytes as they are, a frame or text for the command prompt.
+ *
+ * @param client The connection.
+ * @param frame The bytes.
+ * @param length Their number.
+ * @return 0 if successful, CLIENT_IO_ERROR otherwise.
+ */
+int client_send(FsClient *client, const uint8_t *frame, int length) {
+    while (length > 0) {
+        ssize_t count = write(client->fd, frame, length);
+        if (count < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            return CLIENT_IO_ERROR;
+        }
+        frame += count;
+        length -= count;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads the next reply, skipping anything before its magic byte.
+ *
+ * @param client The connection.
+ * @param type Set to the type of the reply.
+ * @param reply Filled with the data after the result, it must have room for
+ * PROTO_MAX_DATA bytes.
+ * @param reply_length Set to the length of that data.
+ * @return The result of the reply, PROTO_BAD_FRAME if the reply was damaged,
+ * CLIENT_TIMEOUT or CLIENT_IO_ERROR. The type is only set if a reply was
+ * read.
+ */
+int client_read_reply(FsClient *client, int *type, uint8_t *reply,
+                      int *reply_length) {
+    uint64_t deadline = now_ms() + CLIENT_TIMEOUT_MS;
+    uint8_t header[PROTO_HEADER];
+    int ch;
+    do {
+        ch = read_byte(client, deadline);
+        if (ch < 0) {
+            return ch;
+        }
+    } while (ch != PROTO_MAGIC);
+
+    header[0] = ch;
+    for (int i = 1; i < PROTO_HEADER; i++) {
+        if ((ch = read_byte(client, deadline)) < 0) {
+            return ch;
+        }
+        header[i] = ch;
+    }
+    int length = header[2] | header[3] << 8;
+    if (length < 4 || length > PROTO_MAX_PAYLOAD) {
+        return PROTO_BAD_FRAME;
+    }
+
+    static uint8_t frame[PROTO_FRAME_MAX];
+    memcpy(frame, header, PROTO_HEADER);
+    for (int i = 0; i < length + PROTO_TRAILER; i++) {
+        if ((ch = read_byte(client, deadline)) < 0) {
+            return ch;
+        }
+        frame[PROTO_HEADER + i] = ch;
+    }
+    if (client_crc32(frame + 1, PROTO_HEADER - 1 + length) !=
+        get_u32(frame + PROTO_HEADER + length)) {
+        return PROTO_BAD_FRAME;
+    }
+
+    *type = header[1];
+    *reply_length = length - 4;
+    memcpy(reply, frame + PROTO_HEADER + 4, length - 4);
+    return (int32_t)get_u32(frame + PROTO_HEADER);
+}
+
+/**
+ * @brief Sends a request and waits for its reply.
+ *
+ * A request the other end refuses as damaged, or whose reply is damaged or
+ * does not come, is sent again, up to CLIENT_RETRIES times. Requests do the
+ * same thing when sent again, see proto.h. A reply of another type, left
+ * over from an earlier request, is skipped.
+ *
+ * @param client The connection.
+ * @param type The type of the request.
+ * @param payload Its payload.
+ * @param length The length of the payload.
+ * @param reply Filled with the data of the reply, it must have room for
+ * PROTO_MAX_DATA bytes. May be NULL if the reply has no data.
+ * @param reply_length Set to the length of that data. May be NULL.
+ * @return The result of the reply, or an error code.
+ */
+int client_request(FsClient *client, int type, const void *payload,
+                   int length, uint8_t *reply, int *reply_length) {
+    int frame_length = client_frame(frame_out, type, payload, length);
+    int result = PROTO_BAD_FRAME;
+    for (int attempt = 0; attempt <= CLIENT_RETRIES; attempt++) {
+        if (client_send(client, frame_out, frame_length) < 0) {
+            return CLIENT_IO_ERROR;
+        }
+        int reply_type;
+        int data_length;
+        do {
+            reply_type = 0; // Left 0 if no reply could be read
+            result = client_read_reply(client, &reply_type, reply_data,
+                                       &data_length);
+        } while (reply_type != 0 && reply_type != (type | PROTO_REPLY) &&
+                 reply_type != (PROTO_ERROR | PROTO_REPLY));
+        if (result == CLIENT_IO_ERROR) {
+            return result;
+        }
+        if (reply_type != (type | PROTO_REPLY)) {
+            continue;
+        }
+        if (reply != NULL) {
+            memcpy(reply, reply_data, data_length);
+        }
+        if (reply_length != NULL) {
+            *reply_length = data_length;
+        }
+        return result;
+    }
+    return result;
+}
+
+/**
+ * @brief Switches the other end of a connection to binary mode.
+ *
+ * A PROTO_QUIT is sent first in case an earlier session was cut short and
+ * the other end is still in binary mode. At the command prompt it is only
+ * an unknown command.
+ *
+ * @param client The connection.
+ * @return 0 if successful, otherwise an error code.
+ */
+static int start_session(FsClient *client) {
+    client->in_start = 0;
+    client->in_end = 0;
+    int frame_length = client_frame(frame_out, PROTO_QUIT, NULL, 0);
+    if (client_send(client, frame_out, frame_length) < 0 ||
+        client_send(client, (const uint8_t *)"\nbinary\n", 8) < 0) {
+        return CLIENT_IO_ERROR;
+    }
+    while (true) {
+        int type = 0;
+        int length;
+        int result = client_read_reply(client, &type, reply_data, &length);
+        if (result == CLIENT_TIMEOUT || result == CLIENT_IO_ERROR) {
+            return result;
+        }
+        if (type == (PROTO_HELLO | PROTO_REPLY)) {
+            return result == PROTO_VERSION ? 0 : CLIENT_BAD_VERSION;
+        }
+    }
+}
+
+/**
+ * @brief Opens a serial port, such as the Pico's USB CDC device, and
+ * switches the filesystem on the other end to binary mode.
+ *
+ * @param client Filled with the connection.
+ * @param device The path of the serial port.
+ * @return 0 if successful, otherwise an error code.
+ */
+int client_open(FsClient *client, const char *device) {
+    client->child = 0;
+    client->fd = open(device, O_RDWR | O_NOCTTY);
+    if (client->fd < 0) {
+        return CLIENT_IO_ERROR;
+    }
+    struct termios tio;
+    if (tcgetattr(client->fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(client->fd, TCSANOW, &tio);
+        tcflush(client->fd, TCIFLUSH);
+    }
+    int result = start_session(client);
+    if (result < 0) {
+        close(client->fd);
+        client->fd = -1;
+    }
+    return result;
+}
+
+/**
+ * @brief Runs a server, such as fs_host, on a pseudo terminal as if it were
+ * the Pico's serial port, and switches it to binary mode.
+ *
+ * @param client Filled with the connection.
+ * @param argv The program and its arguments, ending with NULL.
+ * @return 0 if successful, otherwise an error code.
+ */
+int client_spawn(FsClient *client, char *const argv[]) {
+    client->child = 0;
+    client->fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (client->fd < 0 || grantpt(client->fd) < 0 ||
+        unlockpt(client->fd) < 0) {
+        return CLIENT_IO_ERROR;
+    }
+    const char *name = ptsname(client->fd);
+    if (name == NULL) {
+        return CLIENT_IO_ERROR;
+    }
+
+    pid_t child = fork();
+    if (child < 0) {
+        return CLIENT_IO_ERROR;
+    }
+    if (child == 0) {
+        setsid();
+        int slave = open(name, O_RDWR);
+        if (slave < 0) {
+            _exit(127);
+        }
+        struct termios tio;
+        tcgetattr(slave, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(slave, TCSANOW, &tio);
+        dup2(slave, STDIN_FILENO);
+        dup2(slave, STDOUT_FILENO);
+        close(slave);
+        close(client->fd);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    client->child = child;
+
+    int result = start_session(client);
+    if (result < 0) {
+        client_close(client);
+    }
+    return result;
+}
+
+/**
+ * @brief Leaves binary mode and closes the connection. A spawned server is
+ * told to exit and waited for.
+ *
+ * @param client The connection.
+ */
+void client_close(FsClient *client) {
+    if (client->fd >= 0) {
+        client_request(client, PROTO_QUIT, NULL, 0, NULL, NULL);
+        if (client->child > 0) {
+            client_send(client, (const uint8_t *)"exit\n", 5);
+        }
+        close(client->fd);
+        client->fd = -1;
+    }
+    if (client->child > 0) {
+        waitpid(client->child, NULL, 0);
+        client->child = 0;
+    }
+}
+
+/**
+ * @brief Copies a local file to the filesystem, replacing any file there.
+ *
+ * @param client The connection.
+ * @param remote The path on the filesystem.
+ * @param in The file to copy.
+ * @return The bytes copied if successful, otherwise an error code.
+ */
+int client_put(FsClient *client, const char *remote, FILE *in) {
+    int result = client_request(client, PROTO_PUT, remote, strlen(remote),
+                                NULL, NULL);
+    if (result < 0) {
+        return result;
+    }
+    static uint8_t data[PROTO_MAX_PAYLOAD]; // Offset, then the data
+    int total = 0;
+    size_t count;
+    while ((count = fread(data + 4, 1, PROTO_MAX_DATA, in)) > 0) {
+        put_u32(data, total);
+        result = client_request(client, PROTO_DATA, data, 4 + count, NULL,
+                                NULL);
+        if (result < 0) {
+            break;
+        }
+        if (result != (int)count) {
+            result = CLIENT_SHORT_WRITE;
+            break;
+        }
+        total += count;
+    }
+    int closed = client_request(client, PROTO_CLOSE, NULL, 0, NULL, NULL);
+    if (result < 0) {
+        return result;
+    }
+    return closed < 0 ? closed : total;
+}
+
+/**
+ * @brief Copies a file of the filesystem to a local file.
+ *
+ * @param client The connection.
+ * @param remote The path on the filesystem.
+ * @param out The file to copy it to.
+ * @return The bytes copied if successful, otherwise an error code.
+ */
+int client_get(FsClient *client, const char *remote, FILE *out) {
+    int result = client_request(client, PROTO_GET, remote, strlen(remote),
+                                NULL, NULL);
+    if (result < 0) {
+        return result;
+    }
+    static uint8_t data[PROTO_MAX_DATA];
+    int total = 0;
+    int length;
+    uint8_t offset[4];
+    while (true) {
+        put_u32(offset, total);
+        result = client_request(client, PROTO_NEXT, offset, 4, data, &length);
+        if (result <= 0) {
+            break;
+        }
+        if (fwrite(data, 1, length, out) != (size_t)length) {
+            result = CLIENT_IO_ERROR;
+            break;
+        }
+        total += length;
+    }
+    int closed = client_request(client, PROTO_CLOSE, NULL, 0, NULL, NULL);
+    if (result < 0) {
+        return result;
+    }
+    return closed < 0 ? closed : total;
+}
+
+/**
+ * @brief Gets the attributes of a file or directory of the filesystem.
+ *
+ * @param client The connection.
+ * @param remote The path on the filesystem.
+ * @param st Filled with the attributes.
+ * @return 0 if successful, otherwise an error code.
+ */
+int client_stat(FsClient *client, const char *remote, ClientStat *st) {
+    uint8_t data[PROTO_MAX_DATA];
+    int length;
+    int result = client_request(client, PROTO_STAT, remote, strlen(remote),
+                                data, &length);
+    if (result < 0) {
+        return result;
+    }
+    if (length < 6) {
+        return PROTO_BAD_FRAME;
+    }
+    st->size = get_u32(data);
+    st->is_dir = data[4];
+    st->compressed = data[5];
+    return 0;
+}
+
+/**
+ * @brief Lists a directory of the filesystem, a line per entry.
+ *
+ * @param client The connection.
+ * @param dir The path of the directory, "" or "/" for the root.
+ * @param out Where to print the entries.
+ * @return The number of entries if successful, otherwise an error code.
+ */
+int client_ls(FsClient *client, const char *dir, FILE *out) {
+    int dir_length = strlen(dir);
+    if (dir_length >= PROTO_MAX_PATH) {
+        return PROTO_BAD_REQUEST;
+    }
+    uint8_t request[4 + PROTO_MAX_PATH];
+    memcpy(request + 4, dir, dir_length);
+
+    static uint8_t data[PROTO_MAX_DATA];
+    int entries = 0;
+    uint32_t cookie = 0;
+    do {
+        put_u32(request, cookie);
+        int length;
+        int result = client_request(client, PROTO_LS, request, 4 + dir_length,
+                                    data, &length);
+        if (result < 0) {
+            return result;
+        }
+        for (int i = 0; i + 6 <= length;) {
+            int name_length = data[i + 5];
+            if (i + 6 + name_length > length) {
+                return PROTO_BAD_FRAME;
+            }
+            fprintf(out, "%.*s%s", name_length, (const char *)data + i + 6,
+                    data[i + 4] & PROTO_LS_DIR ? "/" : "");
+            if (!(data[i + 4] & PROTO_LS_DIR)) {
+                fprintf(out, " %u bytes%s", get_u32(data + i),
+                        data[i + 4] & PROTO_LS_COMPRESSED ? ", compressed"
+                                                          : "");
+            }
+            fprintf(out, "\n");
+            entries++;
+            i += 6 + name_length;
+        }
+        cookie = result;
+    } while (cookie != 0);
+    return entries;
+}
@@ -0,0 +1,54 @@
+#ifndef FS_CLIENT_H
+#define FS_CLIENT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#define CLIENT_TIMEOUT_MS 5000 // Longest wait for a reply
+#define CLIENT_RETRIES 3       // Times a request refused as damaged is resent
+
+// Errors of the client, apart from those the other end replies with
+enum client_errors {
+    CLIENT_IO_ERROR = -110,    // Reading or writing the connection failed
+    CLIENT_TIMEOUT = -111,     // No reply came within CLIENT_TIMEOUT_MS
+    CLIENT_BAD_VERSION = -112, // The other end speaks another PROTO_VERSION
+    CLIENT_SHORT_WRITE = -113, // Fewer bytes were written than sent
+};
+
+// Connection to a device, or to a server spawned on a pty
+typedef struct {
+    int fd;      // Serial port, or the master side of the pty
+    pid_t child; // Process of the spawned server, 0 if none
+    uint8_t in[512]; // Bytes read from the connection but not yet used
+    int in_start;    // First of them
+    int in_end;      // End of them
+} FsClient;
+
+// Attributes of a file, as returned by client_stat
+typedef struct {
+    uint32_t size;  // Size of the file in bytes, as stored if compressed
+    int is_dir;     // Set if it is a directory
+    int compressed; // Set if the data is stored as compressed blocks
+} ClientStat;
+
+// Connecting, which switches the other end to binary mode
+int client_open(FsClient *client, const char *device);
+int client_spawn(FsClient *client, char *const argv[]);
+void client_close(FsClient *client);
+
+// Requests
+int client_put(FsClient *client, const char *remote, FILE *in);
+int client_get(FsClient *client, const char *remote, FILE *out);
+int client_stat(FsClient *client, const char *remote, ClientStat *st);
+int client_ls(FsClient *client, const char *dir, FILE *out);
+
+// Frames, for requests of any kind
+int client_frame(uint8_t *frame, int type, const void *payload, int length);
+int client_send(FsClient *client, const uint8_t *frame, int length);
+int client_request(FsClient *client, int type, const void *payload,
+                   int length, uint8_t *reply, int *reply_length);
+int client_read_reply(FsClient *client, int *type, uint8_t *reply,
+                      int *reply_length);
+
+#endif // FS_CLIENT_H
@@ -0,0 +1,68 @@
+#ifndef HOST_HARDWARE_DMA_H
+#define HOST_HARDWARE_DMA_H
+
+// Host stand-in for the parts of the Pico SDK hardware/dma.h used by the
+// filesystem, backed by dma_emu.c. A transfer runs to completion as soon as
+// it is triggered, and the sniffer computes its CRC the way the hardware does.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DMA_SNIFF_CTRL_CALC_VALUE_CRC32 0x0  // CRC32 of the data as it is
+#define DMA_SNIFF_CTRL_CALC_VALUE_CRC32R 0x1 // CRC32 of the data bit reversed
+
+enum dma_channel_transfer_size {
+    DMA_SIZE_8 = 0,
+    DMA_SIZE_16 = 1,
+    DMA_SIZE_32 = 2
+};
+
+typedef struct {
+    enum dma_channel_transfer_size size;
+    bool read_increment;
+    bool write_increment;
+    bool sniff;
+} dma_channel_config;
+
+int dma_claim_unused_channel(bool required);
+dma_channel_config dma_channel_get_default_config(unsigned int channel);
+void dma_channel_configure(unsigned int channel,
+                           const dma_channel_config *config,
+                           volatile void *write_addr,
+                           const volatile void *read_addr,
+                           unsigned int transfer_count, bool trigger);
+void dma_sniffer_enable(unsigned int channel, unsigned int mode,
+                        bool force_channel_enable);
+void dma_sniffer_disable(void);
+void dma_sniffer_set_output_reverse_enabled(bool enable);
+void dma_sniffer_set_output_invert_enabled(bool enable);
+void dma_sniffer_set_data_accumulator(uint32_t seed);
+uint32_t dma_sniffer_get_data_accumulator(void);
+
+static inline void
+channel_config_set_transfer_data_size(dma_channel_config *c,
+                                      enum dma_channel_transfer_size size) {
+    c->size = size;
+}
+
+static inline void channel_config_set_read_increment(dma_channel_config *c,
+                                                     bool incr) {
+    c->read_increment = incr;
+}
+
+static inline void channel_config_set_write_increment(dma_channel_config *c,
+                                                      bool incr) {
+    c->write_increment = incr;
+}
+
+static inline void channel_config_set_sniff_enable(dma_channel_config *c,
+                                                   bool sniff_enable) {
+    c->sniff = sniff_enable;
+}
+
+// Transfers finish when they are triggered
+static inline void dma_channel_wait_for_finish_blocking(unsigned int channel) {
+    (void)channel;
+}
+
+#endif // HOST_HARDWARE_DMA_H
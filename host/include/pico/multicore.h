@@ -0,0 +1,21 @@
+#ifndef HOST_PICO_MULTICORE_H
+#define HOST_PICO_MULTICORE_H
+
+// Host stand-in for the parts of the Pico SDK pico/multicore.h used by the
+// filesystem. Core 1 is a thread, and as the emulated flash is plain memory
+// there is nothing core 0 has to be locked out of while it is written.
+
+#include <stdint.h>
+
+void multicore_launch_core1(void (*entry)(void));
+
+// Returns 1 on the thread started by multicore_launch_core1, otherwise 0
+uint32_t get_core_num(void);
+
+static inline void multicore_lockout_victim_init(void) {}
+
+static inline void multicore_lockout_start_blocking(void) {}
+
+static inline void multicore_lockout_end_blocking(void) {}
+
+#endif // HOST_PICO_MULTICORE_H
@@ -0,0 +1,9 @@
+#ifndef HOST_PICO_STDIO_USB_H
+#define HOST_PICO_STDIO_USB_H
+
+// Host stand-in for the Pico SDK pico/stdio_usb.h. Output goes to the host's
+// stdout, which never translates newlines, so there is no driver to set up.
+
+#define stdio_set_translate_crlf(driver, translate) ((void)0)
+
+#endif // HOST_PICO_STDIO_USB_H
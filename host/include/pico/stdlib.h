@@ -0,0 +1,36 @@
+#ifndef HOST_PICO_STDLIB_H
+#define HOST_PICO_STDLIB_H
+
+// Host stand-in for the parts of the Pico SDK pico/stdlib.h used by the
+// filesystem
+
+#include "flash_emu.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Flash is memory mapped at XIP_BASE on the Pico, here it is the emulation
+#define XIP_BASE ((uintptr_t)flash_emu_base())
+
+#define PICO_ERROR_TIMEOUT -1
+
+static inline uint64_t time_us_64(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + ts.tv_nsec / 1000u;
+}
+
+static inline void sleep_ms(uint32_t ms) {
+    struct timespec ts = {ms / 1000, (long)(ms % 1000) * 1000000};
+    nanosleep(&ts, NULL);
+}
+
+// Reading stdin blocks on the host, so this never times out
+static inline int getchar_timeout_us(uint32_t timeout_us) {
+    (void)timeout_us;
+    int ch = getchar();
+    return ch == EOF ? '\n' : ch;
+}
+
+#endif // HOST_PICO_STDLIB_H
@@ -0,0 +1,29 @@
+#ifndef HOST_PICO_UTIL_QUEUE_H
+#define HOST_PICO_UTIL_QUEUE_H
+
+// Host stand-in for the Pico SDK pico/util/queue.h, a fixed size queue of
+// fixed size elements that is safe to share between cores
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    uint8_t *data;
+    unsigned int element_size;
+    unsigned int element_count;
+    unsigned int rptr;
+    unsigned int level;
+} queue_t;
+
+void queue_init(queue_t *q, unsigned int element_size,
+                unsigned int element_count);
+bool queue_try_add(queue_t *q, const void *data);
+bool queue_try_remove(queue_t *q, void *data);
+void queue_add_blocking(queue_t *q, const void *data);
+void queue_remove_blocking(queue_t *q, void *data);
+unsigned int queue_get_level(queue_t *q);
+
+#endif // HOST_PICO_UTIL_QUEUE_H
@@ -0,0 +1,32 @@
+#include "cli.h"
+#include "filesystem.h"
+#include "flash_emu.h"
+#include <stdio.h>
+#include <string.h>
+
+// Host counterpart of main.c. An optional argument names a flash image file
+// so the filesystem persists between runs.
+int main(int argc, char **argv) {
+    char command[256];
+
+    if (flash_emu_init(argc > 1 ? argv[1] : NULL) != 0) {
+        return 1;
+    }
+    init_filesystem();
+
+    // Command loop, the terminal does the echoing here. Reading blocks, so the
+    // idle work is done before each prompt instead of while waiting.
+    while (1) {
+        while (fs_idle() > 0) {
+        }
+        printf("\nEnter command: ");
+        fflush(stdout);
+        if (fgets(command, sizeof(command), stdin) == NULL) {
+            break;
+        }
+        command[strcspn(command, "\r\n")] = '\0';
+        if (execute_command(command))
+            break;
+    }
+    return 0;
+}
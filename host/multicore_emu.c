@@ -0,0 +1,107 @@
+#include "pico/multicore.h"
+#include "pico/util/queue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static _Thread_local uint32_t core_num;
+
+static void (*core1_entry)(void);
+
+static void *core1_main(void *arg) {
+    (void)arg;
+    core_num = 1;
+    core1_entry();
+    return NULL;
+}
+
+/**
+ * @brief Runs the given function on a new thread standing in for core 1.
+ */
+void multicore_launch_core1(void (*entry)(void)) {
+    pthread_t thread;
+    core1_entry = entry;
+    if (pthread_create(&thread, NULL, core1_main, NULL) != 0) {
+        perror("multicore_launch_core1");
+        abort();
+    }
+    pthread_detach(thread);
+}
+
+uint32_t get_core_num(void) { return core_num; }
+
+void queue_init(queue_t *q, unsigned int element_size,
+                unsigned int element_count) {
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->changed, NULL);
+    q->data = malloc((size_t)element_size * element_count);
+    q->element_size = element_size;
+    q->element_count = element_count;
+    q->rptr = 0;
+    q->level = 0;
+}
+
+/**
+ * @brief Adds an element, waiting for room if block is set.
+ *
+ * @return true if the element was added.
+ */
+static bool queue_add(queue_t *q, const void *data, bool block) {
+    pthread_mutex_lock(&q->lock);
+    while (block && q->level == q->element_count) {
+        pthread_cond_wait(&q->changed, &q->lock);
+    }
+    bool added = q->level < q->element_count;
+    if (added) {
+        unsigned int wptr = (q->rptr + q->level) % q->element_count;
+        memcpy(q->data + wptr * q->element_size, data, q->element_size);
+        q->level++;
+        pthread_cond_broadcast(&q->changed);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return added;
+}
+
+/**
+ * @brief Removes the oldest element, waiting for one if block is set.
+ *
+ * @return true if an element was removed.
+ */
+static bool queue_remove(queue_t *q, void *data, bool block) {
+    pthread_mutex_lock(&q->lock);
+    while (block && q->level == 0) {
+        pthread_cond_wait(&q->changed, &q->lock);
+    }
+    bool removed = q->level > 0;
+    if (removed) {
+        memcpy(data, q->data + q->rptr * q->element_size, q->element_size);
+        q->rptr = (q->rptr + 1) % q->element_count;
+        q->level--;
+        pthread_cond_broadcast(&q->changed);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return removed;
+}
+
+bool queue_try_add(queue_t *q, const void *data) {
+    return queue_add(q, data, false);
+}
+
+bool queue_try_remove(queue_t *q, void *data) {
+    return queue_remove(q, data, false);
+}
+
+void queue_add_blocking(queue_t *q, const void *data) {
+    queue_add(q, data, true);
+}
+
+void queue_remove_blocking(queue_t *q, void *data) {
+    queue_remove(q, data, true);
+}
+
+unsigned int queue_get_level(queue_t *q) {
+    pthread_mutex_lock(&q->lock);
+    unsigned int level = q->level;
+    pthread_mutex_unlock(&q->lock);
+    return level;
+}
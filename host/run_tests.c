@@ -0,0 +1,10 @@
+#include "filesystem.h"
+#include "tests.h"
+
+// Runs the unit tests against a blank emulated flash. ctest treats any
+// "Failed" line in the output as a failure.
+int main() {
+    init_filesystem();
+    run_tests();
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include "lz.h"
+#include <string.h>
+
+// A compressed block is a sequence of tokens. A token byte below 0x80 is
+// followed by that many literals plus one. Otherwise it is a match of its low
+// seven bits plus LZ_MIN_MATCH bytes, followed by the distance back to the
+// match minus one, low byte first.
+
+// Last position, plus one, where each hash of three bytes was seen
+static uint16_t lz_table[1 << LZ_HASH_BITS];
+
+/**
+ * @brief Hashes the three bytes at a position into the match finder's table.
+ *
+ * @param p The first of the bytes.
+ * @return The entry of the table.
+ */
+static uint32_t lz_hash(const uint8_t *p) {
+    uint32_t v = p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * @brief Writes a run of literals as as many tokens as it takes.
+ *
+ * @param in The literals.
+ * @param length The number of literals.
+ * @param out The output buffer.
+ * @param at Where in the output the tokens go, moved past them.
+ * @param capacity The size of the output buffer.
+ * @return 0 if successful, -1 if the output buffer is too small.
+ */
+static int lz_literals(const uint8_t *in, int length, uint8_t *out, int *at,
+                       int capacity) {
+    while (length > 0) {
+        int run = length < LZ_MAX_RUN ? length : LZ_MAX_RUN;
+        if (*at + 1 + run > capacity) {
+            return -1;
+        }
+        out[(*at)++] = run - 1;
+        memcpy(out + *at, in, run);
+        *at += run;
+        in += run;
+        length -= run;
+    }
+    return 0;
+}
+
+/**
+ * @brief Compresses a buffer.
+ *
+ * Matches are found greedily through a hash table of the last position each
+ * three bytes were seen at, so the whole input is the window and the only
+ * other memory used is the table. Giving a capacity smaller than the input
+ * stops as soon as the output would not be smaller.
+ *
+ * @param in The data to compress, at most 65534 bytes.
+ * @param length The length of the data.
+ * @param out The buffer for the compressed data.
+ * @param capacity The size of that buffer, LZ_BOUND(length) always fits.
+ * @return The length of the compressed data, or -1 if it does not fit.
+ */
+int lz_compress(const uint8_t *in, int length, uint8_t *out, int capacity) {
+    memset(lz_table, 0, sizeof(lz_table));
+    int at = 0;
+    int literals = 0;
+    int i = 0;
+    while (i + LZ_MIN_MATCH <= length) {
+        uint32_t hash = lz_hash(in + i);
+        int candidate = lz_table[hash] - 1;
+        lz_table[hash] = i + 1;
+        if (candidate < 0 || memcmp(in + candidate, in + i, LZ_MIN_MATCH)) {
+            i++;
+            continue;
+        }
+
+        // Extend the match as far as it goes
+        int match = LZ_MIN_MATCH;
+        while (i + match < length && match < LZ_MAX_MATCH &&
+               in[candidate + match] == in[i + match]) {
+            match++;
+        }
+
+        // Write the literals before it, then the match
+        if (lz_literals(in + literals, i - literals, out, &at, capacity) < 0 ||
+            at + 3 > capacity) {
+            return -1;
+        }
+        uint32_t distance = i - candidate - 1;
+        out[at++] = 0x80 | (match - LZ_MIN_MATCH);
+        out[at++] = distance & 0xFF;
+        out[at++] = distance >> 8;
+        i += match;
+        literals = i;
+    }
+    if (lz_literals(in + literals, length - literals, out, &at, capacity) < 0) {
+        return -1;
+    }
+    return at;
+}
+
+/**
+ * @brief Decompresses a buffer compressed by lz_compress.
+ *
+ * @param in The compressed data.
+ * @param length The length of the compressed data.
+ * @param out The buffer for the data.
+ * @param capacity The size of that buffer.
+ * @return The length of the data, or -1 if the compressed data is corrupt or
+ * does not fit.
+ */
+int lz_decompress(const uint8_t *in, int length, uint8_t *out, int capacity) {
+    int at = 0;
+    int i = 0;
+    while (i < length) {
+        uint8_t token = in[i++];
+        if (token < 0x80) {
+            // Copy the literals
+            int run = token + 1;
+            if (i + run > length || at + run > capacity) {
+                return -1;
+            }
+            memcpy(out + at, in + i, run);
+            i += run;
+            at += run;
+        } else {
+            // Copy the match byte by byte, as it can overlap itself
+            int match = (token & 0x7F) + LZ_MIN_MATCH;
+            if (i + 2 > length) {
+                return -1;
+            }
+            int distance = (in[i] | in[i + 1] << 8) + 1;
+            i += 2;
+            if (distance > at || at + match > capacity) {
+                return -1;
+            }
+            for (int j = 0; j < match; j++, at++) {
+                out[at] = out[at - distance];
+            }
+        }
+    }
+    return at;
+}
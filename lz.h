@@ -0,0 +1,17 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+
+#define LZ_MIN_MATCH 3   // Shortest match worth encoding
+#define LZ_MAX_MATCH 130 // Longest match a token holds
+#define LZ_MAX_RUN 128   // Most literals a token holds
+#define LZ_HASH_BITS 10  // The match finder's table has 2^LZ_HASH_BITS entries
+
+// Compressed size of length bytes in the worst case, all literals
+#define LZ_BOUND(length) ((length) + ((length) + LZ_MAX_RUN - 1) / LZ_MAX_RUN)
+
+int lz_compress(const uint8_t *in, int length, uint8_t *out, int capacity);
+int lz_decompress(const uint8_t *in, int length, uint8_t *out, int capacity);
+
+#endif // LZ_H
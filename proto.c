@@ -0,0 +1,341 @@
+#include "proto.h"
+#include "filesystem.h"
+#include "pico/stdio_usb.h"
+#include "pico/stdlib.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IDLE_POLL_US 10000 // How long to wait for a frame before idle work
+
+// Start of the data of the reply being built, after its result
+#define REPLY_DATA (proto_out + PROTO_HEADER + 4)
+
+// Frame being read, and the reply being built
+uint8_t proto_in[PROTO_FRAME_MAX];
+uint8_t proto_out[PROTO_FRAME_MAX];
+
+// File being transferred by PROTO_PUT or PROTO_GET, -1 if none
+int proto_fd = -1;
+
+static uint32_t get_u32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_u32(uint8_t *p, uint32_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+/**
+ * @brief Reads bytes of a frame that has started.
+ *
+ * @param buffer Where the bytes go.
+ * @param length The number of bytes.
+ * @return 0 if they all came, PROTO_BAD_FRAME if one took longer than
+ * PROTO_BYTE_TIMEOUT_US.
+ */
+static int read_bytes(uint8_t *buffer, int length) {
+    for (int i = 0; i < length; i++) {
+        int ch = getchar_timeout_us(PROTO_BYTE_TIMEOUT_US);
+        if (ch == PICO_ERROR_TIMEOUT) {
+            return PROTO_BAD_FRAME;
+        }
+        buffer[i] = ch;
+    }
+    return 0;
+}
+
+/**
+ * @brief Waits for a frame and reads it into proto_in.
+ *
+ * Bytes before the magic byte are skipped, and the idle work the command
+ * prompt does runs while nothing arrives.
+ *
+ * @return The length of the payload, PROTO_BAD_FRAME if the frame was cut
+ * short, too long or its CRC does not match, or -1 if the input has ended,
+ * which only happens on the host.
+ */
+static int read_frame() {
+    int ch;
+    do {
+        ch = getchar_timeout_us(IDLE_POLL_US);
+        if (ch == PICO_ERROR_TIMEOUT) {
+            fs_idle_step();
+        } else if (feof(stdin)) {
+            return -1;
+        }
+    } while (ch != PROTO_MAGIC);
+
+    proto_in[0] = ch;
+    if (read_bytes(proto_in + 1, PROTO_HEADER - 1) < 0) {
+        return PROTO_BAD_FRAME;
+    }
+    int length = proto_in[2] | proto_in[3] << 8;
+    if (length > PROTO_MAX_PAYLOAD ||
+        read_bytes(proto_in + PROTO_HEADER, length + PROTO_TRAILER) < 0) {
+        return PROTO_BAD_FRAME;
+    }
+    if (crc32(proto_in + 1, PROTO_HEADER - 1 + length) !=
+        get_u32(proto_in + PROTO_HEADER + length)) {
+        return PROTO_BAD_FRAME;
+    }
+    return length;
+}
+
+/**
+ * @brief Sends the reply in proto_out, whose data is already at REPLY_DATA.
+ *
+ * @param type The type of the request replied to.
+ * @param result The result of the request.
+ * @param length The length of the data.
+ */
+static void send_reply(int type, int32_t result, int length) {
+    proto_out[0] = PROTO_MAGIC;
+    proto_out[1] = type | PROTO_REPLY;
+    proto_out[2] = (length + 4) & 0xFF;
+    proto_out[3] = (length + 4) >> 8;
+    put_u32(proto_out + PROTO_HEADER, result);
+    put_u32(REPLY_DATA + length,
+            crc32(proto_out + 1, PROTO_HEADER - 1 + 4 + length));
+    fwrite(proto_out, 1, PROTO_HEADER + 4 + length + PROTO_TRAILER, stdout);
+    fflush(stdout);
+}
+
+/**
+ * @brief Copies the path a request gives, which is not NUL terminated.
+ *
+ * @param payload The path.
+ * @param length Its length.
+ * @param path Filled with the path, it must have room for PROTO_MAX_PATH
+ * bytes.
+ * @return 0 if successful, PROTO_BAD_REQUEST if the path is too long.
+ */
+static int get_path(const uint8_t *payload, int length, char *path) {
+    if (length < 0 || length >= PROTO_MAX_PATH) {
+        return PROTO_BAD_REQUEST;
+    }
+    memcpy(path, payload, length);
+    path[length] = '\0';
+    return 0;
+}
+
+/**
+ * @brief Closes the file of the transfer under way, if any.
+ */
+static void close_transfer() {
+    if (proto_fd >= 0) {
+        fs_close(proto_fd);
+        proto_fd = -1;
+    }
+}
+
+/**
+ * @brief Opens a file for PROTO_DATA, emptying it or creating it first.
+ *
+ * @param path The path of the file.
+ * @return 0 if successful, otherwise an error code.
+ */
+static int start_put(const char *path) {
+    int result = fs_format(path);
+    if (result == FILE_NOT_FOUND) {
+        result = fs_create(path);
+    }
+    if (result < 0) {
+        return result;
+    }
+    result = fs_open(path, MODE_WRITE);
+    if (result < 0) {
+        return result;
+    }
+    proto_fd = result;
+    return 0;
+}
+
+/**
+ * @brief Writes the data of a PROTO_DATA request to the file of the transfer.
+ *
+ * @param payload The payload, the offset of the data then the data.
+ * @param length The length of the payload.
+ * @return The bytes written, or taken as written already if the request was
+ * sent again, otherwise an error code.
+ */
+static int put_data(const uint8_t *payload, int length) {
+    if (proto_fd < 0) {
+        return PROTO_NO_TRANSFER;
+    }
+    if (length < 4) {
+        return PROTO_BAD_REQUEST;
+    }
+    uint32_t offset = get_u32(payload);
+    int size = length - 4;
+    int position = fs_seek(proto_fd, 0, FS_SEEK_CUR);
+    if (size > 0 && offset + size == (uint32_t)position) {
+        return size;
+    }
+    if (offset != (uint32_t)position) {
+        return PROTO_BAD_OFFSET;
+    }
+    return fs_write(proto_fd, (const char *)payload + 4, size);
+}
+
+/**
+ * @brief Reads data of the file of the transfer into the reply.
+ *
+ * @param payload The payload of the PROTO_NEXT request, the offset to read
+ * from.
+ * @param length The length of the payload.
+ * @return The bytes read, otherwise an error code.
+ */
+static int get_data(const uint8_t *payload, int length) {
+    if (proto_fd < 0) {
+        return PROTO_NO_TRANSFER;
+    }
+    if (length != 4) {
+        return PROTO_BAD_REQUEST;
+    }
+    int position = fs_seek(proto_fd, get_u32(payload), FS_SEEK_SET);
+    if (position < 0) {
+        return position;
+    }
+    return fs_read(proto_fd, (char *)REPLY_DATA, PROTO_MAX_DATA);
+}
+
+/**
+ * @brief Opens a file for PROTO_NEXT.
+ *
+ * @param path The path of the file.
+ * @return The size of the file if successful, otherwise an error code.
+ */
+static int start_get(const char *path) {
+    int fd = fs_open(path, MODE_READ);
+    if (fd < 0) {
+        return fd;
+    }
+    proto_fd = fd;
+    int size = fs_seek(fd, 0, FS_SEEK_END);
+    fs_seek(fd, 0, FS_SEEK_SET);
+    return size;
+}
+
+/**
+ * @brief Lists entries of a directory into the reply, as many as fit.
+ *
+ * @param path The path of the directory.
+ * @param cookie Where to carry on from, 0 for the first entry.
+ * @param length Set to the length of the entries.
+ * @return The cookie to list the rest with, 0 if there are none left,
+ * otherwise an error code.
+ */
+static int list_dir(const char *path, int cookie, int *length) {
+    char name[FS_NAME_SIZE];
+    FsStat st;
+    *length = 0;
+    while (true) {
+        int next = fs_readdir(path, cookie, name, &st);
+        if (next <= 0) {
+            return next;
+        }
+        int name_length = strlen(name);
+        if (*length + 6 + name_length > PROTO_MAX_DATA) {
+            return cookie;
+        }
+        uint8_t *entry = REPLY_DATA + *length;
+        put_u32(entry, st.size);
+        entry[4] = (st.is_dir ? PROTO_LS_DIR : 0) |
+                   (st.compressed ? PROTO_LS_COMPRESSED : 0);
+        entry[5] = name_length;
+        memcpy(entry + 6, name, name_length);
+        *length += 6 + name_length;
+        cookie = next;
+    }
+}
+
+/**
+ * @brief Runs the binary protocol until PROTO_QUIT.
+ *
+ * Files are moved in frames of up to PROTO_MAX_PAYLOAD bytes instead of
+ * typed and printed lines, so any data can be sent, and each frame carries a
+ * CRC32 so a damaged frame is refused rather than written. Output is sent
+ * without newline translation while the protocol runs. See proto.h for the
+ * frames.
+ */
+void proto_serve() {
+    stdio_set_translate_crlf(&stdio_usb, false);
+    send_reply(PROTO_HELLO, PROTO_VERSION, 0);
+
+    char path[PROTO_MAX_PATH];
+    bool quit = false;
+    while (!quit) {
+        int length = read_frame();
+        if (length == -1) {
+            break;
+        }
+        if (length == PROTO_BAD_FRAME) {
+            send_reply(PROTO_ERROR, PROTO_BAD_FRAME, 0);
+            continue;
+        }
+
+        int type = proto_in[1];
+        const uint8_t *payload = proto_in + PROTO_HEADER;
+        int result = 0;
+        int reply_length = 0;
+        FsStat st;
+        switch (type) {
+        case PROTO_PUT:
+            close_transfer();
+            result = get_path(payload, length, path);
+            if (result == 0) {
+                result = start_put(path);
+            }
+            break;
+        case PROTO_DATA:
+            result = put_data(payload, length);
+            break;
+        case PROTO_GET:
+            close_transfer();
+            result = get_path(payload, length, path);
+            if (result == 0) {
+                result = start_get(path);
+            }
+            break;
+        case PROTO_NEXT:
+            result = get_data(payload, length);
+            reply_length = result > 0 ? result : 0;
+            break;
+        case PROTO_CLOSE:
+            close_transfer();
+            break;
+        case PROTO_STAT:
+            result = get_path(payload, length, path);
+            if (result == 0) {
+                result = fs_stat(path, &st);
+            }
+            if (result == 0) {
+                put_u32(REPLY_DATA, st.size);
+                REPLY_DATA[4] = st.is_dir;
+                REPLY_DATA[5] = st.compressed;
+                reply_length = 6;
+            }
+            break;
+        case PROTO_LS:
+            result = length < 4 ? PROTO_BAD_REQUEST
+                                : get_path(payload + 4, length - 4, path);
+            if (result == 0) {
+                result = list_dir(path, get_u32(payload), &reply_length);
+            }
+            break;
+        case PROTO_QUIT:
+            close_transfer();
+            quit = true;
+            break;
+        default:
+            result = PROTO_BAD_REQUEST;
+            break;
+        }
+        send_reply(type, result, reply_length);
+    }
+    close_transfer();
+    stdio_set_translate_crlf(&stdio_usb, true);
+}
@@ -0,0 +1,62 @@
+#ifndef PROTO_H
+#define PROTO_H
+
+// Binary protocol of the 'binary' command. A frame is PROTO_MAGIC, the type,
+// the length of the payload as two bytes, the payload, then the CRC32 of the
+// type, length and payload as four bytes. Numbers are little endian. Every
+// request gets one reply, whose type is the request's with PROTO_REPLY set
+// and whose payload starts with a four byte result, an error code if
+// negative, followed by the data of the reply.
+
+#define PROTO_VERSION 2
+#define PROTO_MAGIC 0xA5
+#define PROTO_MAX_PAYLOAD 4100 // Largest payload, a sector after an offset
+#define PROTO_HEADER 4         // Bytes before the payload
+#define PROTO_TRAILER 4        // Bytes after it, the CRC32
+#define PROTO_FRAME_MAX (PROTO_HEADER + PROTO_MAX_PAYLOAD + PROTO_TRAILER)
+#define PROTO_MAX_DATA (PROTO_MAX_PAYLOAD - 4) // Data after an offset or result
+#define PROTO_MAX_PATH 128 // Longest path a request can give, with its NUL
+
+#define PROTO_BYTE_TIMEOUT_US 500000 // Longest gap within a frame
+
+// Types of request, the replies having PROTO_REPLY set
+enum proto_types {
+    PROTO_HELLO = 'H', // Sent once on entering binary mode, result the version
+    PROTO_PUT = 'P',   // Path, truncates or creates the file for PROTO_DATA
+    PROTO_DATA = 'D',  // Offset then data to write there, see below
+    PROTO_GET = 'G',   // Path, opens the file for PROTO_NEXT, result its size
+    PROTO_NEXT = 'N',  // Offset, result the bytes read from there, followed
+                       // by them
+    PROTO_CLOSE = 'C', // Closes the file of a PUT or GET
+    PROTO_STAT = 'S',  // Path, followed in the reply by its size, whether it
+                       // is a directory and whether it is compressed
+    PROTO_LS = 'L',    // Cookie then path, see below
+    PROTO_QUIT = 'Q',  // Leaves binary mode
+    PROTO_ERROR = 'E', // Reply to a frame that could not be read
+    PROTO_REPLY = 0x80,
+};
+
+// PROTO_DATA and PROTO_NEXT start with a four byte offset into the file, so a
+// request sent again because its reply was lost has the same effect as once.
+// PROTO_DATA only writes at the end of what has been written. One whose data
+// ends there, the last one sent again, is taken as written already, and any
+// other offset is refused with PROTO_BAD_OFFSET.
+
+// A PROTO_LS request is a four byte cookie, 0 to start, followed by the path
+// of a directory. Its result is the cookie to list the rest with, 0 once the
+// directory is done, followed by an entry per file: the size as four bytes,
+// a byte of flags, the length of the name as a byte, then the name.
+#define PROTO_LS_DIR (1 << 0)        // Flag of a directory
+#define PROTO_LS_COMPRESSED (1 << 1) // Flag of a compressed file
+
+// Errors of the protocol itself, apart from those of the filesystem
+enum proto_errors {
+    PROTO_BAD_FRAME = -100,   // The frame was cut short or its CRC is wrong
+    PROTO_BAD_REQUEST = -101, // Unknown type, or a payload that makes no sense
+    PROTO_NO_TRANSFER = -102, // PROTO_DATA or PROTO_NEXT without a file open
+    PROTO_BAD_OFFSET = -103,  // PROTO_DATA not at the end of what was written
+};
+
+void proto_serve();
+
+#endif // PROTO_H
@@ -1,8 +1,13 @@
 #include "tests.h"
+#include "cli.h"
 #include "filesystem.h"
+#include "fs_async.h"
+#include "lz.h"
+#include <stddef.h>
+#include <string.h>
 
 void run_tests() {
-    for (int i = 0; i < 10; i++) {
+    for (int i = 0; i < FS_MAX_OPEN; i++) {
         fs_close(i);
     }
 
@@ -44,7 +49,60 @@ void run_tests() {
     test35();
     test36();
     test37();
-    for (int i = 0; i < 10; i++) {
+    test38();
+    test39();
+    test40();
+    test41();
+    test42();
+    test43();
+    test44();
+    test45();
+    test46();
+    test47();
+    test48();
+    test49();
+    test50();
+    test51();
+    test52();
+    test53();
+    test54();
+    test55();
+    test56();
+    test57();
+    test58();
+    test59();
+    test60();
+    test61();
+    test62();
+    test63();
+    test64();
+    test65();
+    test66();
+    test67();
+    test68();
+    test69();
+    test70();
+    test71();
+    test72();
+    test73();
+    test74();
+    test75();
+    test76();
+    test77();
+    test78();
+    test79();
+    test80();
+    test81();
+    test82();
+    test83();
+    test84();
+    test85();
+    test86();
+    test87();
+    test88();
+    test89();
+    test90();
+    for (int i = 0; i < FS_MAX_OPEN; i++) {
         fs_close(i);
     }
     fs_wipe();
@@ -75,12 +133,12 @@ void test3() {
     // Test 3: Fill the filesystem with files and try to create a new one
     printf(
         "Test 3: Fill the filesystem with files and try to create a new one\n");
-    for (int i = 0; i < 25; i++) {
-        char filename[6];
+    for (int i = 0; i <= FS_MAX_FILES; i++) {
+        char filename[16];
         sprintf(filename, "file%d", i);
         fs_create(filename);
     }
-    if (fs_create("file26") == FILE_TABLE_FULL) {
+    if (fs_create("full") == FILE_TABLE_FULL) {
         printf("Test 3: Passed\n");
     } else {
         printf("Test 3: Failed\n");
@@ -274,17 +332,17 @@ void test21() {
     // Test 21: fill the filesystem with files and try to open a new one
     printf(
         "Test 21: Fill the filesystem with files and try to open a new one\n");
-    for (int i = 0; i < 10; i++) {
-        char filename[6];
+    for (int i = 0; i < FS_MAX_OPEN; i++) {
+        char filename[16];
         sprintf(filename, "file%d", i);
         fs_open(filename, MODE_CREATE);
     }
-    if (fs_open("file26", MODE_CREATE) == OPENED_FILES_FULL) {
+    if (fs_open("full", MODE_CREATE) == OPENED_FILES_FULL) {
         printf("Test 21: Passed\n");
     } else {
         printf("Test 21: Failed\n");
     }
-    for (int i = 0; i < 10; i++) {
+    for (int i = 0; i < FS_MAX_OPEN; i++) {
         fs_close(i);
     }
     fs_wipe();
@@ -548,3 +606,1692 @@ void test37() {
         printf("Test 37: Failed\n");
     }
 }
+void test38() {
+    // Test 38: Write and read back a file spanning several sectors
+    printf("Test 38: Write and read back a file spanning several sectors\n");
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE | MODE_READ);
+    char buffer[100];
+    int passed = 1;
+    for (int i = 0; i < 100; i++) {
+        for (int j = 0; j < 100; j++) {
+            buffer[j] = (char)(i + j);
+        }
+        if (fs_write(fd, buffer, 100) != 100) {
+            passed = 0;
+        }
+    }
+    fs_seek(fd, 0, FS_SEEK_SET);
+    for (int i = 0; i < 100; i++) {
+        char read_buffer[100];
+        if (fs_read(fd, read_buffer, 100) != 100) {
+            passed = 0;
+        }
+        for (int j = 0; j < 100; j++) {
+            if (read_buffer[j] != (char)(i + j)) {
+                passed = 0;
+            }
+        }
+    }
+    if (passed) {
+        printf("Test 38: Passed\n");
+    } else {
+        printf("Test 38: Failed\n");
+    }
+    fs_close(fd);
+    fs_rm("file1");
+}
+void test39() {
+    // Test 39: Overwrite across a sector boundary
+    printf("Test 39: Overwrite across a sector boundary\n");
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE | MODE_READ);
+    char buffer[10] = "testtest";
+    fs_seek(fd, FS_SECTOR_SIZE * 2, FS_SEEK_SET);
+    fs_write(fd, buffer, 8);
+    fs_seek(fd, FS_SECTOR_SIZE - 4, FS_SEEK_SET);
+    fs_write(fd, buffer, 8);
+    char read_buffer[10];
+    fs_seek(fd, FS_SECTOR_SIZE - 6, FS_SEEK_SET);
+    if (fs_read(fd, read_buffer, 10) == 10 &&
+        memcmp(read_buffer, "\0\0testtest", 10) == 0) {
+        printf("Test 39: Passed\n");
+    } else {
+        printf("Test 39: Failed\n");
+    }
+    fs_close(fd);
+    fs_rm("file1");
+}
+
+// Data sectors of the volume, fewer than FS_NUM_SECTORS leaves room for if
+// the flash ends first
+static int data_sectors() {
+    uint32_t sectors = flash_sector_count();
+    if (sectors > FS_NUM_SECTORS) {
+        sectors = FS_NUM_SECTORS;
+    }
+    return (int)sectors - FS_META_SECTORS;
+}
+
+void test40() {
+    fs_wipe();
+    // Test 40: Fill the volume and write again after removing a file
+    printf("Test 40: Fill the volume and write again after removing a file\n");
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE);
+    char buffer[512] = {0};
+    uint32_t written = 0;
+    while (fs_write(fd, buffer, sizeof(buffer)) == sizeof(buffer)) {
+        written += sizeof(buffer);
+    }
+    fs_close(fd);
+    fd = fs_open("file2", MODE_CREATE | MODE_WRITE);
+    int full = fs_write(fd, buffer, 1);
+    fs_rm("file1");
+    if (written == (uint32_t)data_sectors() * FS_SECTOR_SIZE &&
+        full == NO_SPACE && fs_write(fd, buffer, 1) == 1) {
+        printf("Test 40: Passed\n");
+    } else {
+        printf("Test 40: Failed\n");
+    }
+    fs_close(fd);
+    fs_rm("file2");
+}
+void test41() {
+    // Test 41: Append across a sector boundary
+    printf("Test 41: Append across a sector boundary\n");
+    int fd = fs_open("file1", MODE_CREATE | MODE_APPEND | MODE_READ);
+    char buffer[100];
+    int passed = 1;
+    for (int i = 0; i < 50; i++) {
+        for (int j = 0; j < 100; j++) {
+            buffer[j] = (char)(i * 3 + j);
+        }
+        if (fs_write(fd, buffer, 100) != 100) {
+            passed = 0;
+        }
+    }
+    for (int i = 0; i < 50; i++) {
+        if (fs_read(fd, buffer, 100) != 100) {
+            passed = 0;
+        }
+        for (int j = 0; j < 100; j++) {
+            if (buffer[j] != (char)(i * 3 + j)) {
+                passed = 0;
+            }
+        }
+    }
+    if (passed) {
+        printf("Test 41: Passed\n");
+    } else {
+        printf("Test 41: Failed\n");
+    }
+    fs_close(fd);
+    fs_rm("file1");
+}
+void test42() {
+    // Test 42: Writing past the end of a file leaves zeros
+    printf("Test 42: Writing past the end of a file leaves zeros\n");
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE | MODE_READ);
+    char buffer[10] = "test";
+    fs_write(fd, buffer, 4);
+    fs_seek(fd, 10, FS_SEEK_SET);
+    fs_write(fd, buffer, 4);
+    char read_buffer[14];
+    fs_seek(fd, 0, FS_SEEK_SET);
+    if (fs_read(fd, read_buffer, 14) == 14 &&
+        memcmp(read_buffer, "test\0\0\0\0\0\0test", 14) == 0) {
+        printf("Test 42: Passed\n");
+    } else {
+        printf("Test 42: Failed\n");
+    }
+    fs_close(fd);
+    fs_rm("file1");
+}
+
+void test43() {
+    // Test 43: Mapping a file spanning several sectors
+    printf("Test 43: Mapping a file spanning several sectors\n");
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE | MODE_READ);
+    static char buffer[6000];
+    for (int i = 0; i < 6000; i++) {
+        buffer[i] = 'a' + i % 26;
+    }
+    fs_write(fd, buffer, 6000);
+    fs_seek(fd, 100, FS_SEEK_SET);
+    const char *ptr;
+    int len;
+    if (fs_mmap(fd, &ptr, &len) == 0 && len == 5900 &&
+        memcmp(ptr, buffer + 100, 5900) == 0) {
+        printf("Test 43: Passed\n");
+    } else {
+        printf("Test 43: Failed\n");
+    }
+    fs_close(fd);
+    fs_rm("file1");
+}
+
+void test44() {
+    // Test 44: Mapping needs read mode and stops at the end of the file
+    printf("Test 44: Mapping needs read mode and stops at the end of file\n");
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE);
+    fs_write(fd, "test", 4);
+    const char *ptr;
+    int len;
+    int result = fs_mmap(fd, &ptr, &len);
+    fs_close(fd);
+    fd = fs_open("file1", MODE_READ);
+    fs_seek(fd, 0, FS_SEEK_END);
+    if (result == INCORRECT_MODE && fs_mmap(fd, &ptr, &len) == 0 &&
+        len == 0) {
+        printf("Test 44: Passed\n");
+    } else {
+        printf("Test 44: Failed\n");
+    }
+    fs_close(fd);
+    fs_rm("file1");
+}
+
+void test45() {
+    fs_wipe();
+    // Test 45: Looking up files after renames and removals
+    printf("Test 45: Looking up files after renames and removals\n");
+    char filename[16];
+    for (int i = 0; i < FS_MAX_FILES; i++) {
+        sprintf(filename, "file%d", i);
+        fs_create(filename);
+    }
+    for (int i = 0; i < FS_MAX_FILES; i += 2) {
+        sprintf(filename, "file%d", i);
+        fs_rm(filename);
+    }
+    fs_mv("file1", "moved");
+    int passed = fs_open("file1", MODE_READ) == FILE_NOT_FOUND &&
+                 fs_open("file0", MODE_READ) == FILE_NOT_FOUND &&
+                 fs_create("file3") == FILE_ALREADY_EXISTS;
+    int fd = fs_open("moved", MODE_READ);
+    passed = passed && fd >= 0;
+    fs_close(fd);
+    for (int i = 0; i < FS_MAX_FILES / 2; i++) {
+        sprintf(filename, "new%d", i);
+        passed = passed && fs_create(filename) > 0;
+    }
+    if (passed && fs_create("full") == FILE_TABLE_FULL) {
+        printf("Test 45: Passed\n");
+    } else {
+        printf("Test 45: Failed\n");
+    }
+    fs_wipe();
+}
+
+void test46() {
+    // Test 46: Writing after the chain of an open file changes
+    printf("Test 46: Writing after the chain of an open file changes\n");
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE | MODE_READ);
+    static char buffer[6000];
+    memset(buffer, 'a', sizeof(buffer));
+    fs_write(fd, buffer, 6000);
+    char read_buffer[4];
+    fs_seek(fd, 0, FS_SEEK_SET);
+    fs_read(fd, read_buffer, 4);
+    fs_format("file1");
+    int other = fs_open("file2", MODE_CREATE | MODE_WRITE | MODE_READ);
+    fs_write(other, buffer, 6000);
+    fs_seek(fd, 0, FS_SEEK_SET);
+    fs_write(fd, "bbbb", 4);
+    fs_seek(fd, 0, FS_SEEK_SET);
+    fs_seek(other, 0, FS_SEEK_SET);
+    char other_buffer[4];
+    if (fs_read(fd, read_buffer, 4) == 4 &&
+        memcmp(read_buffer, "bbbb", 4) == 0 &&
+        fs_read(other, other_buffer, 4) == 4 &&
+        memcmp(other_buffer, "aaaa", 4) == 0) {
+        printf("Test 46: Passed\n");
+    } else {
+        printf("Test 46: Failed\n");
+    }
+    fs_close(other);
+    fs_close(fd);
+    fs_rm("file1");
+    fs_rm("file2");
+}
+
+void test47() {
+    // Test 47: Reading back buffered writes before and after closing
+    printf("Test 47: Reading back buffered writes before and after closing\n");
+    int fd =
+        fs_open("file1", MODE_CREATE | MODE_WRITE | MODE_READ | MODE_WRITEBACK);
+    fs_write(fd, "hello", 5);
+    fs_seek(fd, 8, FS_SEEK_SET);
+    fs_write(fd, "world", 5);
+    char read_buffer[13];
+    fs_seek(fd, 0, FS_SEEK_SET);
+    int passed = fs_read(fd, read_buffer, 13) == 13 &&
+                 memcmp(read_buffer, "hello\0\0\0world", 13) == 0;
+    fs_close(fd);
+    fd = fs_open("file1", MODE_READ);
+    if (passed && fs_read(fd, read_buffer, 13) == 13 &&
+        memcmp(read_buffer, "hello\0\0\0world", 13) == 0) {
+        printf("Test 47: Passed\n");
+    } else {
+        printf("Test 47: Failed\n");
+    }
+    fs_close(fd);
+    fs_rm("file1");
+}
+
+void test48() {
+    // Test 48: Buffered writes over more sectors than the cache holds
+    printf("Test 48: Buffered writes over more sectors than the cache holds\n");
+    static char buffer[5 * 4096];
+    for (int i = 0; i < 5 * 4096; i++) {
+        buffer[i] = 'a' + i % 26;
+    }
+    int fd = fs_open("file1", MODE_CREATE | MODE_APPEND | MODE_WRITEBACK);
+    for (int i = 0; i < 5 * 4096; i += 100) {
+        fs_write(fd, buffer + i, i + 100 > 5 * 4096 ? 5 * 4096 - i : 100);
+    }
+    fs_close(fd);
+    fd = fs_open("file1", MODE_WRITE | MODE_WRITEBACK);
+    fs_seek(fd, 4000, FS_SEEK_SET);
+    fs_write(fd, "0123456789", 10);
+    fs_seek(fd, 13000, FS_SEEK_SET);
+    fs_write(fd, "0123456789", 10);
+    fs_close(fd);
+    memcpy(buffer + 4000, "0123456789", 10);
+    memcpy(buffer + 13000, "0123456789", 10);
+    static char read_buffer[5 * 4096];
+    fd = fs_open("file1", MODE_READ);
+    if (fs_read(fd, read_buffer, 5 * 4096) == 5 * 4096 &&
+        memcmp(read_buffer, buffer, 5 * 4096) == 0) {
+        printf("Test 48: Passed\n");
+    } else {
+        printf("Test 48: Failed\n");
+    }
+    fs_close(fd);
+    fs_rm("file1");
+}
+
+void test49() {
+    // Test 49: Syncing a file makes its writes visible to copies
+    printf("Test 49: Syncing a file makes its writes visible to copies\n");
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE | MODE_WRITEBACK);
+    fs_write(fd, "test", 4);
+    int passed = fs_sync(fd) == 0 && fs_sync(9) == FILE_NOT_OPEN;
+    fs_write(fd, "more", 4);
+    fs_cp("file1", "file2");
+    fs_rm("file1");
+    fs_close(fd);
+    char read_buffer[8];
+    fd = fs_open("file2", MODE_READ);
+    if (passed && fs_read(fd, read_buffer, 8) == 8 &&
+        memcmp(read_buffer, "testmore", 8) == 0) {
+        printf("Test 49: Passed\n");
+    } else {
+        printf("Test 49: Failed\n");
+    }
+    fs_close(fd);
+    fs_rm("file2");
+}
+
+void test50() {
+    // Test 50: The newest file table is loaded after many updates
+    printf("Test 50: The newest file table is loaded after many updates\n");
+    for (int i = 0; i < 20; i++) {
+        fs_create("file1");
+        fs_rm("file1");
+    }
+    int fd = fs_open("file2", MODE_CREATE | MODE_WRITE);
+    fs_write(fd, "test", 4);
+    fs_close(fd);
+    init_filesystem();
+    fd = fs_open("file2", MODE_READ);
+    char read_buffer[4];
+    if (fs_open("file1", MODE_READ) == FILE_NOT_FOUND &&
+        fs_read(fd, read_buffer, 4) == 4 &&
+        memcmp(read_buffer, "test", 4) == 0) {
+        printf("Test 50: Passed\n");
+    } else {
+        printf("Test 50: Failed\n");
+    }
+    fs_close(fd);
+}
+
+void test51() {
+    // Test 51: Updates after loading the file table are kept
+    printf("Test 51: Updates after loading the file table are kept\n");
+    int passed = 1;
+    for (int i = 0; i < 10; i++) {
+        const char *from = i % 2 == 0 ? "file2" : "file3";
+        const char *to = i % 2 == 0 ? "file3" : "file2";
+        fs_mv(from, to);
+        init_filesystem();
+        int fd = fs_open(to, MODE_READ);
+        passed = passed && fd >= 0 && fs_open(from, MODE_READ) < 0;
+        fs_close(fd);
+    }
+    if (passed) {
+        printf("Test 51: Passed\n");
+    } else {
+        printf("Test 51: Failed\n");
+    }
+    fs_rm("file2");
+}
+
+void test52() {
+    // Test 52: Rewriting a file in a loop spreads the erases
+    printf("Test 52: Rewriting a file in a loop spreads the erases\n");
+    static uint32_t before[FS_NUM_SECTORS];
+    static uint32_t after[FS_NUM_SECTORS];
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE | MODE_READ);
+    fs_write(fd, "test", 4);
+    fs_wear(before);
+    char buffer[4];
+    for (int i = 0; i < 100; i++) {
+        sprintf(buffer, "%03d", i);
+        fs_seek(fd, 0, FS_SEEK_SET);
+        fs_write(fd, buffer, 4);
+    }
+    int sectors = fs_wear(after);
+    uint32_t most = 0;
+    for (int i = FS_META_SECTORS; i < sectors; i++) {
+        if (after[i] - before[i] > most) {
+            most = after[i] - before[i];
+        }
+    }
+    char read_buffer[4];
+    fs_seek(fd, 0, FS_SEEK_SET);
+    if (most <= FS_WEAR_SLACK * 2 && fs_read(fd, read_buffer, 4) == 4 &&
+        memcmp(read_buffer, "099", 4) == 0) {
+        printf("Test 52: Passed\n");
+    } else {
+        printf("Test 52: Failed\n");
+    }
+    fs_close(fd);
+}
+
+void test53() {
+    // Test 53: Moved sectors and erase counts survive restarts
+    printf("Test 53: Moved sectors and erase counts survive restarts\n");
+    static uint32_t before[FS_NUM_SECTORS];
+    static uint32_t after[FS_NUM_SECTORS];
+    fs_create("file2");
+    fs_wear(before);
+    init_filesystem();
+    fs_wear(after);
+    int fd = fs_open("file1", MODE_READ);
+    char read_buffer[4];
+    if (memcmp(before, after, sizeof(before)) == 0 &&
+        fs_read(fd, read_buffer, 4) == 4 &&
+        memcmp(read_buffer, "099", 4) == 0) {
+        printf("Test 53: Passed\n");
+    } else {
+        printf("Test 53: Failed\n");
+    }
+    fs_close(fd);
+    fs_rm("file1");
+    fs_rm("file2");
+}
+
+// Totals of the results passed to count_results
+static int result_count;
+static int result_sum;
+
+static void count_results(int result, void *context) {
+    (void)context;
+    result_count++;
+    result_sum += result;
+}
+
+void test54() {
+    // Test 54: Writing on the flash worker
+    printf("Test 54: Writing on the flash worker\n");
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE | MODE_READ);
+    result_count = 0;
+    result_sum = 0;
+    for (int i = 0; i < 3; i++) {
+        fs_write_async(fd, "abc", 3, count_results, NULL);
+    }
+    fs_flush_async(fd, count_results, NULL);
+    fs_async_wait();
+    char read_buffer[9];
+    fs_seek(fd, 0, FS_SEEK_SET);
+    if (result_count == 4 && result_sum == 9 && fs_async_poll() == 0 &&
+        fs_read(fd, read_buffer, 9) == 9 &&
+        memcmp(read_buffer, "abcabcabc", 9) == 0) {
+        printf("Test 54: Passed\n");
+    } else {
+        printf("Test 54: Failed\n");
+    }
+    fs_close(fd);
+    fs_rm("file1");
+}
+
+void test55() {
+    // Test 55: Errors and a full queue on the flash worker
+    printf("Test 55: Errors and a full queue on the flash worker\n");
+    result_count = 0;
+    result_sum = 0;
+    int queued = 0;
+    while (fs_write_async(9, "abc", 3, count_results, NULL) == 0) {
+        queued++;
+    }
+    fs_async_wait();
+    if (queued == FS_ASYNC_QUEUE && result_count == queued &&
+        result_sum == queued * FILE_NOT_OPEN) {
+        printf("Test 55: Passed\n");
+    } else {
+        printf("Test 55: Failed\n");
+    }
+}
+
+// Total erases of all sectors
+static uint32_t total_erases() {
+    static uint32_t counts[FS_NUM_SECTORS];
+    uint32_t total = 0;
+    int sectors = fs_wear(counts);
+    for (int i = 0; i < sectors; i++) {
+        total += counts[i];
+    }
+    return total;
+}
+
+void test56() {
+    // Test 56: Idle time erases the sectors of a removed file
+    printf("Test 56: Idle time erases the sectors of a removed file\n");
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE);
+    fs_seek(fd, 3 * FS_SECTOR_SIZE - 1, FS_SEEK_SET);
+    fs_write(fd, "x", 1);
+    fs_close(fd);
+    fs_rm("file1");
+    int calls = 0;
+    int waiting = fs_idle();
+    while (waiting > 0 && calls < FS_NUM_SECTORS) {
+        int left = fs_idle();
+        if (left >= waiting) {
+            break;
+        }
+        waiting = left;
+        calls++;
+    }
+    uint32_t erases = total_erases();
+    if (waiting == 0 && fs_idle() == 0 && total_erases() == erases) {
+        printf("Test 56: Passed\n");
+    } else {
+        printf("Test 56: Failed\n");
+    }
+}
+
+void test57() {
+    // Test 57: Rewriting after idle time only programs
+    printf("Test 57: Rewriting after idle time only programs\n");
+    // Leave every free sector holding stale data
+    int fd = fs_open("file2", MODE_CREATE | MODE_WRITE);
+    fs_seek(fd, data_sectors() * FS_SECTOR_SIZE - 1, FS_SEEK_SET);
+    fs_write(fd, "x", 1);
+    fs_close(fd);
+    fs_rm("file2");
+    fd = fs_open("file1", MODE_CREATE | MODE_WRITE | MODE_READ);
+    fs_write(fd, "test", 4);
+    while (fs_idle() > 0) {
+    }
+    uint32_t erases = total_erases();
+    fs_seek(fd, 0, FS_SEEK_SET);
+    fs_write(fd, "best", 4);
+    uint32_t rewrite_erases = total_erases() - erases;
+    fs_close(fd);
+    init_filesystem();
+    fd = fs_open("file1", MODE_READ);
+    char read_buffer[4];
+    if (rewrite_erases == 0 && fs_read(fd, read_buffer, 4) == 4 &&
+        memcmp(read_buffer, "best", 4) == 0) {
+        printf("Test 57: Passed\n");
+    } else {
+        printf("Test 57: Failed\n");
+    }
+    fs_close(fd);
+    fs_rm("file1");
+}
+
+void test58() {
+    // Test 58: Counting the work of a write and a read
+    printf("Test 58: Counting the work of a write and a read\n");
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE | MODE_READ);
+    fs_reset_stats();
+    fs_write(fd, "test", 4);
+    fs_seek(fd, 0, FS_SEEK_SET);
+    char read_buffer[4];
+    fs_read(fd, read_buffer, 4);
+    FsStats stats = fs_get_stats();
+    fs_reset_stats();
+    FsStats reset = fs_get_stats();
+    FsStats zero;
+    memset(&zero, 0, sizeof(zero));
+    if (stats.bytes_written == 4 && stats.bytes_read == 4 &&
+        stats.table_updates == 1 && stats.flash.programs >= 2 &&
+        stats.flash.bytes_programmed >= 4 && stats.cache_misses == 0 &&
+        memcmp(&reset, &zero, sizeof(zero)) == 0) {
+        printf("Test 58: Passed\n");
+    } else {
+        printf("Test 58: Failed\n");
+    }
+    fs_close(fd);
+    fs_rm("file1");
+}
+
+void test59() {
+    // Test 59: Counting write-back cache hits and misses
+    printf("Test 59: Counting write-back cache hits and misses\n");
+    int fd =
+        fs_open("file1", MODE_CREATE | MODE_WRITE | MODE_READ | MODE_WRITEBACK);
+    fs_reset_stats();
+    fs_write(fd, "te", 2);
+    fs_write(fd, "st", 2);
+    fs_seek(fd, 0, FS_SEEK_SET);
+    char read_buffer[4];
+    fs_read(fd, read_buffer, 4);
+    FsStats stats = fs_get_stats();
+    if (stats.cache_misses == 1 && stats.cache_hits == 2 &&
+        stats.flash.programs == 0 && stats.table_updates == 0) {
+        printf("Test 59: Passed\n");
+    } else {
+        printf("Test 59: Failed\n");
+    }
+    fs_close(fd);
+    fs_rm("file1");
+}
+
+void test60() {
+    // Test 60: Percentiles of a latency histogram
+    printf("Test 60: Percentiles of a latency histogram\n");
+    Histogram hist;
+    memset(&hist, 0, sizeof(hist));
+    uint64_t empty = hist_percentile(&hist, 50);
+    for (int i = 1; i <= 100; i++) {
+        hist_add(&hist, i);
+    }
+    hist_add(&hist, (uint64_t)1 << 40);
+    if (empty == 0 && hist.samples == 101 && hist_percentile(&hist, 50) == 63 &&
+        hist_percentile(&hist, 99) == 127 &&
+        hist_percentile(&hist, 100) == (uint64_t)1 << 40 &&
+        hist.counts[HIST_BUCKETS - 1] == 1) {
+        printf("Test 60: Passed\n");
+    } else {
+        printf("Test 60: Failed\n");
+    }
+}
+
+void test61() {
+    // Test 61: Timing every call of the timed operations
+    printf("Test 61: Timing every call of the timed operations\n");
+    fs_reset_stats();
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE | MODE_READ);
+    fs_write(fd, "test", 4);
+    fs_seek(fd, 0, FS_SEEK_SET);
+    char read_buffer[4];
+    fs_read(fd, read_buffer, 4);
+    fs_close(fd);
+    fs_cp("file1", "file2");
+    fs_mv("file2", "file3");
+    fs_rm("file3");
+    fs_rm("file1");
+    FsStats stats = fs_get_stats();
+    int counted = 1;
+    for (int i = 0; i < FS_OPS; i++) {
+        uint32_t expected = i == FS_OP_RM ? 2 : 1;
+        counted = counted && stats.latency[i].samples == expected;
+    }
+    if (counted && stats.flash.irq_off.samples > 0 &&
+        hist_percentile(&stats.flash.irq_off, 99) <=
+            stats.flash.irq_off.max_us) {
+        printf("Test 61: Passed\n");
+    } else {
+        printf("Test 61: Failed\n");
+    }
+}
+
+void test62() {
+    // Test 62: Files with the same name in different directories
+    printf("Test 62: Files with the same name in different directories\n");
+    fs_mkdir("dir1");
+    fs_mkdir("dir2");
+    fs_mkdir("dir1/sub");
+    int fd = fs_open("dir1/sub/file1", MODE_CREATE | MODE_WRITE);
+    fs_write(fd, "one", 3);
+    fs_close(fd);
+    fd = fs_open("/dir2/file1", MODE_CREATE | MODE_WRITE);
+    fs_write(fd, "two", 3);
+    fs_close(fd);
+    char read_buffer[3];
+    fd = fs_open("/dir1/sub/file1", MODE_READ);
+    int first = fs_read(fd, read_buffer, 3) == 3 &&
+                memcmp(read_buffer, "one", 3) == 0;
+    fs_close(fd);
+    fd = fs_open("dir2/file1", MODE_READ);
+    int second = fs_read(fd, read_buffer, 3) == 3 &&
+                 memcmp(read_buffer, "two", 3) == 0;
+    fs_close(fd);
+    if (first && second && fs_open("dir1", MODE_READ) == IS_A_DIRECTORY &&
+        fs_open("dir2/file1/x", MODE_READ) == NOT_A_DIRECTORY &&
+        fs_create("dir3/file1") == FILE_NOT_FOUND &&
+        fs_mkdir("dir1/sub") == FILE_ALREADY_EXISTS &&
+        fs_mkdir("dir1/") == INVALID_PATH && fs_rm("dir2") == IS_A_DIRECTORY &&
+        fs_ls() == 2) {
+        printf("Test 62: Passed\n");
+    } else {
+        printf("Test 62: Failed\n");
+    }
+}
+
+void test63() {
+    // Test 63: Moving and removing directories
+    printf("Test 63: Moving and removing directories\n");
+    int in_itself = fs_mv("dir1", "dir1/sub/dir1");
+    int moved = fs_mv("dir1/sub", "dir2/sub");
+    int not_empty = fs_rmdir("dir2");
+    init_filesystem();
+    int fd = fs_open("dir2/sub/file1", MODE_READ);
+    char read_buffer[3];
+    int kept = fs_read(fd, read_buffer, 3) == 3 &&
+               memcmp(read_buffer, "one", 3) == 0;
+    fs_close(fd);
+    int renamed = fs_mv("dir2/sub/file1", "dir1/file3");
+    fs_rm("dir2/file1");
+    if (in_itself == INVALID_PATH && moved == 0 && kept && renamed == 0 &&
+        not_empty == DIRECTORY_NOT_EMPTY &&
+        fs_rmdir("dir1/file3") == NOT_A_DIRECTORY &&
+        fs_open("dir1/sub/file1", MODE_READ) == FILE_NOT_FOUND &&
+        fs_rmdir("dir2/sub") == 0 && fs_rmdir("dir2") == 0 &&
+        fs_rm("dir1/file3") == 0 && fs_rmdir("dir1") == 0 && fs_ls() == 0) {
+        printf("Test 63: Passed\n");
+    } else {
+        printf("Test 63: Failed\n");
+    }
+}
+
+void test64() {
+    // Test 64: Filling the file table and loading it back
+    printf("Test 64: Filling the file table and loading it back\n");
+    char filename[16];
+    fs_mkdir("dir");
+    for (int i = 0; i < FS_MAX_FILES - 1; i++) {
+        sprintf(filename, "dir/f%d", i);
+        fs_create(filename);
+    }
+    int full = fs_create("f") == FILE_TABLE_FULL;
+    init_filesystem();
+    sprintf(filename, "dir/f%d", FS_MAX_FILES - 2);
+    int fd = fs_open(filename, MODE_READ);
+    int found = fd >= 0;
+    fs_close(fd);
+    int listed = fs_ls() == FS_MAX_FILES - 1;
+    int not_empty = fs_rmdir("dir") == DIRECTORY_NOT_EMPTY;
+    fs_mv("dir/f0", "f0");
+    for (int i = 1; i < FS_MAX_FILES - 1; i++) {
+        sprintf(filename, "dir/f%d", i);
+        fs_rm(filename);
+    }
+    if (full && found && listed && not_empty && fs_rmdir("dir") == 0 &&
+        fs_rm("f0") == 0 && fs_ls() == 0) {
+        printf("Test 64: Passed\n");
+    } else {
+        printf("Test 64: Failed\n");
+    }
+}
+
+void test65() {
+    // Test 65: Writing and reading several buffers in one call
+    printf("Test 65: Writing and reading several buffers in one call\n");
+    static char data[5010];
+    static char back[5010];
+    for (int i = 0; i < (int)sizeof(data); i++) {
+        data[i] = 'a' + i % 26;
+    }
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE | MODE_READ);
+    fs_write(fd, data, 10);
+    fs_seek(fd, 0, FS_SEEK_SET);
+    fs_reset_stats();
+    FsIoVec out[3] = {{data, 3000}, {data + 3000, 2000}, {data + 5000, 10}};
+    int written = fs_writev(fd, out, 3);
+    FsStats stats = fs_get_stats();
+    fs_seek(fd, 0, FS_SEEK_SET);
+    FsIoVec in[4] = {
+        {back, 1}, {back + 1, 0}, {back + 1, 4999}, {back + 5000, 10}};
+    int read = fs_readv(fd, in, 4);
+    if (written == 5010 && read == 5010 &&
+        memcmp(data, back, sizeof(data)) == 0 && stats.table_updates == 1 &&
+        stats.bytes_written == 5010 &&
+        stats.latency[FS_OP_WRITE].samples == 1) {
+        printf("Test 65: Passed\n");
+    } else {
+        printf("Test 65: Failed\n");
+    }
+    fs_close(fd);
+    fs_rm("file1");
+}
+
+void test66() {
+    // Test 66: Vectored calls with bad buffers and at end of file
+    printf("Test 66: Vectored calls with bad buffers and at end of file\n");
+    char read_buffer[8] = {0};
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE | MODE_READ);
+    FsIoVec bad[2] = {{"test", 4}, {"data", -1}};
+    int overflow = fs_writev(fd, bad, 2);
+    FsIoVec out[2] = {{"te", 2}, {"st", 2}};
+    int written = fs_writev(fd, out, 2);
+    fs_seek(fd, 1, FS_SEEK_SET);
+    FsIoVec in[2] = {{read_buffer, 2}, {read_buffer + 2, 6}};
+    int read = fs_readv(fd, in, 2);
+    int at_end = fs_readv(fd, in, 2);
+    fs_close(fd);
+    if (overflow == OVERFLOW && written == 4 && read == 3 &&
+        memcmp(read_buffer, "est", 4) == 0 && at_end == 0 &&
+        fs_writev(fd, out, 2) == FILE_NOT_OPEN &&
+        fs_readv(fd, in, 2) == FILE_NOT_OPEN) {
+        printf("Test 66: Passed\n");
+    } else {
+        printf("Test 66: Failed\n");
+    }
+    fs_rm("file1");
+}
+
+// Whether a file filling the given number of sectors can be written
+static int sectors_free(int sectors) {
+    int fd = fs_open("full", MODE_CREATE | MODE_WRITE);
+    fs_seek(fd, sectors * FS_SECTOR_SIZE - 1, FS_SEEK_SET);
+    int written = fs_write(fd, "x", 1);
+    fs_close(fd);
+    fs_rm("full");
+    return written == 1;
+}
+
+// Whether a file filling every data sector can be written
+static int volume_is_free() {
+    return sectors_free(data_sectors());
+}
+
+// Whether a file holds exactly the expected data
+static int file_matches(const char *path, const char *expected, int size) {
+    static char read_buffer[2 * FS_SECTOR_SIZE];
+    int fd = fs_open(path, MODE_READ);
+    int read = fs_read(fd, read_buffer, sizeof(read_buffer));
+    fs_close(fd);
+    return read == size && memcmp(read_buffer, expected, size) == 0;
+}
+
+void test67() {
+    // Test 67: Copying a file shares its sectors until either side changes
+    printf("Test 67: Copying a file shares sectors until either changes\n");
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE);
+    fs_seek(fd, (data_sectors() - 1) * FS_SECTOR_SIZE - 1, FS_SEEK_SET);
+    fs_write(fd, "x", 1);
+    fs_close(fd);
+    fs_reset_stats();
+    int copied = fs_cp("file1", "file2") == 0;
+    FsStats stats = fs_get_stats();
+    fd = fs_open("file2", MODE_WRITE);
+    int moved = fs_write(fd, "b", 1) == 1;
+    fs_seek(fd, FS_SECTOR_SIZE, FS_SEEK_SET);
+    int full = fs_write(fd, "b", 1) == NO_SPACE;
+    fs_close(fd);
+    init_filesystem();
+    fs_rm("file1");
+    fd = fs_open("file2", MODE_WRITE | MODE_READ);
+    fs_seek(fd, FS_SECTOR_SIZE, FS_SEEK_SET);
+    int unshared = fs_write(fd, "c", 1) == 1;
+    char read_buffer[4] = {0};
+    fs_seek(fd, 0, FS_SEEK_SET);
+    fs_read(fd, read_buffer, 2);
+    fs_seek(fd, FS_SECTOR_SIZE, FS_SEEK_SET);
+    fs_read(fd, read_buffer + 2, 1);
+    fs_seek(fd, 1, FS_SEEK_END);
+    fs_read(fd, read_buffer + 3, 1);
+    fs_close(fd);
+    fs_rm("file2");
+    // Only copies of the file table are written by the copy
+    if (copied &&
+        stats.flash.bytes_programmed <
+            stats.table_updates *
+                (sizeof(MetaHeader) + sizeof(FileTable) + FS_PAGE_SIZE) &&
+        moved && full && unshared && memcmp(read_buffer, "b\0cx", 4) == 0 &&
+        volume_is_free()) {
+        printf("Test 67: Passed\n");
+    } else {
+        printf("Test 67: Failed\n");
+    }
+}
+
+void test68() {
+    // Test 68: Writing each of three files sharing the same sectors
+    printf("Test 68: Writing each of three files sharing the same sectors\n");
+    static char data[5001];
+    static char expected[5001];
+    for (int i = 0; i < (int)sizeof(data); i++) {
+        data[i] = 'a' + i % 26;
+    }
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE);
+    fs_write(fd, data, 5000);
+    fs_close(fd);
+    fs_cp("file1", "file2");
+    fs_cp("file2", "file3");
+    fd = fs_open("file1", MODE_WRITE);
+    fs_seek(fd, FS_SECTOR_SIZE, FS_SEEK_SET);
+    fs_write(fd, "X", 1);
+    fs_close(fd);
+    fd = fs_open("file2", MODE_APPEND);
+    fs_write(fd, "Y", 1);
+    fs_close(fd);
+    fd = fs_open("file3", MODE_WRITE | MODE_WRITEBACK);
+    fs_write(fd, "Z", 1);
+    fs_close(fd);
+    init_filesystem();
+    memcpy(expected, data, 5000);
+    expected[FS_SECTOR_SIZE] = 'X';
+    int first = file_matches("file1", expected, 5000);
+    memcpy(expected, data, 5000);
+    expected[5000] = 'Y';
+    int second = file_matches("file2", expected, 5001);
+    expected[0] = 'Z';
+    int third = file_matches("file3", expected, 5000);
+    fs_rm("file1");
+    fs_rm("file2");
+    fs_rm("file3");
+    if (first && second && third && volume_is_free()) {
+        printf("Test 68: Passed\n");
+    } else {
+        printf("Test 68: Failed\n");
+    }
+}
+
+void test69() {
+    // Test 69: Moving a file over another in one table update
+    printf("Test 69: Moving a file over another in one table update\n");
+    static char data[5000];
+    memset(data, 'o', sizeof(data));
+    int fd = fs_open("cfg", MODE_CREATE | MODE_WRITE);
+    fs_write(fd, data, sizeof(data));
+    fs_close(fd);
+    fd = fs_open("cfg.tmp", MODE_CREATE | MODE_WRITE);
+    fs_write(fd, "new", 3);
+    fs_close(fd);
+    fs_reset_stats();
+    int moved = fs_mv("cfg.tmp", "cfg") == 0;
+    FsStats stats = fs_get_stats();
+    init_filesystem();
+    int gone = fs_open("cfg.tmp", MODE_READ) == FILE_NOT_FOUND;
+    int replaced = file_matches("cfg", "new", 3);
+    fs_rm("cfg");
+    if (moved && stats.table_updates == 1 &&
+        stats.flash.bytes_programmed <
+            sizeof(MetaHeader) + sizeof(FileTable) + FS_PAGE_SIZE &&
+        stats.latency[FS_OP_CP].samples == 0 &&
+        stats.latency[FS_OP_RM].samples == 0 && gone && replaced &&
+        volume_is_free()) {
+        printf("Test 69: Passed\n");
+    } else {
+        printf("Test 69: Failed\n");
+    }
+}
+
+void test70() {
+    // Test 70: Moving a shared file over a file that is open
+    printf("Test 70: Moving a shared file over a file that is open\n");
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE);
+    fs_write(fd, "test", 4);
+    fs_close(fd);
+    fs_cp("file1", "file2");
+    fd = fs_open("file3", MODE_CREATE | MODE_WRITE);
+    fs_write(fd, "old data", 8);
+    fs_close(fd);
+    fd = fs_open("file3", MODE_READ);
+    int moved = fs_mv("file1", "file3") == 0;
+    char read_buffer[8] = {0};
+    int read = fs_read(fd, read_buffer, sizeof(read_buffer));
+    fs_close(fd);
+    fs_rm("file2");
+    int kept = file_matches("file3", "test", 4);
+    fs_rm("file3");
+    if (moved && read == 4 && memcmp(read_buffer, "test", 4) == 0 && kept &&
+        volume_is_free()) {
+        printf("Test 70: Passed\n");
+    } else {
+        printf("Test 70: Failed\n");
+    }
+}
+
+// Fills a buffer with lines of JSON, which compress well
+static void fill_json(char *buffer, int size) {
+    char line[64];
+    int length = 0;
+    for (int i = 0; length < size; i++) {
+        int n = sprintf(line, "{\"id\": %d, \"name\": \"sensor\"}\n", i);
+        memcpy(buffer + length, line, n < size - length ? n : size - length);
+        length += n;
+    }
+}
+
+void test71() {
+    // Test 71: Compressing a file and seeking in it
+    printf("Test 71: Compressing a file and seeking in it\n");
+    static char data[10000];
+    static char read_buffer[200];
+    fill_json(data, sizeof(data));
+    int fd = fs_open("log", MODE_CREATE | MODE_WRITE | MODE_COMPRESS);
+    int written = fs_write(fd, data, sizeof(data));
+    fs_close(fd);
+    init_filesystem();
+    fd = fs_open("log", MODE_READ);
+    fs_seek(fd, 5000, FS_SEEK_SET);
+    int middle = fs_read(fd, read_buffer, 100) == 100 &&
+                 memcmp(read_buffer, data + 5000, 100) == 0;
+    fs_seek(fd, 4000, FS_SEEK_SET);
+    FsIoVec in[2] = {{read_buffer, 50}, {read_buffer + 50, 150}};
+    int across = fs_readv(fd, in, 2) == 200 &&
+                 memcmp(read_buffer, data + 4000, 200) == 0;
+    fs_seek(fd, 10, FS_SEEK_END);
+    int tail = fs_read(fd, read_buffer, 100) == 10 &&
+               memcmp(read_buffer, data + 9990, 10) == 0;
+    const char *ptr;
+    int len;
+    int unmapped = fs_mmap(fd, &ptr, &len) == INCORRECT_MODE;
+    fs_close(fd);
+    // The 10000 bytes take a single sector
+    int small = sectors_free(data_sectors() - 1);
+    fs_rm("log");
+
+    // Data that does not compress round trips, and is stored as it is
+    static uint8_t noise[FS_BLOCK_SIZE];
+    static uint8_t packed[LZ_BOUND(FS_BLOCK_SIZE)];
+    uint32_t seed = 1;
+    for (int i = 0; i < FS_BLOCK_SIZE; i++) {
+        seed = seed * 1103515245 + 12345;
+        noise[i] = seed >> 16;
+    }
+    int length = lz_compress(noise, FS_BLOCK_SIZE, packed, sizeof(packed));
+    int raw = lz_decompress(packed, length, (uint8_t *)data, sizeof(data)) ==
+                  FS_BLOCK_SIZE &&
+              memcmp(data, noise, FS_BLOCK_SIZE) == 0 &&
+              lz_compress(noise, FS_BLOCK_SIZE, packed, FS_BLOCK_SIZE - 1) < 0;
+    if (written == 10000 && middle && across && tail && unmapped && small &&
+        raw) {
+        printf("Test 71: Passed\n");
+    } else {
+        printf("Test 71: Failed\n");
+    }
+}
+
+void test72() {
+    // Test 72: Appending to and rewriting the end of a compressed file
+    printf("Test 72: Appending to and rewriting a compressed file\n");
+    static char expected[7000];
+    fill_json(expected, 6000);
+    int fd = fs_open("log", MODE_CREATE | MODE_APPEND | MODE_COMPRESS);
+    for (int i = 0; i < 6000; i += 40) {
+        fs_write(fd, expected + i, 40);
+    }
+    fs_close(fd);
+    fd = fs_open("log", MODE_WRITE | MODE_READ);
+    int early = fs_write(fd, "x", 1) == INVALID_POSITION;
+    fs_seek(fd, 5000, FS_SEEK_SET);
+    fs_write(fd, "XYZ", 3);
+    memcpy(expected + 5000, "XYZ", 3);
+    fs_seek(fd, 6500, FS_SEEK_SET);
+    fs_write(fd, "end", 3);
+    memset(expected + 6000, 0, 500);
+    memcpy(expected + 6500, "end", 3);
+    fs_close(fd);
+    fd = fs_open("log", MODE_APPEND | MODE_WRITEBACK);
+    fs_write(fd, "wb", 2);
+    memcpy(expected + 6503, "wb", 2);
+    fs_close(fd);
+    fs_cp("log", "log2");
+    init_filesystem();
+    int first = file_matches("log", expected, 6505);
+    int second = file_matches("log2", expected, 6505);
+    fs_rm("log");
+    fs_rm("log2");
+    if (early && first && second && volume_is_free()) {
+        printf("Test 72: Passed\n");
+    } else {
+        printf("Test 72: Failed\n");
+    }
+}
+
+// Sector of flash holding an offset of a file
+static uint16_t sector_of(const char *path, int offset) {
+    const char *ptr;
+    int len;
+    int fd = fs_open(path, MODE_READ);
+    fs_seek(fd, offset, FS_SEEK_SET);
+    fs_mmap(fd, &ptr, &len);
+    fs_close(fd);
+    return ((const uint8_t *)ptr - flash_xip_address(0)) / FS_SECTOR_SIZE;
+}
+
+void test73() {
+    // Test 73: Verified reads and scrubbing find a corrupted sector
+    printf("Test 73: Verified reads and scrubbing find corrupted data\n");
+    char buffer[16];
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE);
+    fs_write(fd, "123456789", 9);
+    fs_seek(fd, FS_SECTOR_SIZE, FS_SEEK_SET);
+    fs_write(fd, "second", 6);
+    fs_close(fd);
+    uint16_t sector = sector_of("file1", 0);
+    // The sniffer computes the usual CRC32
+    int standard = flash_crc32(sector, 0, 9) == 0xCBF43926;
+    init_filesystem();
+    fd = fs_open("file1", MODE_READ | MODE_VERIFY);
+    int clean = fs_read(fd, buffer, 9) == 9 && fs_scrub(FS_NUM_SECTORS) == 0;
+    fs_close(fd);
+
+    // Clear the bits of a byte, as a worn out cell would
+    uint8_t zero = 0;
+    flash_program_safe(sector, 4, &zero, 1);
+    fs_reset_stats();
+    int scrubbed = fs_scrub(FS_NUM_SECTORS) == 1;
+    fd = fs_open("file1", MODE_READ | MODE_VERIFY);
+    int caught = fs_read(fd, buffer, 9) == DATA_CORRUPT;
+    const char *ptr;
+    int len;
+    int unmapped = fs_mmap(fd, &ptr, &len) == DATA_CORRUPT;
+    fs_seek(fd, FS_SECTOR_SIZE, FS_SEEK_SET);
+    int other = fs_read(fd, buffer, 6) == 6 &&
+                memcmp(buffer, "second", 6) == 0;
+    fs_close(fd);
+    fd = fs_open("file1", MODE_READ);
+    int unchecked = fs_read(fd, buffer, 9) == 9 &&
+                    memcmp(buffer, "1234\0" "6789", 9) == 0;
+    fs_close(fd);
+    FsStats stats = fs_get_stats();
+    fs_rm("file1");
+    if (standard && clean && scrubbed && caught && unmapped && other &&
+        unchecked && stats.corrupt_sectors == 3) {
+        printf("Test 73: Passed\n");
+    } else {
+        printf("Test 73: Failed\n");
+    }
+}
+
+void test74() {
+    // Test 74: Sectors are checked once, and only up to the end of the file
+    printf("Test 74: Sector checks are lazy and stop at the end of file\n");
+    char buffer[8];
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE);
+    fs_write(fd, "abc", 3);
+    fs_close(fd);
+    // Program bytes past the end, as an append cut short by a power loss would
+    uint16_t sector = sector_of("file1", 0);
+    flash_program_safe(sector, 3, (const uint8_t *)"def", 3);
+    init_filesystem();
+    fs_reset_stats();
+    fd = fs_open("file1", MODE_READ | MODE_VERIFY);
+    int first = fs_read(fd, buffer, sizeof(buffer)) == 3;
+    fs_seek(fd, 0, FS_SEEK_SET);
+    int again = fs_read(fd, buffer, sizeof(buffer)) == 3;
+    fs_close(fd);
+    FsStats stats = fs_get_stats();
+    int lazy = first && again && stats.sectors_verified == 1 &&
+               stats.corrupt_sectors == 0;
+
+    // A sector whose data is still only in the cache is passed over, and
+    // scrubbing carries on one sector at a time
+    fd = fs_open("file2", MODE_CREATE | MODE_WRITE | MODE_WRITEBACK);
+    fs_write(fd, "pending", 7);
+    fs_reset_stats();
+    int skipped = fs_scrub(FS_NUM_SECTORS) == 0 &&
+                  fs_get_stats().sectors_verified == 1;
+    fs_close(fd);
+    int stepped = fs_scrub(1) == 0 && fs_scrub(1) == 0 &&
+                  fs_get_stats().sectors_verified == 3;
+    fs_rm("file1");
+    fs_rm("file2");
+    if (lazy && skipped && stepped) {
+        printf("Test 74: Passed\n");
+    } else {
+        printf("Test 74: Failed\n");
+    }
+}
+
+void test75() {
+    // Test 75: The free space reported follows files being written and removed
+    printf("Test 75: Free space follows files being written and removed\n");
+    while (fs_idle() > 0) {
+    }
+    FsSpace before = fs_df();
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE);
+    fs_seek(fd, 2 * FS_SECTOR_SIZE, FS_SEEK_SET);
+    fs_write(fd, "x", 1);
+    fs_close(fd);
+    // A copy shares the sectors, so it takes an entry but no space
+    fs_cp("file1", "file2");
+    FsSpace during = fs_df();
+    fs_rm("file1");
+    fs_rm("file2");
+    FsSpace after = fs_df();
+    while (fs_idle() > 0) {
+    }
+    FsSpace idle = fs_df();
+    if (before.sectors == (uint32_t)data_sectors() &&
+        before.free_sectors == before.sectors &&
+        before.erased_sectors == before.sectors &&
+        during.free_sectors == before.sectors - 3 &&
+        during.erased_sectors == before.sectors - 3 &&
+        during.free_entries == before.free_entries - 2 &&
+        after.free_sectors == before.sectors &&
+        after.erased_sectors == before.sectors - 3 &&
+        after.free_entries == before.free_entries &&
+        idle.erased_sectors == before.sectors) {
+        printf("Test 75: Passed\n");
+    } else {
+        printf("Test 75: Failed\n");
+    }
+}
+
+void test76() {
+    // Test 76: The free space is rebuilt when the filesystem is initialized
+    printf("Test 76: Free space is rebuilt when the filesystem starts\n");
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE);
+    fs_seek(fd, (data_sectors() - 1) * FS_SECTOR_SIZE, FS_SEEK_SET);
+    fs_write(fd, "x", 1);
+    fs_close(fd);
+    FsSpace full = fs_df();
+    fd = fs_open("file2", MODE_CREATE | MODE_WRITE);
+    int refused = fs_write(fd, "x", 1) == NO_SPACE;
+    fs_close(fd);
+    fs_rm("file2");
+    init_filesystem();
+    FsSpace mounted = fs_df();
+    fs_rm("file1");
+    init_filesystem();
+    FsSpace empty = fs_df();
+    if (full.free_sectors == 0 && full.erased_sectors == 0 && refused &&
+        mounted.free_sectors == 0 &&
+        mounted.free_entries == full.free_entries &&
+        empty.free_sectors == (uint32_t)data_sectors() &&
+        empty.erased_sectors == 0 && volume_is_free()) {
+        printf("Test 76: Passed\n");
+    } else {
+        printf("Test 76: Failed\n");
+    }
+}
+
+void test77() {
+    // Test 77: The volume starts after the firmware image and runs to the end
+    // of flash, or as far as the capacity goes
+    printf("Test 77: The volume takes the flash after the firmware\n");
+    uint32_t start = flash_xip_address(0) - (const uint8_t *)XIP_BASE;
+    uint32_t sectors = flash_sector_count();
+    static uint32_t counts[FS_NUM_SECTORS];
+    int volume = fs_wear(counts);
+    if (start % FS_SECTOR_SIZE == 0 &&
+        start + sectors * FS_SECTOR_SIZE == PICO_FLASH_SIZE_BYTES &&
+        volume == (int)(sectors < FS_NUM_SECTORS ? sectors : FS_NUM_SECTORS) &&
+        fs_df().sectors == (uint32_t)data_sectors()) {
+        printf("Test 77: Passed\n");
+    } else {
+        printf("Test 77: Failed\n");
+    }
+}
+
+void test78() {
+    // Test 78: Files can take every data sector of the volume but no more
+    printf("Test 78: Files take every sector of the volume but no more\n");
+    int fits = sectors_free(data_sectors());
+    int refused = !sectors_free(data_sectors() + 1);
+    int clean = fs_scrub(FS_NUM_SECTORS) == 0;
+    if (fits && refused && clean && volume_is_free()) {
+        printf("Test 78: Passed\n");
+    } else {
+        printf("Test 78: Failed\n");
+    }
+}
+
+void test79() {
+    // Test 79: Wiping erases every data sector once, each 64 KB block wholly
+    // in the volume with a single erase
+    printf("Test 79: Wiping erases the volume a block at a time\n");
+    static uint32_t before[FS_NUM_SECTORS];
+    static uint32_t after[FS_NUM_SECTORS];
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE);
+    fs_write(fd, "data", 4);
+    fs_close(fd);
+    int sectors = fs_wear(before);
+    fs_reset_stats();
+    fs_wipe();
+    FsStats stats = fs_get_stats();
+    fs_wear(after);
+
+    // Count the blocks between the first data sector and the end
+    uint32_t block = 16 * FS_SECTOR_SIZE;
+    uint32_t start = flash_xip_address(FS_META_SECTORS) -
+                     (const uint8_t *)XIP_BASE;
+    uint32_t end = start + data_sectors() * FS_SECTOR_SIZE;
+    uint32_t first = (start + block - 1) / block * block;
+    uint32_t blocks = end > first ? (end - first) / block : 0;
+
+    int once = 1;
+    uint32_t erases = 0;
+    for (int i = 0; i < sectors; i++) {
+        erases += after[i] - before[i];
+        if (i >= FS_META_SECTORS && after[i] != before[i] + 1) {
+            once = 0;
+        }
+    }
+    if (once && stats.flash.erases == erases &&
+        stats.flash.block_erases == blocks &&
+        fs_open("file1", MODE_READ) == FILE_NOT_FOUND &&
+        fs_df().erased_sectors == (uint32_t)data_sectors()) {
+        printf("Test 79: Passed\n");
+    } else {
+        printf("Test 79: Failed\n");
+    }
+}
+
+void test80() {
+    // Test 80: A lazy wipe erases nothing, and leaves the sectors the files
+    // used to fs_idle
+    printf("Test 80: A lazy wipe leaves the erases to fs_idle\n");
+    static char data[FS_SECTOR_SIZE];
+    static uint32_t before[FS_NUM_SECTORS];
+    static uint32_t after[FS_NUM_SECTORS];
+    memset(data, 'a', sizeof(data));
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE);
+    for (int i = 0; i < 3; i++) {
+        fs_write(fd, data, sizeof(data));
+    }
+    fs_close(fd);
+    int sectors = fs_wear(before);
+    fs_reset_stats();
+    fs_wipe_lazy();
+    FsStats stats = fs_get_stats();
+    FsSpace wiped = fs_df();
+    fs_wear(after);
+    int untouched = 1;
+    for (int i = FS_META_SECTORS; i < sectors; i++) {
+        untouched = untouched && after[i] == before[i];
+    }
+    int gone = fs_open("file1", MODE_READ) == FILE_NOT_FOUND;
+
+    // The stale sectors are found again after a restart
+    init_filesystem();
+    FsSpace mounted = fs_df();
+    fd = fs_open("file2", MODE_CREATE | MODE_WRITE | MODE_READ);
+    fs_write(fd, "new", 3);
+    fs_seek(fd, 0, FS_SEEK_SET);
+    char buffer[8];
+    int reread = fs_read(fd, buffer, sizeof(buffer)) == 3 &&
+                 memcmp(buffer, "new", 3) == 0;
+    fs_close(fd);
+    fs_rm("file2");
+    while (fs_idle() > 0) {
+    }
+    FsSpace idle = fs_df();
+    if (untouched && stats.table_updates == 1 && gone &&
+        wiped.free_sectors == wiped.sectors &&
+        wiped.erased_sectors == wiped.sectors - 3 &&
+        mounted.erased_sectors == wiped.erased_sectors && reread &&
+        idle.erased_sectors == idle.sectors) {
+        printf("Test 80: Passed\n");
+    } else {
+        printf("Test 80: Failed\n");
+    }
+}
+
+// Keeps the result of a request in the int its context points to
+static void store_result(int result, void *context) {
+    *(int *)context = result;
+}
+
+void test81() {
+    // Test 81: Writes of a batch to one file are merged into a single update
+    // of the file table
+    printf("Test 81: A batch of writes updates the file table once\n");
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE | MODE_READ);
+    int results[5] = {0};
+    FsAsyncOp ops[5];
+    const char *parts[4] = {"ab", "cde", "f", "ghij"};
+    for (int i = 0; i < 4; i++) {
+        ops[i] = (FsAsyncOp){fd, parts[i], strlen(parts[i]),
+                             FS_ASYNC_WRITE_DEADLINE, store_result,
+                             &results[i]};
+    }
+    ops[4] = (FsAsyncOp){fd, NULL, 0, FS_ASYNC_SYNC_DEADLINE, store_result,
+                         &results[4]};
+    fs_reset_stats();
+    int queued = fs_async_batch(ops, 5);
+    fs_async_wait();
+    FsStats stats = fs_get_stats();
+    char read_buffer[10];
+    fs_seek(fd, 0, FS_SEEK_SET);
+    if (queued == 0 && results[0] == 2 && results[1] == 3 &&
+        results[2] == 1 && results[3] == 4 && results[4] == 0 &&
+        stats.table_updates == 1 && fs_read(fd, read_buffer, 10) == 10 &&
+        memcmp(read_buffer, "abcdefghij", 10) == 0) {
+        printf("Test 81: Passed\n");
+    } else {
+        printf("Test 81: Failed\n");
+    }
+    fs_close(fd);
+    fs_rm("file1");
+}
+
+void test82() {
+    // Test 82: The file due first in a batch goes first, and a batch that
+    // does not fit in the queue is refused whole
+    printf("Test 82: Batches run earliest deadline first\n");
+    static char data[FS_SECTOR_SIZE];
+    // Leave a single free sector, which only one of the files can have
+    int fd = fs_open("full", MODE_CREATE | MODE_WRITE);
+    fs_seek(fd, (data_sectors() - 1) * FS_SECTOR_SIZE - 1, FS_SEEK_SET);
+    fs_write(fd, "x", 1);
+    fs_close(fd);
+    int fd1 = fs_open("file1", MODE_CREATE | MODE_WRITE);
+    int fd2 = fs_open("file2", MODE_CREATE | MODE_WRITE);
+    int results[3] = {0};
+    FsAsyncOp ops[FS_ASYNC_QUEUE + 1] = {
+        {fd1, data, sizeof(data), FS_ASYNC_WRITE_DEADLINE, store_result,
+         &results[0]},
+        {fd2, data, 1, FS_ASYNC_WRITE_DEADLINE, store_result, &results[1]},
+        {fd2, NULL, 0, FS_ASYNC_SYNC_DEADLINE, store_result, &results[2]},
+    };
+    int queued = fs_async_batch(ops, 3);
+    fs_async_wait();
+    int refused = fs_async_batch(ops, FS_ASYNC_QUEUE + 1) == QUEUE_FULL &&
+                  fs_async_poll() == 0;
+    fs_close(fd1);
+    fs_close(fd2);
+    fs_rm("file1");
+    fs_rm("file2");
+    fs_rm("full");
+    if (queued == 0 && results[0] == NO_SPACE && results[1] == 1 &&
+        results[2] == 0 && refused) {
+        printf("Test 82: Passed\n");
+    } else {
+        printf("Test 82: Failed\n");
+    }
+}
+
+void test83() {
+    // Test 83: fs_stat reports files, directories and the root
+    printf("Test 83: Stat a file, a directory and the root\n");
+    fs_mkdir("dir");
+    int fd = fs_open("dir/file1", MODE_CREATE | MODE_WRITE);
+    fs_write(fd, "hello", 5);
+    fs_close(fd);
+    FsStat file_st, dir_st, root_st, missing_st;
+    if (fs_stat("dir/file1", &file_st) == 0 && file_st.size == 5 &&
+        !file_st.is_dir && !file_st.compressed &&
+        fs_stat("dir", &dir_st) == 0 && dir_st.is_dir &&
+        fs_stat("/", &root_st) == 0 && root_st.is_dir &&
+        fs_stat("dir/missing", &missing_st) == FILE_NOT_FOUND &&
+        fs_stat("dir/file1/x", &missing_st) == NOT_A_DIRECTORY) {
+        printf("Test 83: Passed\n");
+    } else {
+        printf("Test 83: Failed\n");
+    }
+    fs_rm("dir/file1");
+    fs_rmdir("dir");
+}
+
+void test84() {
+    // Test 84: fs_readdir lists every entry of a directory once, and refuses
+    // a cookie that is not one of them, here an entry of the root
+    printf("Test 84: Read a directory entry by entry\n");
+    fs_mkdir("dir");
+    fs_mkdir("dir/sub");
+    fs_create("dir/file1");
+    fs_create("dir/file2");
+    fs_create("file3");
+    char name[FS_NAME_SIZE];
+    FsStat st;
+    int found = 0, dirs = 0, count = 0;
+    int cookie = 0;
+    while ((cookie = fs_readdir("dir", cookie, name, &st)) > 0 &&
+           count < FS_FILE_ENTRIES) {
+        count++;
+        found |= strcmp(name, "sub") == 0     ? 1
+                 : strcmp(name, "file1") == 0 ? 2
+                 : strcmp(name, "file2") == 0 ? 4
+                                              : 8;
+        dirs += st.is_dir;
+    }
+    int outside = fs_readdir("/", 0, name, &st);
+    int invalid = fs_readdir("dir", outside, name, &st);
+    if (cookie == 0 && count == 3 && found == 7 && dirs == 1 &&
+        outside > 0 && invalid == INVALID_POSITION &&
+        fs_readdir("file3", 0, name, &st) == NOT_A_DIRECTORY) {
+        printf("Test 84: Passed\n");
+    } else {
+        printf("Test 84: Failed\n");
+    }
+    fs_rm("dir/file1");
+    fs_rm("dir/file2");
+    fs_rm("file3");
+    fs_rmdir("dir/sub");
+    fs_rmdir("dir");
+}
+
+void test85() {
+    // Test 85: Commands leave their result in cli_status
+    printf("Test 85: Commands report their result\n");
+    char create[] = "create file1";
+    char create_again[] = "create file1";
+    char open[] = "open file1 w";
+    char write[32];
+    char missing[] = "open";
+    char unknown[] = "bogus";
+    char rm[] = "rm file1";
+    int results[7];
+    execute_command(create);
+    results[0] = cli_status;
+    execute_command(create_again);
+    results[1] = cli_status;
+    execute_command(open);
+    results[2] = cli_status;
+    int fd = cli_status;
+    snprintf(write, sizeof(write), "write %d \"hello\"", fd);
+    execute_command(write);
+    results[3] = cli_status;
+    fs_close(fd);
+    execute_command(missing);
+    results[4] = cli_status;
+    execute_command(unknown);
+    results[5] = cli_status;
+    execute_command(rm);
+    results[6] = cli_status;
+    if (results[0] == 0 && results[1] == FILE_ALREADY_EXISTS &&
+        results[2] >= 0 && results[3] == 5 &&
+        results[4] == CLI_BAD_ARGUMENTS && results[5] == CLI_UNKNOWN_COMMAND &&
+        results[6] == 0) {
+        printf("Test 85: Passed\n");
+    } else {
+        printf("Test 85: Failed\n");
+    }
+}
+
+void test86() {
+    // Test 86: A script runs its commands until one fails, skipping comments
+    // and blank lines
+    printf("Test 86: Run scripts stored in the filesystem\n");
+    const char *good = "# Make a directory with two files\n"
+                       "mkdir dir\n"
+                       "\n"
+                       "create dir/file1\r\n"
+                       "cp dir/file1 dir/file2";
+    const char *bad = "create file1\ncreate file1\ncreate file2\n";
+    int fd = fs_open("good", MODE_CREATE | MODE_WRITE);
+    fs_write(fd, good, strlen(good));
+    fs_close(fd);
+    fd = fs_open("bad", MODE_CREATE | MODE_WRITE);
+    fs_write(fd, bad, strlen(bad));
+    fs_close(fd);
+    char source_good[] = "source good";
+    char source_bad[] = "source bad";
+    char source_missing[] = "source missing";
+    FsStat st;
+    execute_command(source_good);
+    int good_status = cli_status;
+    int good_files = fs_stat("dir/file1", &st) == 0 &&
+                     fs_stat("dir/file2", &st) == 0;
+    execute_command(source_bad);
+    int bad_status = cli_status;
+    int stopped = fs_stat("file1", &st) == 0 &&
+                  fs_stat("file2", &st) == FILE_NOT_FOUND;
+    execute_command(source_missing);
+    if (good_status == 0 && good_files && bad_status == FILE_ALREADY_EXISTS &&
+        stopped && cli_status == FILE_NOT_FOUND) {
+        printf("Test 86: Passed\n");
+    } else {
+        printf("Test 86: Failed\n");
+    }
+    fs_rm("dir/file1");
+    fs_rm("dir/file2");
+    fs_rmdir("dir");
+    fs_rm("file1");
+    fs_rm("good");
+    fs_rm("bad");
+}
+
+void test87() {
+    // Test 87: A write-back write spanning more sectors than there are cache
+    // slots keeps every byte of the slots evicted before the file grew
+    printf("Test 87: Write back a write spanning several sectors\n");
+    static char data[3 * FS_SECTOR_SIZE];
+    static char read_buffer[3 * FS_SECTOR_SIZE];
+    for (int i = 0; i < (int)sizeof(data); i++) {
+        data[i] = i * 7 + i / 256;
+    }
+    int fd = fs_open("file1", MODE_CREATE | MODE_WRITE);
+    fs_write(fd, data, FS_SECTOR_SIZE + 100);
+    fs_close(fd);
+    fd = fs_open("file1", MODE_WRITE | MODE_WRITEBACK);
+    fs_seek(fd, FS_SECTOR_SIZE + 50, FS_SEEK_SET);
+    int written = fs_write(fd, data, sizeof(data));
+    fs_close(fd);
+    fd = fs_open("file1", MODE_READ | MODE_VERIFY);
+    fs_seek(fd, FS_SECTOR_SIZE + 50, FS_SEEK_SET);
+    int read = fs_read(fd, read_buffer, sizeof(read_buffer));
+    int size = fs_seek(fd, 0, FS_SEEK_END);
+    fs_close(fd);
+    if (written == (int)sizeof(data) && read == (int)sizeof(data) &&
+        size == FS_SECTOR_SIZE + 50 + (int)sizeof(data) &&
+        memcmp(data, read_buffer, sizeof(data)) == 0) {
+        printf("Test 87: Passed\n");
+    } else {
+        printf("Test 87: Failed\n");
+    }
+    fs_rm("file1");
+}
+
+void test88() {
+    // Test 88: A compressed append that runs out of space keeps the blocks
+    // it stored and returns the bytes they hold
+    printf("Test 88: Fill the volume with a compressed append\n");
+    static char data[5 * FS_BLOCK_SIZE];
+    static char read_buffer[5 * FS_BLOCK_SIZE];
+    uint32_t seed = 88;
+    for (int i = 0; i < (int)sizeof(data); i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = seed >> 16;
+    }
+    // Leave three free sectors, room for two blocks that do not compress
+    int fd = fs_open("full", MODE_CREATE | MODE_WRITE);
+    fs_seek(fd, (data_sectors() - 3) * FS_SECTOR_SIZE - 1, FS_SEEK_SET);
+    fs_write(fd, "x", 1);
+    fs_close(fd);
+    fd = fs_open("file1", MODE_CREATE | MODE_APPEND | MODE_COMPRESS);
+    int written = fs_write(fd, data, sizeof(data));
+    fs_close(fd);
+    fd = fs_open("file1", MODE_READ);
+    int size = fs_seek(fd, 0, FS_SEEK_END);
+    fs_seek(fd, 0, FS_SEEK_SET);
+    int read = fs_read(fd, read_buffer, sizeof(read_buffer));
+    fs_close(fd);
+    fs_rm("file1");
+    fs_rm("full");
+    if (written == 2 * FS_BLOCK_SIZE && size == written && read == written &&
+        memcmp(data, read_buffer, written) == 0) {
+        printf("Test 88: Passed\n");
+    } else {
+        printf("Test 88: Failed\n");
+    }
+}
+
+// Record slot the next copy of the file table goes to, from filesystem.c
+extern uint32_t meta_next;
+uint32_t meta_offset(uint32_t record);
+
+void test89() {
+    // Test 89: A copy of the file table cut short by a power loss does not
+    // swallow the next update
+    printf("Test 89: Updates after a torn copy of the file table are kept\n");
+    fs_create("file1");
+    // Program the header and part of the next copy, as a power loss while
+    // it was programmed would, without its commit word
+    uint8_t torn[FS_PAGE_SIZE];
+    memset(torn, 0, sizeof(torn));
+    memset(torn + offsetof(MetaHeader, commit), 0xFF, 8);
+    uint32_t offset = meta_offset(meta_next);
+    flash_program_safe(offset / FS_SECTOR_SIZE, offset % FS_SECTOR_SIZE, torn,
+                       sizeof(torn));
+    init_filesystem();
+    int fd = fs_open("file1", MODE_READ);
+    int kept = fd >= 0;
+    fs_close(fd);
+    int created = fs_create("file2");
+    // Pre-erasing must not touch what the newest copy refers to
+    while (fs_idle() > 0) {
+    }
+    init_filesystem();
+    fd = fs_open("file2", MODE_READ);
+    fs_close(fd);
+    fs_rm("file1");
+    fs_rm("file2");
+    if (kept && created > 0 && fd >= 0) {
+        printf("Test 89: Passed\n");
+    } else {
+        printf("Test 89: Failed\n");
+    }
+}
+
+void test90() {
+    // Test 90: A merged batch of writes that stops part way gives each write
+    // the bytes of it that went in, and writes none of them twice
+    printf("Test 90: A batch that fills the volume is not written twice\n");
+    static char data[3 * FS_BLOCK_SIZE];
+    static char read_buffer[3 * FS_BLOCK_SIZE];
+    uint32_t seed = 90;
+    for (int i = 0; i < (int)sizeof(data); i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = seed >> 16;
+    }
+    // Leave three free sectors, room for two blocks that do not compress
+    int fd = fs_open("full", MODE_CREATE | MODE_WRITE);
+    fs_seek(fd, (data_sectors() - 3) * FS_SECTOR_SIZE - 1, FS_SEEK_SET);
+    fs_write(fd, "x", 1);
+    fs_close(fd);
+    fd = fs_open("file1", MODE_CREATE | MODE_WRITE | MODE_COMPRESS);
+    int results[3] = {0};
+    FsAsyncOp ops[3];
+    for (int i = 0; i < 3; i++) {
+        ops[i] = (FsAsyncOp){fd, data + i * FS_BLOCK_SIZE, FS_BLOCK_SIZE,
+                             FS_ASYNC_WRITE_DEADLINE, store_result,
+                             &results[i]};
+    }
+    int queued = fs_async_batch(ops, 3);
+    fs_async_wait();
+    fs_close(fd);
+    fd = fs_open("file1", MODE_READ);
+    int size = fs_seek(fd, 0, FS_SEEK_END);
+    fs_seek(fd, 0, FS_SEEK_SET);
+    int read = fs_read(fd, read_buffer, sizeof(read_buffer));
+    fs_close(fd);
+    fs_rm("file1");
+    fs_rm("full");
+    if (queued == 0 && results[0] == FS_BLOCK_SIZE &&
+        results[1] == FS_BLOCK_SIZE && results[2] == 0 &&
+        size == 2 * FS_BLOCK_SIZE && read == size &&
+        memcmp(data, read_buffer, size) == 0) {
+        printf("Test 90: Passed\n");
+    } else {
+        printf("Test 90: Failed\n");
+    }
+}
@@ -42,18 +42,58 @@ void test34();
 void test35();
 void test36();
 void test37();
-// void test38();
-// void test39();
-// void test40();
-// void test41();
-// void test42();
-// void test43();
-// void test44();
-// void test45();
-// void test46();
-// void test47();
-// void test48();
-// void test49();
-// void test50();
+void test38();
+void test39();
+void test40();
+void test41();
+void test42();
+void test43();
+void test44();
+void test45();
+void test46();
+void test47();
+void test48();
+void test49();
+void test50();
+void test51();
+void test52();
+void test53();
+void test54();
+void test55();
+void test56();
+void test57();
+void test58();
+void test59();
+void test60();
+void test61();
+void test62();
+void test63();
+void test64();
+void test65();
+void test66();
+void test67();
+void test68();
+void test69();
+void test70();
+void test71();
+void test72();
+void test73();
+void test74();
+void test75();
+void test76();
+void test77();
+void test78();
+void test79();
+void test80();
+void test81();
+void test82();
+void test83();
+void test84();
+void test85();
+void test86();
+void test87();
+void test88();
+void test89();
+void test90();
 
 #endif
\ No newline at end of file